@@ -0,0 +1,142 @@
+#include "Arena.h"
+#include <new>
+
+using namespace emu;
+
+//Largest block carved from a slab
+#define ARENA_MAX_SLOT ((size_t)ARENA_MIN_SLOT << (ARENA_CLASSES - 1))
+
+//======================================================
+//Arena
+//======================================================
+
+Arena::~Arena() {
+	for (void* slab : slabs)
+		::operator delete(slab);
+}
+
+int Arena::sizeClass(size_t size, bool grow) {
+	int sclass = 0;
+	while (((size_t)ARENA_MIN_SLOT << sclass) < size)
+		sclass++;
+	//Blocks filling most of their slot keep it
+	size_t exact = (size + ARENA_MIN_SLOT - 1) / ARENA_MIN_SLOT * ARENA_MIN_SLOT;
+	if (exact * 4 > slotSize(sclass) * 3)
+		return sclass;
+	//A size gets its fitted class on its first allocation or never, so a block is always
+	//released to the class it came from
+	for (int i = 0; i < fittedcount; i++) {
+		if (fitted[i] == exact)
+			return ARENA_CLASSES + i;
+	}
+	if (grow && fittedcount < ARENA_FITTED) {
+		fitted[fittedcount] = exact;
+		return ARENA_CLASSES + fittedcount++;
+	}
+	return sclass;
+}
+
+size_t Arena::slotSize(int sclass) const {
+	return sclass < ARENA_CLASSES ? (size_t)ARENA_MIN_SLOT << sclass : fitted[sclass - ARENA_CLASSES];
+}
+
+void* Arena::allocate(size_t size) {
+	if (size > ARENA_MAX_SLOT)
+		return ::operator new(size);
+
+	std::lock_guard<std::mutex> lock(m);
+	int sclass = sizeClass(size, true);
+	size_t slot = slotSize(sclass);
+	if (freelist[sclass] != NULL) {
+		FreeSlot* taken = freelist[sclass];
+		freelist[sclass] = taken->next;
+		return taken;
+	}
+	if (left < slot) {
+		//The tail of the old slab is too small for this class and is left unused
+		BYTE* slab = static_cast<BYTE*>(::operator new(ARENA_SLAB_SIZE + ARENA_MIN_SLOT));
+		slabs.push_back(slab);
+		bump = slab + (ARENA_MIN_SLOT - (uintptr_t)slab % ARENA_MIN_SLOT);
+		left = ARENA_SLAB_SIZE;
+	}
+	void* carved = bump;
+	bump += slot;
+	left -= slot;
+	return carved;
+}
+
+void Arena::release(void* block, size_t size) {
+	if (size > ARENA_MAX_SLOT) {
+		::operator delete(block);
+		return;
+	}
+	std::lock_guard<std::mutex> lock(m);
+	int sclass = sizeClass(size, false);
+	FreeSlot* freed = static_cast<FreeSlot*>(block);
+	freed->next = freelist[sclass];
+	freelist[sclass] = freed;
+}
+
+size_t Arena::getSlabCount() {
+	std::lock_guard<std::mutex> lock(m);
+	return slabs.size();
+}
+
+/* Standard allocator over an arena, or the heap if there is none. Lets shared_ptr carve its
+ * shared count from the arena. */
+template<class T>
+struct ArenaAllocator {
+	typedef T value_type;
+	ArenaAllocator(Arena* owner) : arena(owner) {};
+	template<class U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {};
+	T* allocate(size_t n) {
+		return static_cast<T*>(arena != NULL ? arena->allocate(n * sizeof(T)) : ::operator new(n * sizeof(T)));
+	}
+	void deallocate(T* block, size_t n) {
+		if (arena != NULL)
+			arena->release(block, n * sizeof(T));
+		else
+			::operator delete(block);
+	}
+	template<class U>
+	bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+	template<class U>
+	bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+	Arena* arena;
+};
+
+std::shared_ptr<BYTE> Arena::allocateShared(Arena* arena, size_t size) {
+	ArenaAllocator<BYTE> alloc(arena);
+	BYTE* data = alloc.allocate(size);
+	return std::shared_ptr<BYTE>(data, [alloc, size](BYTE* block) mutable { alloc.deallocate(block, size); }, alloc);
+}
+
+//======================================================
+//ArenaObject
+//======================================================
+
+//Placed before every ArenaObject, padded to keep the object aligned as the heap would
+struct ArenaHeader {
+	Arena* arena;
+	size_t size;
+};
+#define ARENA_HEADER_SIZE 16
+
+void* ArenaObject::operator new(size_t size, Arena* arena) {
+	size += ARENA_HEADER_SIZE;
+	ArenaHeader* header = static_cast<ArenaHeader*>(arena != NULL ? arena->allocate(size) : ::operator new(size));
+	header->arena = arena;
+	header->size = size;
+	return reinterpret_cast<BYTE*>(header) + ARENA_HEADER_SIZE;
+}
+
+void ArenaObject::operator delete(void* object) {
+	if (object == NULL)
+		return;
+	ArenaHeader* header = reinterpret_cast<ArenaHeader*>(static_cast<BYTE*>(object) - ARENA_HEADER_SIZE);
+	if (header->arena != NULL)
+		header->arena->release(header, header->size);
+	else
+		::operator delete(header);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#ifdef __ARENA_H__
+#error __ARENA_H__ Already defined!
+#else
+#define __ARENA_H__
+#endif
+
+#include "NTDef.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//Bytes the arena takes from the heap at a time
+#define ARENA_SLAB_SIZE		0x40000
+//Slot sizes are ARENA_MIN_SLOT << n for n < ARENA_CLASSES, the largest 16 Kb
+#define ARENA_MIN_SLOT		64
+#define ARENA_CLASSES		9
+//Most exact size classes an arena adds, see Arena
+#define ARENA_FITTED		4
+
+namespace emu {
+
+	/* Slab allocator for the machines of a pool. Blocks are carved from 256 Kb slabs in a
+	 * handful of cache line aligned size classes, and freed blocks go on a free list of their
+	 * class for the next instance, so creating and tearing down instances leaves the global heap
+	 * alone once the pool has warmed up. The classes are powers of two, plus an exact class for
+	 * each of the first ARENA_FITTED sizes that would waste over a quarter of their power of two,
+	 * such as a mapper's memory block. The slabs are given back all at once when the arena is
+	 * destroyed, which must be after everything carved from it. Larger blocks fall through to the
+	 * heap. Thread-safe.
+	 */
+	class Arena {
+	public:
+		Arena() : fittedcount(0), bump(NULL), left(0) {
+			for (int i = 0; i < ARENA_CLASSES + ARENA_FITTED; i++)
+				freelist[i] = NULL;
+		};
+		~Arena();
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+
+		/* A block of at least size bytes, aligned to ARENA_MIN_SLOT. */
+		void* allocate(size_t size);
+		/* Return a block from allocate, with the size it was allocated with. */
+		void release(void* block, size_t size);
+		/* Shared storage of size bytes, with the shared count carved from arena too. The
+		 * global heap is used when arena is NULL. */
+		static std::shared_ptr<BYTE> allocateShared(Arena* arena, size_t size);
+		/* Number of slabs taken from the heap. */
+		size_t getSlabCount();
+	private:
+		struct FreeSlot {
+			FreeSlot* next;
+		};
+		//Size class of a block that fits a slot. A fitted class is added for it if grow is set
+		//and there is room. Call with m held.
+		int sizeClass(size_t size, bool grow);
+		//Bytes in a slot of a size class
+		size_t slotSize(int sclass) const;
+
+		std::mutex m;
+		//Power of two classes, then fitted ones
+		FreeSlot* freelist[ARENA_CLASSES + ARENA_FITTED];
+		//Slot sizes of the fitted classes
+		size_t fitted[ARENA_FITTED];
+		int fittedcount;
+		std::vector<void*> slabs;
+		//Unused end of the newest slab
+		BYTE* bump;
+		size_t left;
+	};
+
+	/* Base of objects that may be carved from an Arena: new (arena) T(...) places one there,
+	 * plain new uses the global heap, and delete returns the object to where it came from. */
+	class ArenaObject {
+	public:
+		static void* operator new(size_t size) { return operator new(size, (Arena*)NULL); }
+		static void* operator new(size_t size, Arena* arena);
+		static void operator delete(void* object);
+		static void operator delete(void* object, Arena*) { operator delete(object); }
+	};
+
+}
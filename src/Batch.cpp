@@ -0,0 +1,182 @@
+#include "Batch.h"
+#include <chrono>
+
+using namespace emu;
+
+//======================================================
+//BatchRunner
+//======================================================
+
+BatchRunner::BatchRunner(unsigned threadcount) :
+	slicesize(TICKS_PER_FRAME), generation(0), active(0), shutdown(false), pending(0), queued(0), idlers(0),
+	seconds(0)
+{
+	if (threadcount == 0)
+		threadcount = std::thread::hardware_concurrency();
+	if (threadcount == 0)
+		threadcount = 1;
+
+	for (unsigned i = 0; i < threadcount; i++)
+		workers.emplace_back(new Worker());
+	for (unsigned i = 0; i < threadcount; i++)
+		threads.emplace_back(&BatchRunner::workerLoop, this, i);
+}
+
+BatchRunner::~BatchRunner() {
+	{
+		std::lock_guard<std::mutex> lock(runm);
+		shutdown = true;
+	}
+	startcv.notify_all();
+	for (auto& thread : threads)
+		thread.join();
+}
+
+int BatchRunner::addInstance(Mapper* mapper, const CPU& cpu) {
+	instances.emplace_back(new Instance(mapper, cpu));
+	instances.back()->emulator.setRunControl(&control);
+	return (int)instances.size() - 1;
+}
+
+void BatchRunner::run(long budget, int slice) {
+	if (instances.empty() || budget <= 0)
+		return;
+	slicesize = slice > 0 ? slice : TICKS_PER_FRAME;
+	auto start = std::chrono::steady_clock::now();
+
+	//Counted before the first task is out, as a worker may take it at once. The last run left
+	//no worker inside it, so nothing else is counting down.
+	pending.store((int)instances.size());
+	//Deal the instances out round-robin. Workers rebalance by stealing.
+	for (size_t id = 0; id < instances.size(); id++) {
+		Instance& inst = *instances[id];
+		inst.budget = budget;
+		inst.status = { 0, inst.emulator.getErrorState(), false };
+		pushTask(*workers[id % workers.size()], (int)id);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(runm);
+		generation++;
+	}
+	startcv.notify_all();
+	{
+		std::unique_lock<std::mutex> lock(runm);
+		donecv.wait(lock, [this] { return pending.load() == 0 && active == 0; });
+	}
+	std::chrono::duration<double> runtime = std::chrono::steady_clock::now() - start;
+	seconds += runtime.count();
+}
+
+BatchCounters BatchRunner::getCounters() const {
+	BatchCounters counters = { 0, 0, 0, 0, seconds };
+	for (auto& worker : workers) {
+		counters.ticks += worker->ticks.load(std::memory_order_relaxed);
+		counters.slices += worker->slices.load(std::memory_order_relaxed);
+		counters.steals += worker->steals.load(std::memory_order_relaxed);
+		counters.completed += worker->completed.load(std::memory_order_relaxed);
+	}
+	return counters;
+}
+
+void BatchRunner::workerLoop(unsigned self) {
+	Worker& worker = *workers[self];
+	unsigned seen = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(runm);
+			startcv.wait(lock, [&] { return shutdown || generation != seen; });
+			if (shutdown)
+				return;
+			seen = generation;
+			active++;
+		}
+
+		for (;;) {
+			int id;
+			if (takeTask(self, id)) {
+				if (!runSlice(worker, id))
+					pushTask(worker, id);
+				else if (pending.fetch_sub(1) == 1) {
+					std::lock_guard<std::mutex> lock(runm);
+					workcv.notify_all();
+				}
+				continue;
+			}
+
+			//Every remaining instance is held by another worker, or the run is over
+			std::unique_lock<std::mutex> lock(runm);
+			if (pending.load() == 0)
+				break;
+			idlers++;
+			workcv.wait(lock, [this] { return pending.load() == 0 || queued.load() > 0; });
+			idlers--;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(runm);
+			active--;
+		}
+		donecv.notify_all();
+	}
+}
+
+void BatchRunner::pushTask(Worker& worker, int id) {
+	{
+		std::lock_guard<std::mutex> lock(worker.m);
+		worker.tasks.push_back(id);
+	}
+	//A sleeper counted itself before looking at queued, so either it sees the task or it is notified
+	queued.fetch_add(1);
+	if (idlers.load() > 0) {
+		std::lock_guard<std::mutex> lock(runm);
+		workcv.notify_one();
+	}
+}
+
+bool BatchRunner::takeTask(unsigned self, int& id) {
+	{
+		Worker& worker = *workers[self];
+		std::lock_guard<std::mutex> lock(worker.m);
+		if (!worker.tasks.empty()) {
+			id = worker.tasks.back();
+			worker.tasks.pop_back();
+			queued.fetch_sub(1);
+			return true;
+		}
+	}
+	for (size_t i = 1; i < workers.size(); i++) {
+		Worker& victim = *workers[(self + i) % workers.size()];
+		std::lock_guard<std::mutex> lock(victim.m);
+		if (!victim.tasks.empty()) {
+			id = victim.tasks.front();
+			victim.tasks.pop_front();
+			queued.fetch_sub(1);
+			workers[self]->steals.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool BatchRunner::runSlice(Worker& worker, int id) {
+	Instance& inst = *instances[id];
+	//errstate is sticky, an instance that already faulted is not run again
+	if (inst.status.error == NONE) {
+		int ticks = inst.budget < slicesize ? (int)inst.budget : slicesize;
+		int used = ticks - inst.emulator.emulate_cpu(ticks);
+		inst.budget -= used;
+		inst.status.ticks_run += used;
+		inst.status.error = inst.emulator.getErrorState();
+		worker.ticks.fetch_add(used, std::memory_order_relaxed);
+		worker.slices.fetch_add(1, std::memory_order_relaxed);
+	}
+	if (inst.status.error == NONE && inst.budget > 0)
+		return false;
+
+	inst.status.complete = true;
+	worker.completed.fetch_add(1, std::memory_order_relaxed);
+	if (onComplete)
+		onComplete(id, inst.status);
+	return true;
+}
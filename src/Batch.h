@@ -0,0 +1,137 @@
+#pragma once
+
+#ifdef __BATCH_H__
+#error __BATCH_H__ Already defined!
+#else
+#define __BATCH_H__
+#endif
+
+#include "NTDef.h"
+#include "Mapper.h"
+#include "Emulator.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//CPU ticks in one NTSC frame (341 * 262 / 3, rounded up)
+#define TICKS_PER_FRAME 29781
+
+namespace emu {
+
+	/* Progress of one instance in the current BatchRunner::run. */
+	struct InstanceStatus {
+		long ticks_run;
+		ERROR_STATE error;
+		bool complete;
+	};
+
+	/* Aggregate throughput of a BatchRunner. Totals since construction, seconds is wall time spent in run. */
+	struct BatchCounters {
+		unsigned long long ticks;
+		unsigned long long slices;
+		unsigned long long steals;
+		unsigned long long completed;
+		double seconds;
+		double ticksPerSecond() const { return seconds > 0 ? ticks / seconds : 0; }
+	};
+
+	/* Owns a pool of Mapper + CPU + Emulator2A03 instances and advances them on a pool of
+	 * worker threads. Each worker keeps a deque of instance ids; it takes work from the back
+	 * of its own deque and steals from the front of the others when empty. A task advances
+	 * one instance by one slice, after which the instance is requeued on the same worker.
+	 * Workers finding every deque empty sleep until an instance is requeued or the run ends.
+	 */
+	class BatchRunner {
+	public:
+		typedef std::function<void(int id, const InstanceStatus& status)> CompletionHandler;
+
+		/* @threads Number of worker threads. 0 uses every hardware thread. */
+		explicit BatchRunner(unsigned threads = 0);
+		~BatchRunner();
+		BatchRunner(const BatchRunner&) = delete;
+		BatchRunner& operator=(const BatchRunner&) = delete;
+
+		/* Add an instance. Takes ownership of mapper. Not thread-safe with run.
+		 * @return The instance id.
+		 */
+		int addInstance(Mapper* mapper, const CPU& cpu);
+		int getInstanceCount() const { return (int)instances.size(); }
+		Mapper& getMapper(int id) { return *instances[id]->mapper; }
+		CPU& getCPU(int id) { return instances[id]->cpu; }
+		Emulator2A03& getEmulator(int id) { return instances[id]->emulator; }
+		const InstanceStatus& getStatus(int id) const { return instances[id]->status; }
+
+		/* Called on a worker thread as each instance completes. Set before run. */
+		void setCompletionHandler(CompletionHandler handler) { onComplete = handler; }
+
+		/* Advance every instance by budget ticks, slice ticks per task. An instance completes when
+		 * its budget is spent or the CPU reports an error. Blocks until every instance completes.
+		 */
+		void run(long budget, int slice = TICKS_PER_FRAME);
+		/* Advance every instance by a number of NTSC frames, one frame per task. */
+		void runFrames(int frames) { run((long)frames * TICKS_PER_FRAME, TICKS_PER_FRAME); }
+		/* Hold every instance at its next poll (see RUN_POLL_TICKS) until resume, with the
+		 * workers asleep. run keeps blocking while paused. Thread-safe. */
+		void pause() { control.pause(); }
+		void resume() { control.resume(); }
+
+		/* Sum of the per-worker counters. May be called while run is in progress. */
+		BatchCounters getCounters() const;
+		unsigned getThreadCount() const { return (unsigned)threads.size(); }
+	private:
+		struct Instance : Machine {
+			Instance(Mapper* mappa, const CPU& proc) : Machine(mappa, proc), budget(0)
+			{
+				status = { 0, NONE, false };
+			}
+			long budget;
+			InstanceStatus status;
+		};
+
+		//Counters are only written by the owning worker. Aligned to keep workers off each other's cache lines.
+		struct alignas(64) Worker {
+			std::mutex m;
+			std::deque<int> tasks;
+			std::atomic<unsigned long long> ticks{ 0 };
+			std::atomic<unsigned long long> slices{ 0 };
+			std::atomic<unsigned long long> steals{ 0 };
+			std::atomic<unsigned long long> completed{ 0 };
+		};
+
+		void workerLoop(unsigned self);
+		//Take a task from the own deque, else steal one. Returns false if every deque is empty.
+		bool takeTask(unsigned self, int& id);
+		//Run one slice of an instance. Returns true if the instance completed.
+		bool runSlice(Worker& worker, int id);
+		//Queue an instance on worker, waking a sleeping worker to take it
+		void pushTask(Worker& worker, int id);
+
+		//Followed by every instance
+		RunControl control;
+		std::vector<std::unique_ptr<Instance>> instances;
+		std::vector<std::unique_ptr<Worker>> workers;
+		std::vector<std::thread> threads;
+		CompletionHandler onComplete;
+		int slicesize;
+
+		std::mutex runm;
+		std::condition_variable startcv;
+		std::condition_variable donecv;
+		//Workers with nothing to take sleep on workcv while idlers counts them
+		std::condition_variable workcv;
+		unsigned generation;
+		//Workers inside the current run, which returns once none are
+		unsigned active;
+		bool shutdown;
+		std::atomic<int> pending;
+		std::atomic<int> queued;
+		std::atomic<int> idlers;
+		double seconds;
+	};
+
+}
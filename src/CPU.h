@@ -0,0 +1,85 @@
+#pragma once
+
+#ifdef __CPU_H__
+#error __CPU_H__ Already defined!
+#else
+#define __CPU_H__
+#endif
+
+#include "NTDef.h"
+
+/* CPU registers and the block calling conventions. Kept free of Mapper so that modules
+ * written by the recompiler (see Recompiled.h) link against nothing of the emulator.
+ */
+
+namespace emu {
+
+	extern const BYTE OPTICK[];
+
+	//BAD_READ and BAD_WRITE are accesses refused by the mapper's policy, see Emulator2A03::getFaultAddress
+	enum ERROR_STATE { NONE, CPU_LOCK, UNKNOWN_INSTRUCTION, BAD_READ, BAD_WRITE };
+
+	struct CPU {
+		REG_S16B progcount;
+		REG_S8B accumulator;
+		REG_S8B xindex;
+		REG_S8B yindex;
+		REG_S8B stackp;
+		uint8_t procstat;
+		REG_S8B temp;
+		REG_S8B debug;
+		//Results N and Z are taken from while the core runs (see settleFlags)
+		REG_S8B nresult;
+		REG_S8B zresult;
+	};
+
+	void initializeCPU(CPU& cpu);
+
+	/* N and Z are set by nearly every opcode and read by few, so the core only records the
+	 * result they come from: N is bit 7 of nresult and Z is set when zresult is 0. The bits
+	 * in procstat are stale while the core runs. They are worked out when PHP or BRK push
+	 * procstat and when the core returns, so procstat is exact whenever it can be observed.
+	 */
+	#define LAZY_NZ(cpu, VAL) ((cpu).nresult.unsigned8 = (cpu).zresult.unsigned8 = (VAL))
+	#define LAZY_N(cpu, VAL) ((cpu).nresult.unsigned8 = (VAL))
+	#define LAZY_Z(cpu, VAL) ((cpu).zresult.unsigned8 = (VAL))
+	#define LAZYF_NEG(cpu) ((cpu).nresult.signed8 < 0)
+	#define LAZYF_ZERO(cpu) ((cpu).zresult.unsigned8 == 0)
+
+	/* procstat with the recorded N and Z worked in. */
+	inline uint8_t settledFlags(const CPU& cpu) {
+		return (cpu.procstat & ~(NEG_BIT | ZERO_BIT)) | (cpu.nresult.unsigned8 & NEG_BIT) |
+			(cpu.zresult.unsigned8 == 0 ? ZERO_BIT : 0);
+	}
+	inline void settleFlags(CPU& cpu) { cpu.procstat = settledFlags(cpu); }
+	/* Record N and Z from procstat, after it was set from outside the core or pulled. */
+	inline void loadFlags(CPU& cpu) {
+		cpu.nresult.unsigned8 = cpu.procstat & NEG_BIT;
+		cpu.zresult.unsigned8 = F_ZERO(cpu.procstat) ? 0 : 1;
+	}
+
+	//Most opcodes recorded into one block
+	#define BLOCK_MAX_OPS 16
+
+	/* Opcode recorded into a block, with its base tick cost and address. */
+	struct MicroOp {
+		OPCODE code;
+		uint8_t ticks;
+		ADDR_16B pc;
+	};
+
+	/* Native translation of a block. Returns (opcodes run << 8) | ERROR_STATE. */
+	typedef int (*NativeBlock)(void* mapper, CPU* cpu);
+
+	//Interpreter handler of one opcode, as seen by recompiled code
+	typedef int (*RecompiledOp)(void* mapper, CPU* cpu);
+	/* What the emulator hands a recompiled block: the handlers of its core and the
+	 * generations of its mapper's pages. */
+	struct RecompiledHost {
+		RecompiledOp handlers[256];
+		const uint32_t* pagegen;
+	};
+	/* Block compiled ahead of time (see Recompiled.h). Returns as NativeBlock. */
+	typedef int (*RecompiledFn)(void* mapper, CPU* cpu, const RecompiledHost* host);
+
+}
@@ -6,22 +6,43 @@
 #define __DEBUG_H__
 #endif
 
-/* STRICT enforcement increases the fidelity of the emulator at the cost of speed.
- * MINIMUM enforcement is recommended but not required for a correctly programmed ROM. At the
- * very least make sure ENFORCE_READONLY_MINIMUM is defined to ensure that ROM space is not written to.
- */
-
 //Ensure integer wrap. Useful for architectures with different wrap mechanisms from 6502.
+//A property of the host rather than of the ROM, so it stays one switch per build.
 //#define ENFORCE_OVRFLOWSEMANTICS
 
-//Ensure data values are written to all stack mirrors.
-#define ENFORCE_STACK_MIRROR
+namespace emu {
+
+	/* Enforcement policies. STRICT enforcement increases the fidelity of the emulator at the cost
+	 * of speed. MINIMUM enforcement is recommended but not required for a correctly programmed
+	 * ROM. Mappers are instantiated on a policy (see BasicDefaultMapper) and Emulator2A03 runs the
+	 * interpreter instantiated on the mapper's, so one process can hold fast and strict instances
+	 * side by side. Checks are compile-time constants; a policy without them pays nothing.
+	 * A refused access is dropped and reported through ERROR_STATE as BAD_READ or BAD_WRITE
+	 * (see MemoryFault); nothing throws.
+	 * Stack mirrors need no check: every RAM mirror maps the one copy of RAM.
+	 */
+	enum class Enforcement { FAST, STRICT };
 
-//Ensure no trainer is used in ROM.
-#define ENFORCE_NOTRAINER
+	/* What every instance gets unless asked for more. */
+	struct FastPolicy {
+		static const Enforcement level = Enforcement::FAST;
+		//Ensure no trainer is used in ROM.
+		static const bool notrainer = true;
+		//Refuse writes to PRG-ROM and expansion ROM.
+		static const bool readonly_minimum = false;
+		//Also refuse writes to read-only registers.
+		static const bool readonly_strict = false;
+		//Refuse reads of write-only registers.
+		static const bool writeonly_minimum = false;
+	};
 
-//Enforce no read only ranges.
-#define ENFORCE_READONLY_NONE
+	/* Every check, for triage. */
+	struct StrictPolicy {
+		static const Enforcement level = Enforcement::STRICT;
+		static const bool notrainer = true;
+		static const bool readonly_minimum = true;
+		static const bool readonly_strict = true;
+		static const bool writeonly_minimum = true;
+	};
 
-//Enforce no write only ranges.
-#define ENFORCE_WRITEONLY_NONE
+}
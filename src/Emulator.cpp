@@ -1,5 +1,7 @@
 #include "Emulator.h"
 #include "Instructions.h"
+#include "Jit.h"
+#include "Recompiled.h"
 using namespace emu;
 
 /*Array of ticks corresponding to each OPCODE. Some opcodes have variable tick counts up to +2
@@ -36,123 +38,154 @@ void emu::initializeCPU(CPU& cpu) {
 	cpu.debug.unsigned8 = 0x00;
 	cpu.procstat = 0x00;
 	cpu.progcount = L_PRGROM;
+	loadFlags(cpu);
 }
 
 //======================================================
 //Emulator Helpers
 //======================================================
 
+//For the few helpers every handler must inline, however many handlers there are
+#ifdef __GNUC__
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE __forceinline
+#endif
+
+/* Read a byte from memory. Plain RAM/ROM pages are read straight from the mapper's
+ * read page table, everything else goes through readMemory. */
+template<class MAPPER>
+ALWAYS_INLINE BYTE read_byte(MAPPER& mapper, ADDR_16B addr)
+{
+	const BYTE* page = mapper.getReadPages()[addr >> 12];
+	if (page != NULL)
+		return page[addr & mapper.getPageMasks()[addr >> 12]];
+	return mapper.readMemory(addr);
+}
+
 //Read a 2-byte value from memory
 #define READ_WORD(MAPPER,ADDR) \
-	MAPPER.readMemory(ADDR) | (MAPPER.readMemory(ADDR + 1) << 8)
+	read_byte(MAPPER, ADDR) | (read_byte(MAPPER, ADDR + 1) << 8)
 
 //Memory GETs ==========================================
 
-MEM_BYTE GET_IMMEDIATE(Mapper& mapper, CPU& cpu)
+template<class MAPPER>
+inline MEM_BYTE GET_IMMEDIATE(MAPPER& mapper, CPU& cpu)
 {
 	MEM_BYTE byte;
-	byte.unsigned8 = mapper.readMemory(cpu.progcount);
+	byte.unsigned8 = read_byte(mapper, cpu.progcount);
 	++cpu.progcount;
 	return byte;
 }
 
-MEM_BYTE GET_ZPAGE(Mapper& mapper, CPU& cpu)
+template<class MAPPER>
+inline MEM_BYTE GET_ZPAGE(MAPPER& mapper, CPU& cpu)
 {
-	BYTE zpage = mapper.readMemory(cpu.progcount);
+	BYTE zpage = read_byte(mapper, cpu.progcount);
 	MEM_BYTE byte;
-	byte.unsigned8 = mapper.readMemory(zpage);
+	byte.unsigned8 = read_byte(mapper, zpage);
 	++cpu.progcount;
 	return byte;
 }
 
-MEM_BYTE GET_ZPAGEX(Mapper& mapper, CPU& cpu)
+template<class MAPPER>
+inline MEM_BYTE GET_ZPAGEX(MAPPER& mapper, CPU& cpu)
 {
-	BYTE zpage = mapper.readMemory(cpu.progcount);
+	BYTE zpage = read_byte(mapper, cpu.progcount);
 	zpage += cpu.xindex.unsigned8;
 	MEM_BYTE byte;
-	byte.unsigned8 = mapper.readMemory(zpage);
+	byte.unsigned8 = read_byte(mapper, zpage);
 	++cpu.progcount;
 	return byte;
 }
 
-MEM_BYTE GET_ZPAGEY(Mapper& mapper, CPU& cpu)
+template<class MAPPER>
+inline MEM_BYTE GET_ZPAGEY(MAPPER& mapper, CPU& cpu)
 {
-	BYTE zpage = mapper.readMemory(cpu.progcount);
+	BYTE zpage = read_byte(mapper, cpu.progcount);
 	zpage += cpu.yindex.unsigned8;
 	MEM_BYTE byte;
-	byte.unsigned8 = mapper.readMemory(zpage);
+	byte.unsigned8 = read_byte(mapper, zpage);
 	++cpu.progcount;
 	return byte;
 }
 
-MEM_BYTE GET_ABSOLUTE(Mapper& mapper, CPU& cpu)
+template<class MAPPER>
+inline MEM_BYTE GET_ABSOLUTE(MAPPER& mapper, CPU& cpu)
 {
 	ADDR_16B abs = READ_WORD(mapper, cpu.progcount);
 	MEM_BYTE byte;
-	byte.unsigned8 = mapper.readMemory(abs);
+	byte.unsigned8 = read_byte(mapper, abs);
 	cpu.progcount += 2;
 	return byte;
 }
 
 
-MEM_BYTE GET_ABSOLUTEX(Mapper& mapper, CPU& cpu)
+template<class MAPPER>
+inline MEM_BYTE GET_ABSOLUTEX(MAPPER& mapper, CPU& cpu)
 {
 	ADDR_16B abs = READ_WORD(mapper, cpu.progcount);
 	abs += cpu.xindex.unsigned8;
 	MEM_BYTE byte;
-	byte.unsigned8 = mapper.readMemory(abs);
+	byte.unsigned8 = read_byte(mapper, abs);
 	cpu.progcount += 2;
 	return byte;
 }
 
-MEM_BYTE GET_ABSOLUTEY(Mapper& mapper, CPU& cpu)
+template<class MAPPER>
+inline MEM_BYTE GET_ABSOLUTEY(MAPPER& mapper, CPU& cpu)
 {
 	ADDR_16B abs = READ_WORD(mapper, cpu.progcount);
 	abs += cpu.yindex.unsigned8;
 	MEM_BYTE byte;
-	byte.unsigned8 = mapper.readMemory(abs);
+	byte.unsigned8 = read_byte(mapper, abs);
 	cpu.progcount += 2;
 	return byte;
 }
 
-MEM_BYTE GET_INDXINDIRECT(Mapper& mapper, CPU& cpu)
+template<class MAPPER>
+inline MEM_BYTE GET_INDXINDIRECT(MAPPER& mapper, CPU& cpu)
 {
-	BYTE zpageaddr = mapper.readMemory(cpu.progcount);
+	BYTE zpageaddr = read_byte(mapper, cpu.progcount);
 	zpageaddr += cpu.xindex.unsigned8;
 	ADDR_16B indirect = READ_WORD(mapper, zpageaddr);
 	MEM_BYTE byte;
-	byte.unsigned8 = mapper.readMemory(indirect);
+	byte.unsigned8 = read_byte(mapper, indirect);
 	++cpu.progcount;
 	return byte;
 }
 
-MEM_BYTE GET_INDIRECTINDXY(Mapper& mapper, CPU& cpu)
+template<class MAPPER>
+inline MEM_BYTE GET_INDIRECTINDXY(MAPPER& mapper, CPU& cpu)
 {
-	BYTE zpageaddr = mapper.readMemory(cpu.progcount);
+	BYTE zpageaddr = read_byte(mapper, cpu.progcount);
 	ADDR_16B indirect = READ_WORD(mapper, zpageaddr);
 	indirect += cpu.yindex.unsigned8;
 	MEM_BYTE byte;
-	byte.unsigned8 = mapper.readMemory(indirect);
+	byte.unsigned8 = read_byte(mapper, indirect);
 	++cpu.progcount;
 	return byte;
 }
 
 //Memory SETs ==========================================
 
-void SET_ZPAGE(Mapper& mapper, CPU& cpu, BYTE val)
+template<class MAPPER>
+inline void SET_ZPAGE(MAPPER& mapper, CPU& cpu, BYTE val)
 {
 	ADDR_16B zpage = GET_IMMEDIATE(mapper, cpu).unsigned8;
 	mapper.writeMemory(zpage, val);
 }
 
-void SET_ABSOLUTE(Mapper& mapper, CPU& cpu, BYTE val)
+template<class MAPPER>
+inline void SET_ABSOLUTE(MAPPER& mapper, CPU& cpu, BYTE val)
 {
 	ADDR_16B addr = READ_WORD(mapper, cpu.progcount);
 	mapper.writeMemory(addr, val);
 	cpu.progcount += 2;
 }
 
-void SET_ABSOLUTEX(Mapper& mapper, CPU& cpu, BYTE val)
+template<class MAPPER>
+inline void SET_ABSOLUTEX(MAPPER& mapper, CPU& cpu, BYTE val)
 {
 	ADDR_16B addr = READ_WORD(mapper, cpu.progcount);
 	addr += cpu.xindex.unsigned8;
@@ -160,7 +193,8 @@ void SET_ABSOLUTEX(Mapper& mapper, CPU& cpu, BYTE val)
 	cpu.progcount += 2;
 }
 
-void SET_ABSOLUTEY(Mapper& mapper, CPU& cpu, BYTE val)
+template<class MAPPER>
+inline void SET_ABSOLUTEY(MAPPER& mapper, CPU& cpu, BYTE val)
 {
 	ADDR_16B addr = READ_WORD(mapper, cpu.progcount);
 	addr += cpu.yindex.unsigned8;
@@ -168,32 +202,36 @@ void SET_ABSOLUTEY(Mapper& mapper, CPU& cpu, BYTE val)
 	cpu.progcount += 2;
 }
 
-void SET_ZPAGEX(Mapper& mapper, CPU& cpu, BYTE val)
+template<class MAPPER>
+inline void SET_ZPAGEX(MAPPER& mapper, CPU& cpu, BYTE val)
 {
 	ADDR_16B zpage = GET_IMMEDIATE(mapper, cpu).unsigned8;
 	zpage += cpu.xindex.unsigned8;
 	mapper.writeMemory(zpage, val);
 }
 
-void SET_ZPAGEY(Mapper& mapper, CPU& cpu, BYTE val)
+template<class MAPPER>
+inline void SET_ZPAGEY(MAPPER& mapper, CPU& cpu, BYTE val)
 {
 	ADDR_16B zpage = GET_IMMEDIATE(mapper, cpu).unsigned8;
 	zpage += cpu.yindex.unsigned8;
 	mapper.writeMemory(zpage, val);
 }
 
-void SET_INDXINDIRECT(Mapper& mapper, CPU& cpu, BYTE val)
+template<class MAPPER>
+inline void SET_INDXINDIRECT(MAPPER& mapper, CPU& cpu, BYTE val)
 {
-	BYTE zpageaddr = mapper.readMemory(cpu.progcount);
+	BYTE zpageaddr = read_byte(mapper, cpu.progcount);
 	zpageaddr += cpu.xindex.unsigned8;
 	ADDR_16B indirect = READ_WORD(mapper, zpageaddr);
 	mapper.writeMemory(indirect, val);
 	++cpu.progcount;
 }
 
-void SET_ZPAGEINY(Mapper& mapper, CPU& cpu, BYTE val)
+template<class MAPPER>
+inline void SET_ZPAGEINY(MAPPER& mapper, CPU& cpu, BYTE val)
 {
-	BYTE zpageaddr = mapper.readMemory(cpu.progcount);
+	BYTE zpageaddr = read_byte(mapper, cpu.progcount);
 	ADDR_16B indirect = READ_WORD(mapper, zpageaddr);
 	indirect += cpu.yindex.unsigned8;
 	mapper.writeMemory(indirect, val);
@@ -202,59 +240,16 @@ void SET_ZPAGEINY(Mapper& mapper, CPU& cpu, BYTE val)
 
 //Helper Functions =====================================
 
-/* Operations to perform. */
+/* Operations to perform. Each operation is also available as a type with a static apply()
+ * so that handlers can be generated at compile time (see op_get). */
 namespace operations {
 	enum OperationT { BIT_OR, BIT_XOR, BIT_AND, ADD, SUB, EQL, CMP, ASL, ROL };
-}
-
-/* Perform an operation between an operand and a register. */
-void perform_operation(CPU& cpu, REG_S8B& reg, MEM_BYTE rvalue, operations::OperationT operation)
-{
-	using namespace operations;
-#ifdef ENFORCE_OVRFLOWSEMANTICS
-	int16_t tval;
-#endif
 
-	int8_t add_result;
-	const uint8_t CARRY_UNSET = 2;
-	uint8_t carry = CARRY_UNSET;
-
-	switch (operation)
+	/* Add an operand and carry to a register. */
+	inline void add_carry(CPU& cpu, REG_S8B& reg, MEM_BYTE rvalue, uint8_t carry)
 	{
-	case BIT_OR:
-		reg.unsigned8 |= rvalue.unsigned8;
-		//Negative Flag
-		SETF_NEG(cpu.procstat, reg.signed8 < 0);
-		//Zero Flag
-		SETF_ZERO(cpu.procstat, reg.unsigned8 == 0);
-		break;
-
-	case BIT_XOR:
-		reg.unsigned8 ^= rvalue.unsigned8;
-		//Negative Flag
-		SETF_NEG(cpu.procstat, reg.signed8 < 0);
-		//Zero Flag
-		SETF_ZERO(cpu.procstat, reg.unsigned8 == 0);
-		break;
-
-	case BIT_AND:
-		reg.unsigned8 &= rvalue.unsigned8;
-		//Negative Flag
-		SETF_NEG(cpu.procstat, reg.signed8 < 0);
-		//Zero Flag
-		SETF_ZERO(cpu.procstat, reg.unsigned8 == 0);
-		break;
-
-	case SUB:
-		//$STUB$ add enforce_ovrflowsemantics w/ alternate for carry *= -1 and rvalue *= -1
-		carry = (~F_CARRY(cpu.procstat)) + 1; //Two's complement
-		rvalue.unsigned8 = (~rvalue.unsigned8) + 1;
-	case ADD:
 #ifdef ENFORCE_OVRFLOWSEMANTICS  //Generic implementation $STUB$ revisit and ensure valid
-		if (carry == CARRY_UNSET)
-			carry = F_CARRY(cpu.procstat);
-
-		tval = reg.signed8;
+		int16_t tval = reg.signed8;
 		tval += rvalue.signed8;
 		tval += carry;
 
@@ -274,10 +269,7 @@ void perform_operation(CPU& cpu, REG_S8B& reg, MEM_BYTE rvalue, operations::Oper
 		else
 			reg.signed8 += rvalue.signed8;
 #else   //For environments that handle overflows in the same manner as 6502.
-		if (carry == CARRY_UNSET)
-			carry = F_CARRY(cpu.procstat);
-
-		add_result = reg.signed8;
+		int8_t add_result = reg.signed8;
 		add_result += rvalue.signed8;
 		add_result += carry;
 
@@ -291,28 +283,95 @@ void perform_operation(CPU& cpu, REG_S8B& reg, MEM_BYTE rvalue, operations::Oper
 
 		reg.signed8 = add_result;
 #endif
-		//Negative Flag
-		SETF_NEG(cpu.procstat, reg.signed8 < 0);
+		//Negative and Zero Flags
+		LAZY_NZ(cpu, reg.unsigned8);
+	}
 
-		//Zero Flag
-		SETF_ZERO(cpu.procstat, reg.unsigned8 == 0);
-		break;
+	struct BitOr {
+		static void apply(CPU& cpu, REG_S8B& reg, MEM_BYTE rvalue) {
+			reg.unsigned8 |= rvalue.unsigned8;
+			//Negative and Zero Flags
+			LAZY_NZ(cpu, reg.unsigned8);
+		}
+	};
 
-	case EQL:
-		reg = rvalue;
+	struct BitXor {
+		static void apply(CPU& cpu, REG_S8B& reg, MEM_BYTE rvalue) {
+			reg.unsigned8 ^= rvalue.unsigned8;
+			//Negative and Zero Flags
+			LAZY_NZ(cpu, reg.unsigned8);
+		}
+	};
 
-		//Negative Flag
-		SETF_NEG(cpu.procstat, reg.signed8 < 0);
-		//Zero Flag
-		SETF_ZERO(cpu.procstat, reg.unsigned8 == 0);
-		break;
+	struct BitAnd {
+		static void apply(CPU& cpu, REG_S8B& reg, MEM_BYTE rvalue) {
+			reg.unsigned8 &= rvalue.unsigned8;
+			//Negative and Zero Flags
+			LAZY_NZ(cpu, reg.unsigned8);
+		}
+	};
 
-	case CMP:
-		add_result = reg.signed8 - rvalue.signed8;
+	struct Add {
+		static void apply(CPU& cpu, REG_S8B& reg, MEM_BYTE rvalue) {
+			add_carry(cpu, reg, rvalue, F_CARRY(cpu.procstat));
+		}
+	};
+
+	struct Sub {
+		static void apply(CPU& cpu, REG_S8B& reg, MEM_BYTE rvalue) {
+			//$STUB$ add enforce_ovrflowsemantics w/ alternate for carry *= -1 and rvalue *= -1
+			uint8_t carry = (~F_CARRY(cpu.procstat)) + 1; //Two's complement
+			rvalue.unsigned8 = (~rvalue.unsigned8) + 1;
+			add_carry(cpu, reg, rvalue, carry);
+		}
+	};
+
+	struct Eql {
+		static void apply(CPU& cpu, REG_S8B& reg, MEM_BYTE rvalue) {
+			reg = rvalue;
+
+			//Negative and Zero Flags
+			LAZY_NZ(cpu, reg.unsigned8);
+		}
+	};
+
+	struct Cmp {
+		static void apply(CPU& cpu, REG_S8B& reg, MEM_BYTE rvalue) {
+			int8_t cmp_result = reg.signed8 - rvalue.signed8;
+
+			LAZY_NZ(cpu, static_cast<uint8_t>(cmp_result));
+			SETF_CARRY(cpu.procstat, reg.signed8 >= rvalue.signed8);
+		}
+	};
+}
 
-		SETF_ZERO(cpu.procstat, add_result == 0);
-		SETF_NEG(cpu.procstat, add_result < 0);
-		SETF_CARRY(cpu.procstat, reg.signed8 >= rvalue.signed8);
+/* Perform an operation between an operand and a register. */
+void perform_operation(CPU& cpu, REG_S8B& reg, MEM_BYTE rvalue, operations::OperationT operation)
+{
+	using namespace operations;
+
+	switch (operation)
+	{
+	case BIT_OR:
+		BitOr::apply(cpu, reg, rvalue);
+		break;
+	case BIT_XOR:
+		BitXor::apply(cpu, reg, rvalue);
+		break;
+	case BIT_AND:
+		BitAnd::apply(cpu, reg, rvalue);
+		break;
+	case SUB:
+		Sub::apply(cpu, reg, rvalue);
+		break;
+	case ADD:
+		Add::apply(cpu, reg, rvalue);
+		break;
+	case EQL:
+		Eql::apply(cpu, reg, rvalue);
+		break;
+	case CMP:
+		Cmp::apply(cpu, reg, rvalue);
 		break;
 		
 	case ROL:
@@ -552,6 +611,600 @@ void translate_CC00_set(Mapper& mapper, CPU& cpu, OPCODE code, REG_S8B& reg)
 			SETF_DEBUG(cpu.procstat, 1);
 	}
 }
+/* Translation routine for opcodes with the AAABBBCC bit pattern. */
+ERROR_STATE translate_AAABBBCC(Mapper& mapper, CPU& cpu, OPCODE code)
+{
+	//$STUB$ reinterperet_cast to maintain bit patterns
+	switch (code & MASK_AAACC)
+	{
+	//==== Start of CC 01 ====
+	case OP_ORA:
+		translate_CC01_get(mapper, cpu, code, cpu.accumulator, operations::BIT_OR);
+		break;
+	case OP_AND:
+		translate_CC01_get(mapper, cpu, code, cpu.accumulator, operations::BIT_AND);
+		break;
+	case OP_EOR:
+		translate_CC01_get(mapper, cpu, code, cpu.accumulator, operations::BIT_XOR);
+		break;
+	case OP_ADC:
+		translate_CC01_get(mapper, cpu, code, cpu.accumulator, operations::ADD);
+		break;
+	case OP_STA:
+		translate_CC01_set(mapper, cpu, code, cpu.accumulator);
+		break;
+	case OP_LDA:
+		translate_CC01_get(mapper, cpu, code, cpu.accumulator, operations::EQL);
+		break;
+	case OP_CMP:
+		translate_CC01_get(mapper, cpu, code, cpu.accumulator, operations::CMP);
+		break;
+	case OP_SBC:
+		translate_CC01_get(mapper, cpu, code, cpu.accumulator, operations::SUB);
+		break;
+
+	//==== Start of CC 10 ====
+	case OP_ASL:
+		//translate_CC10_get(mapper, cpu, code, cpu.accumulator, operations::ASL);
+		break;
+	case OP_ROL:
+		//translate_CC10_get(mapper, cpu, code, cpu.accumulator, operations::ROL);
+		break;
+	case OP_LSR:
+		//translate_CC10_get(mapper, cpu, code, cpu.accumulator, operations::LSR);
+		break;
+	case OP_ROR:
+		//translate_CC10_get(mapper, cpu, code, cpu.accumulator, operations::ROR);
+		break;
+	case OP_STX:
+		//translate_CC10_set(mapper, cpu, code, cpu.xindex);
+		break;
+	case OP_LDX:
+		//translate_CC10_get(mapper, cpu, code, cpu.xindex, operations::EQL);
+		break;
+	case OP_DEC:
+		//$STUB$
+		break;
+	case OP_INC:
+		//$STUB$
+		break;
+
+    //==== Start of CC 00 ====
+	case OP_BIT:
+		//TRANSLATE_CC00_GET(code, mapper, cpu.temp.signed8, = );
+		//Zero Flag
+		LAZY_Z(cpu, cpu.accumulator.unsigned8 & cpu.temp.unsigned8);
+		//Negative Flag
+		LAZY_N(cpu, cpu.temp.unsigned8);
+		//Overflow Flag
+		SETF_OVRFLOW(cpu.procstat, BIT6(cpu.temp.unsigned8));
+		break;
+	case OP_STY:
+		//translate_CC00_set(mapper, cpu, code, cpu.yindex);
+		break;
+	case OP_LDY:
+		//translate_CC00_get(mapper, cpu, code, cpu.yindex, operations::EQL);
+		break;
+	case OP_CPY:
+		//translate_CC00_get(mapper, cpu, code, cpu.yindex, operations::CMP);
+		break;
+	case OP_CPX:
+		//translate_CC00_get(mapper, cpu, code, cpu.xindex, operations::CMP);
+		break;
+
+	default:
+		return ERROR_STATE::UNKNOWN_INSTRUCTION;
+	}
+
+	return ERROR_STATE::NONE;
+}
+
+//======================================================
+//Opcode Handlers
+//======================================================
+
+/* Executes a single opcode. progcount points past the opcode byte on entry.
+ * Returns ERROR_STATE::NONE if execution may continue. */
+template<class MAPPER>
+using OpHandler = ERROR_STATE (*)(MAPPER& mapper, CPU& cpu);
+
+//Addressing Modes =====================================
+
+/* Addressing modes for generated handlers. get() fetches the operand and set() stores to
+ * the effective address, advancing progcount past the operand bytes. */
+#define AMODE_GET(GETTER) \
+	template<class MAPPER> \
+	static MEM_BYTE get(MAPPER& mapper, CPU& cpu) { return GETTER(mapper, cpu); }
+#define AMODE_SET(SETTER) \
+	template<class MAPPER> \
+	static void set(MAPPER& mapper, CPU& cpu, BYTE val) { SETTER(mapper, cpu, val); }
+
+namespace amodes {
+	struct Immediate { AMODE_GET(GET_IMMEDIATE) };
+	struct ZPage { AMODE_GET(GET_ZPAGE) AMODE_SET(SET_ZPAGE) };
+	struct ZPageX { AMODE_GET(GET_ZPAGEX) AMODE_SET(SET_ZPAGEX) };
+	struct Absolute { AMODE_GET(GET_ABSOLUTE) AMODE_SET(SET_ABSOLUTE) };
+	struct AbsoluteX { AMODE_GET(GET_ABSOLUTEX) AMODE_SET(SET_ABSOLUTEX) };
+	struct AbsoluteY { AMODE_GET(GET_ABSOLUTEY) AMODE_SET(SET_ABSOLUTEY) };
+	struct IndxIndirect { AMODE_GET(GET_INDXINDIRECT) AMODE_SET(SET_INDXINDIRECT) };
+	struct IndirectIndxY { AMODE_GET(GET_INDIRECTINDXY) AMODE_SET(SET_ZPAGEINY) };
+
+	/* CC01 addressing mode selected by BBB. */
+	template<OPCODE BBB> struct CC01;
+	template<> struct CC01<AMODE_ZPAGEINX> { typedef IndxIndirect type; };
+	template<> struct CC01<AMODE_ZPAGE> { typedef ZPage type; };
+	template<> struct CC01<AMODE_IMMED> { typedef Immediate type; };
+	template<> struct CC01<AMODE_ABS> { typedef Absolute type; };
+	template<> struct CC01<AMODE_ZPAGEINY> { typedef IndirectIndxY type; };
+	template<> struct CC01<AMODE_ZPAGEX> { typedef ZPageX type; };
+	template<> struct CC01<AMODE_ABSY> { typedef AbsoluteY type; };
+	template<> struct CC01<AMODE_ABSX> { typedef AbsoluteX type; };
+}
+
+//Generated Handlers ===================================
+
+/* Perform OPERATION between REG and an operand fetched through MODE. */
+template<class OPERATION, class MODE, REG_S8B CPU::*REG, class MAPPER>
+inline ERROR_STATE op_get(MAPPER& mapper, CPU& cpu)
+{
+	MEM_BYTE rvalue = MODE::get(mapper, cpu);
+	OPERATION::apply(cpu, cpu.*REG, rvalue);
+	return ERROR_STATE::NONE;
+}
+
+/* Store REG to the effective address of MODE. */
+template<class MODE, REG_S8B CPU::*REG, class MAPPER>
+inline ERROR_STATE op_set(MAPPER& mapper, CPU& cpu)
+{
+	MODE::set(mapper, cpu, (cpu.*REG).unsigned8);
+	return ERROR_STATE::NONE;
+}
+
+/* Handler for the AAACC operation with BBB addressing mode. Bit patterns without an
+ * operation are unknown instructions. */
+template<OPCODE AAACC, OPCODE BBB>
+struct AAABBBCC {
+	template<class MAPPER>
+	static ERROR_STATE exec(MAPPER&, CPU&) { return ERROR_STATE::UNKNOWN_INSTRUCTION; }
+};
+
+#define AAACC_HANDLER(AAACC, ...) \
+	template<OPCODE BBB> struct AAABBBCC<AAACC, BBB> { \
+		template<class MAPPER> \
+		static ERROR_STATE exec(MAPPER& mapper, CPU& cpu) { __VA_ARGS__ } };
+//For operations on registers alone
+#define AAACC_REGHANDLER(AAACC, ...) \
+	template<OPCODE BBB> struct AAABBBCC<AAACC, BBB> { \
+		template<class MAPPER> \
+		static ERROR_STATE exec(MAPPER&, CPU& cpu) { __VA_ARGS__ } };
+
+//CC 01
+#define CC01_GET(AAACC, OPERATION) \
+	AAACC_HANDLER(AAACC, return op_get<OPERATION, typename amodes::CC01<BBB>::type, &CPU::accumulator>(mapper, cpu);)
+CC01_GET(OP_ORA, operations::BitOr)
+CC01_GET(OP_AND, operations::BitAnd)
+CC01_GET(OP_EOR, operations::BitXor)
+CC01_GET(OP_ADC, operations::Add)
+CC01_GET(OP_LDA, operations::Eql)
+CC01_GET(OP_CMP, operations::Cmp)
+CC01_GET(OP_SBC, operations::Sub)
+AAACC_HANDLER(OP_STA, return op_set<typename amodes::CC01<BBB>::type, &CPU::accumulator>(mapper, cpu);)
+
+//CC 10 and CC 00 $STUB$ Not yet decoded, executed as single byte no-ops.
+#define AAACC_STUB(AAACC) \
+	template<OPCODE BBB> struct AAABBBCC<AAACC, BBB> { \
+		template<class MAPPER> \
+		static ERROR_STATE exec(MAPPER&, CPU&) { return ERROR_STATE::NONE; } };
+AAACC_STUB(OP_ASL)
+AAACC_STUB(OP_ROL)
+AAACC_STUB(OP_LSR)
+AAACC_STUB(OP_ROR)
+AAACC_STUB(OP_STX)
+AAACC_STUB(OP_LDX)
+AAACC_STUB(OP_DEC)
+AAACC_STUB(OP_INC)
+AAACC_STUB(OP_STY)
+AAACC_STUB(OP_LDY)
+AAACC_STUB(OP_CPY)
+AAACC_STUB(OP_CPX)
+
+AAACC_REGHANDLER(OP_BIT,
+	//Zero Flag
+	LAZY_Z(cpu, cpu.accumulator.unsigned8 & cpu.temp.unsigned8);
+	//Negative Flag
+	LAZY_N(cpu, cpu.temp.unsigned8);
+	//Overflow Flag
+	SETF_OVRFLOW(cpu.procstat, BIT6(cpu.temp.unsigned8));
+	return ERROR_STATE::NONE;)
+
+/* Tag selecting the handler overload of an opcode. */
+template<OPCODE CODE>
+struct OpTag {};
+
+/* Opcodes without a dedicated handler are decoded from their AAABBBCC bit pattern
+ * at compile time. */
+template<class MAPPER, OPCODE CODE>
+inline ERROR_STATE op(MAPPER& mapper, CPU& cpu, OpTag<CODE>)
+{
+	return AAABBBCC<CODE & MASK_AAACC, CODE & MASK_BBB>::exec(mapper, cpu);
+}
+
+#define OPHANDLER(CODE) template<class MAPPER> inline ERROR_STATE op(MAPPER& mapper, CPU& cpu, OpTag<CODE>)
+//For handlers working on registers alone, and on nothing at all
+#define REGHANDLER(CODE) template<class MAPPER> inline ERROR_STATE op(MAPPER&, CPU& cpu, OpTag<CODE>)
+#define NULLHANDLER(CODE) template<class MAPPER> inline ERROR_STATE op(MAPPER&, CPU&, OpTag<CODE>)
+
+//KIL
+#define KIL_HANDLER(CODE) NULLHANDLER(CODE) { return ERROR_STATE::CPU_LOCK; }
+KIL_HANDLER(OP_KIL0)
+KIL_HANDLER(OP_KIL1)
+KIL_HANDLER(OP_KIL2)
+KIL_HANDLER(OP_KIL3)
+KIL_HANDLER(OP_KIL4)
+KIL_HANDLER(OP_KIL5)
+KIL_HANDLER(OP_KIL6)
+KIL_HANDLER(OP_KIL7)
+KIL_HANDLER(OP_KIL8)
+KIL_HANDLER(OP_KIL9)
+KIL_HANDLER(OP_KILA)
+KIL_HANDLER(OP_KILB)
+
+//NOPs
+#define NOP_HANDLER(CODE) NULLHANDLER(CODE) { return ERROR_STATE::NONE; }
+NOP_HANDLER(OP_NOP)
+NOP_HANDLER(OP_NOP0)
+NOP_HANDLER(OP_NOP1)
+NOP_HANDLER(OP_NOP2)
+NOP_HANDLER(OP_NOP3)
+NOP_HANDLER(OP_NOP4)
+NOP_HANDLER(OP_NOP5)
+
+//Double NOPs
+#define DNOP_HANDLER(CODE) REGHANDLER(CODE) { ++cpu.progcount; return ERROR_STATE::NONE; }
+DNOP_HANDLER(OP_DNOP0)
+DNOP_HANDLER(OP_DNOP1)
+DNOP_HANDLER(OP_DNOP2)
+DNOP_HANDLER(OP_DNOP3)
+DNOP_HANDLER(OP_DNOP4)
+DNOP_HANDLER(OP_DNOP5)
+DNOP_HANDLER(OP_DNOP6)
+DNOP_HANDLER(OP_DNOP7)
+DNOP_HANDLER(OP_DNOP8)
+DNOP_HANDLER(OP_DNOP9)
+DNOP_HANDLER(OP_DNOPA)
+DNOP_HANDLER(OP_DNOPB)
+DNOP_HANDLER(OP_DNOPC)
+DNOP_HANDLER(OP_DNOPD)
+
+//Increment/Decrement x/y registers and register transfers
+#define LOAD_HANDLER(CODE, DST, EXPR) REGHANDLER(CODE) { \
+	EXPR; \
+	/*Negative and Zero Flags*/ \
+	LAZY_NZ(cpu, cpu.DST.unsigned8); \
+	return ERROR_STATE::NONE; }
+LOAD_HANDLER(OP_INX, xindex, ++cpu.xindex.signed8)
+LOAD_HANDLER(OP_INY, yindex, ++cpu.yindex.signed8)
+LOAD_HANDLER(OP_DEX, xindex, --cpu.xindex.signed8)
+LOAD_HANDLER(OP_DEY, yindex, --cpu.yindex.signed8)
+LOAD_HANDLER(OP_TAX, xindex, cpu.xindex = cpu.accumulator)
+LOAD_HANDLER(OP_TXA, accumulator, cpu.accumulator = cpu.xindex)
+LOAD_HANDLER(OP_TAY, yindex, cpu.yindex = cpu.accumulator)
+LOAD_HANDLER(OP_TYA, accumulator, cpu.accumulator = cpu.yindex)
+LOAD_HANDLER(OP_TSX, xindex, cpu.xindex = cpu.stackp)
+LOAD_HANDLER(OP_TXS, stackp, cpu.stackp = cpu.xindex)
+
+//Branch instructions
+#define BRANCH_HANDLER(CODE, COND) OPHANDLER(CODE) { \
+	if (COND) \
+		cpu.progcount += static_cast<int>(read_byte(mapper, cpu.progcount)) + 1; \
+	else \
+		++cpu.progcount; \
+	return ERROR_STATE::NONE; }
+BRANCH_HANDLER(OP_BCC, !F_CARRY(cpu.procstat))
+BRANCH_HANDLER(OP_BCS, F_CARRY(cpu.procstat))
+BRANCH_HANDLER(OP_BEQ, LAZYF_ZERO(cpu))
+BRANCH_HANDLER(OP_BMI, LAZYF_NEG(cpu))
+BRANCH_HANDLER(OP_BNE, !LAZYF_ZERO(cpu))
+BRANCH_HANDLER(OP_BPL, !LAZYF_NEG(cpu))
+BRANCH_HANDLER(OP_BVC, !F_OVRFLOW(cpu.procstat))
+BRANCH_HANDLER(OP_BVS, F_OVRFLOW(cpu.procstat))
+
+//Stack instructions - $STUB$ Implement stack overflow
+OPHANDLER(OP_PHA) {
+	mapper.writeMemory(L_STACKT + cpu.stackp.unsigned8, cpu.accumulator.unsigned8);
+	--cpu.stackp.unsigned8;
+	return ERROR_STATE::NONE;
+}
+
+OPHANDLER(OP_PLA) {
+	++cpu.stackp.unsigned8;
+	cpu.accumulator.unsigned8 = read_byte(mapper, L_STACKT + cpu.stackp.unsigned8);
+	//Negative and Zero Flags
+	LAZY_NZ(cpu, cpu.accumulator.unsigned8);
+	return ERROR_STATE::NONE;
+}
+
+OPHANDLER(OP_PHP) {
+	mapper.writeMemory(L_STACKT + cpu.stackp.unsigned8, settledFlags(cpu));
+	--cpu.stackp.unsigned8;
+	return ERROR_STATE::NONE;
+}
+
+OPHANDLER(OP_PLP) {
+	++cpu.stackp.unsigned8;
+	cpu.procstat = read_byte(mapper, L_STACKT + cpu.stackp.unsigned8);
+	loadFlags(cpu);
+	return ERROR_STATE::NONE;
+}
+
+//Set and Clear
+#define FLAG_HANDLER(CODE, SETF, VAL) REGHANDLER(CODE) { SETF(cpu.procstat, VAL); return ERROR_STATE::NONE; }
+FLAG_HANDLER(OP_SEC, SETF_CARRY, 1)
+FLAG_HANDLER(OP_SED, SETF_DMODE, 1)
+FLAG_HANDLER(OP_SEI, SETF_INTDIS, 1)
+FLAG_HANDLER(OP_CLC, SETF_CARRY, 0)
+FLAG_HANDLER(OP_CLD, SETF_DMODE, 0)
+FLAG_HANDLER(OP_CLI, SETF_INTDIS, 0)
+FLAG_HANDLER(OP_CLV, SETF_OVRFLOW, 0)
+
+//Flow Control Instructions
+OPHANDLER(OP_BRK) {
+	cpu.progcount += 2;
+	//Push PC
+	mapper.writeMemory(L_STACKT + cpu.stackp.unsigned8, (cpu.progcount - 1));
+	--cpu.stackp.unsigned8;
+	mapper.writeMemory(L_STACKT + cpu.stackp.unsigned8, (cpu.progcount >> 8));
+	--cpu.stackp.unsigned8;
+	//Push PSW
+	mapper.writeMemory(L_STACKT + cpu.stackp.unsigned8, settledFlags(cpu));
+	--cpu.stackp.unsigned8;
+	//Go to BRK address
+	cpu.progcount = read_byte(mapper, L_BRKHNDL) | read_byte(mapper, L_BRKHNDL + 1) << 8;
+	SETF_BRKCMD(cpu.procstat, 1);
+	return ERROR_STATE::NONE;
+}
+
+OPHANDLER(OP_JSRABS) {
+	//Push PC
+	mapper.writeMemory(L_STACKT + cpu.stackp.unsigned8, cpu.progcount + 1);
+	--cpu.stackp.unsigned8;
+	mapper.writeMemory(L_STACKT + cpu.stackp.unsigned8, (cpu.progcount + 1) >> 8);
+	--cpu.stackp.unsigned8;
+	//Go to address specified by operand
+	cpu.progcount = READ_WORD(mapper, cpu.progcount);
+	return ERROR_STATE::NONE;
+}
+
+OPHANDLER(OP_RTI) {
+	//Pop PSW
+	++cpu.stackp.unsigned8;
+	cpu.procstat = read_byte(mapper, L_STACKT + cpu.stackp.unsigned8);
+	loadFlags(cpu);
+	//Pop PC - Return address
+	++cpu.stackp.unsigned8;
+	cpu.progcount = read_byte(mapper, L_STACKT + cpu.stackp.unsigned8) << 8;
+	++cpu.stackp.unsigned8;
+	cpu.progcount |= read_byte(mapper, L_STACKT + cpu.stackp.unsigned8);
+	return ERROR_STATE::NONE;
+}
+
+OPHANDLER(OP_RTS) {
+	//Pop PC - Return address
+	++cpu.stackp.unsigned8;
+	cpu.progcount = read_byte(mapper, L_STACKT + cpu.stackp.unsigned8) << 8;
+	++cpu.stackp.unsigned8;
+	cpu.progcount |= read_byte(mapper, L_STACKT + cpu.stackp.unsigned8);
+	++cpu.progcount;
+	return ERROR_STATE::NONE;
+}
+
+OPHANDLER(OP_JMP) {
+	//Indirection
+	cpu.progcount = READ_WORD(mapper, cpu.progcount);
+	cpu.progcount = READ_WORD(mapper, cpu.progcount);
+	return ERROR_STATE::NONE;
+}
+
+OPHANDLER(OP_JMPABS) {
+	cpu.progcount = READ_WORD(mapper, cpu.progcount);
+	return ERROR_STATE::NONE;
+}
+
+/* Expands ENTRY(0x00) ... ENTRY(0xFF) in opcode order. */
+#define OPROW(ENTRY, H) \
+	ENTRY(H##0) ENTRY(H##1) ENTRY(H##2) ENTRY(H##3) ENTRY(H##4) ENTRY(H##5) ENTRY(H##6) ENTRY(H##7) \
+	ENTRY(H##8) ENTRY(H##9) ENTRY(H##A) ENTRY(H##B) ENTRY(H##C) ENTRY(H##D) ENTRY(H##E) ENTRY(H##F)
+#define OPCODES(ENTRY) \
+	OPROW(ENTRY, 0x0) OPROW(ENTRY, 0x1) OPROW(ENTRY, 0x2) OPROW(ENTRY, 0x3) \
+	OPROW(ENTRY, 0x4) OPROW(ENTRY, 0x5) OPROW(ENTRY, 0x6) OPROW(ENTRY, 0x7) \
+	OPROW(ENTRY, 0x8) OPROW(ENTRY, 0x9) OPROW(ENTRY, 0xA) OPROW(ENTRY, 0xB) \
+	OPROW(ENTRY, 0xC) OPROW(ENTRY, 0xD) OPROW(ENTRY, 0xE) OPROW(ENTRY, 0xF)
+
+/* True unless MAPPER is instantiated on a policy that never refuses an access (see
+ * MemoryFault), in which case opcodes are not checked for faults at all. */
+template<class MAPPER>
+struct MayFault {
+	static const bool value = true;
+};
+
+template<class POLICY>
+struct MayFault<BasicDefaultMapper<POLICY>> {
+	static const bool value = POLICY::readonly_minimum || POLICY::readonly_strict || POLICY::writeonly_minimum;
+};
+
+static inline ERROR_STATE fault_error(const MemoryFault& fault)
+{
+	return fault.kind == MemoryFault::BADREAD ? ERROR_STATE::BAD_READ : ERROR_STATE::BAD_WRITE;
+}
+
+/* Run the op() overload of CODE, progcount just past the opcode. If the mapper refused one
+ * of its accesses, stop there with progcount back on the opcode. */
+template<class MAPPER, OPCODE CODE>
+inline ERROR_STATE run_op(MAPPER& mapper, CPU& cpu)
+{
+	ADDR_16B pc = cpu.progcount - 1;
+	ERROR_STATE result = op(mapper, cpu, OpTag<CODE>());
+	if (MayFault<MAPPER>::value && result == ERROR_STATE::NONE && mapper.hasFault()) {
+		cpu.progcount = pc;
+		return fault_error(mapper.getFault());
+	}
+	return result;
+}
+
+/* Adapts run_op of CODE to OpHandler. */
+template<class MAPPER, OPCODE CODE>
+ERROR_STATE handler(MAPPER& mapper, CPU& cpu)
+{
+	return run_op<MAPPER, CODE>(mapper, cpu);
+}
+
+/* The 256 entry handler table. */
+template<class MAPPER>
+static const OpHandler<MAPPER>* op_table()
+{
+#define OPTABLE_ENTRY(CODE) &handler<MAPPER, CODE>,
+	static constexpr OpHandler<MAPPER> optable[256] = { OPCODES(OPTABLE_ENTRY) };
+#undef OPTABLE_ENTRY
+	return optable;
+}
+
+/* Adapts handler<MAPPER, CODE> to RecompiledOp, the untyped call recompiled modules make. */
+template<class MAPPER, OPCODE CODE>
+static int recompiled_handler(void* mapper, CPU* cpu)
+{
+	return handler<MAPPER, CODE>(*static_cast<MAPPER*>(mapper), *cpu);
+}
+
+/* The handler table handed to recompiled modules. */
+template<class MAPPER>
+static const RecompiledOp* recompiled_table()
+{
+#define RECOMPILEDTABLE_ENTRY(CODE) &recompiled_handler<MAPPER, CODE>,
+	static constexpr RecompiledOp table[256] = { OPCODES(RECOMPILEDTABLE_ENTRY) };
+#undef RECOMPILEDTABLE_ENTRY
+	return table;
+}
+
+//Idle Loops ===========================================
+
+//Most opcodes in one pass of an idle loop
+#define IDLE_MAX_OPS 16
+//Budgets this small are not worth looking for an idle loop in
+#define IDLE_MIN_TICKS 32
+//Kept out of the dispatch loops so their registers are left alone
+#ifdef __GNUC__
+#define IDLE_NOINLINE __attribute__((noinline))
+#else
+#define IDLE_NOINLINE __declspec(noinline)
+#endif
+
+/* Opcodes an idle loop may be made of. None write memory or the stack, and all are cheap
+ * to try; whether a pass really changes nothing is left to idle_loop_cost. */
+static bool idle_safe(OPCODE code)
+{
+	//Branches
+	if ((code & 0x1F) == 0x10)
+		return true;
+	switch (code)
+	{
+	case OP_NOP:
+	case OP_CLC:
+	case OP_SEC:
+	case OP_CLV:
+	case OP_TAX:
+	case OP_TAY:
+	case OP_TXA:
+	case OP_TYA:
+	case OP_TSX:
+	case OP_JMPABS:
+		return true;
+	}
+	//Reads of memory into A that give the same A when repeated
+	switch (code & MASK_AAACC)
+	{
+	case OP_ORA:
+	case OP_AND:
+	case OP_LDA:
+	case OP_CMP:
+		return true;
+	}
+	return false;
+}
+
+/* Ticks taken by one pass of the idle loop starting at cpu.progcount, or 0 if there is none.
+ * A pass is run on a copy of the CPU. It is an idle loop if the pass jumps back to where it
+ * started within IDLE_MAX_OPS idle_safe opcodes and leaves the copy as it found it: nothing is
+ * written, so every further pass does the same. Reads are assumed free of side effects, as
+ * they are for every mapper in this tree.
+ */
+template<class MAPPER>
+static int idle_loop_cost(MAPPER& mapper, const CPU& cpu)
+{
+	const OpHandler<MAPPER>* optable = op_table<MAPPER>();
+	CPU pass = cpu;
+	int cost = 0;
+
+	for (int i = 0; i < IDLE_MAX_OPS; i++) {
+		OPCODE code = read_byte(mapper, pass.progcount);
+		if (!idle_safe(code))
+			return 0;
+		++pass.progcount;
+		cost += OPTICK[code];
+		optable[code](mapper, pass);
+		//Left for the real pass to refuse
+		if (MayFault<MAPPER>::value && mapper.hasFault()) {
+			mapper.takeFault();
+			return 0;
+		}
+		if (code == OP_JMPABS && pass.progcount == cpu.progcount) {
+			bool same = pass.accumulator.unsigned8 == cpu.accumulator.unsigned8 &&
+				pass.xindex.unsigned8 == cpu.xindex.unsigned8 &&
+				pass.yindex.unsigned8 == cpu.yindex.unsigned8 &&
+				settledFlags(pass) == settledFlags(cpu);
+			return same ? cost : 0;
+		}
+	}
+	return 0;
+}
+
+/* Skips whole passes of the idle loop at cpu.progcount, if there is one, leaving between 1
+ * and one pass worth of ticks to run as usual so that the ticks left are exactly those of
+ * running every pass. The passes skipped are added to skips. */
+template<class MAPPER>
+IDLE_NOINLINE static int find_idle(MAPPER& mapper, const CPU& cpu, int ticks, uint64_t& skips)
+{
+	if (ticks <= IDLE_MIN_TICKS || !idle_safe(read_byte(mapper, cpu.progcount)))
+		return ticks;
+	int cost = idle_loop_cost(mapper, cpu);
+	if (cost > 0) {
+		int passes = (ticks - 1) / cost;
+		ticks -= passes * cost;
+		skips += passes;
+	}
+	return ticks;
+}
+
+/* Called after each OP_JMPABS. busy is the last target found not to be an idle loop, and is
+ * not looked at again for the rest of the dispatch: most jumps close loops doing work, and
+ * a loop missed only costs time. */
+template<class MAPPER>
+inline int skip_idle(MAPPER& mapper, const CPU& cpu, int ticks, ADDR_16B& busy, uint64_t& skips)
+{
+	if (cpu.progcount == busy)
+		return ticks;
+	int left = find_idle(mapper, cpu, ticks, skips);
+	if (left == ticks)
+		busy = cpu.progcount;
+	return left;
+}
+
+/* Returns true if Emulator2A03::takeInterrupt would enter a handler: an NMI, or an IRQ with
+ * the I flag clear. The dispatchers stop on it so that emulate_cpu takes it. */
+inline bool interrupt_due(const CPU& cpu, const std::atomic<uint32_t>& pending)
+{
+	uint32_t lines = pending.load(std::memory_order_relaxed);
+	return lines != 0 && ((lines & INT_NMI) || ((lines & INT_IRQ_MASK) && !F_INTDIS(cpu.procstat)));
+}
 
 //======================================================
 //Emulator
@@ -560,29 +1213,157 @@ void translate_CC00_set(Mapper& mapper, CPU& cpu, OPCODE code, REG_S8B& reg)
 /* Stop the emulation cycle. Meant to be called from thread or handler. */
 int Emulator2A03::stopEmulation()
 {
-	std::lock_guard<std::mutex> lock(ticks_remaining_m);
-	ticks_remaining = 0;
-	return ticks_remaining;
+	stopemulation.store(true);
+	//Either may have the emulator asleep
+	control.wake();
+	if (group != NULL)
+		group->wake();
+	return running.load() ? 1 : 0;
 }
 
-/* Emulate the CPU for a number of cycles. */
-int Emulator2A03::emulate_cpu(int exec_ticks)
+bool Emulator2A03::pollRequests()
+{
+	for (;;) {
+		if (stopemulation.load(std::memory_order_relaxed))
+			return stopemulation.exchange(false);
+		if (control.isPaused())
+			control.wait(&stopemulation);
+		else if (group != NULL && group->isPaused())
+			group->wait(&stopemulation);
+		else
+			return false;
+	}
+}
+
+/* Enter the NMI or IRQ handler as BRK does, with the same stack layout so RTI returns to
+ * the opcode interrupted, but pushing P with B clear. NMI wins over IRQ. */
+bool Emulator2A03::takeInterrupt()
+{
+	uint32_t lines = pending.load();
+	ADDR_16B vector;
+	if (lines & INT_NMI) {
+		pending.fetch_and(~INT_NMI);
+		vector = L_NMIHNDL;
+	}
+	else if ((lines & INT_IRQ_MASK) && !F_INTDIS(cpu.procstat))
+		vector = L_BRKHNDL;
+	else
+		return false;
+
+	//Push PC
+	mapper.writeMemory(L_STACKT + cpu.stackp.unsigned8, cpu.progcount & 0xFF);
+	--cpu.stackp.unsigned8;
+	mapper.writeMemory(L_STACKT + cpu.stackp.unsigned8, cpu.progcount >> 8);
+	--cpu.stackp.unsigned8;
+	//Push PSW, settled by the core on leaving
+	BYTE psw = cpu.procstat;
+	SETF_BRKCMD(psw, 0);
+	mapper.writeMemory(L_STACKT + cpu.stackp.unsigned8, psw);
+	--cpu.stackp.unsigned8;
+	SETF_INTDIS(cpu.procstat, 1);
+	cpu.progcount = mapper.readMemory(vector) | mapper.readMemory(vector + 1) << 8;
+	return true;
+}
+
+/* Take the mapper's fault. The PC recorded is progcount, which the core leaves on the
+ * opcode making the access. */
+ERROR_STATE Emulator2A03::recordFault()
+{
+	MemoryFault fault = mapper.takeFault();
+	faultaddr = fault.addr;
+	faultpc = cpu.progcount;
+	return fault_error(fault);
+}
+
+/* Snapshot the machine into caller provided storage. */
+void Emulator2A03::saveState(MachineState& state) const
+{
+	state.cpu = cpu;
+	state.clocks_used = scheduler.now();
+	state.pending = pending.load();
+	state.errstate = errstate;
+	state.faultaddr = faultaddr;
+	state.faultpc = faultpc;
+	mapper.saveState(state.mapper);
+}
+
+/* Restore a snapshot taken by saveState. */
+bool Emulator2A03::restoreState(const MachineState& state)
+{
+	if (!mapper.restoreState(state.mapper))
+		return false;
+	cpu = state.cpu;
+	scheduler.setClock(state.clocks_used);
+	pending.store(state.pending);
+	errstate = state.errstate;
+	faultaddr = state.faultaddr;
+	faultpc = state.faultpc;
+	return true;
+}
+
+void Emulator2A03::reset()
 {
-	stopemulation = false;
-	ticks_remaining = exec_ticks;
+	cpu.stackp.unsigned8 -= 3;
+	SETF_INTDIS(cpu.procstat, 1);
+	cpu.progcount = mapper.readMemory(L_PORHNDL) | mapper.readMemory(L_PORHNDL + 1) << 8;
+	pending.store(0);
+	errstate = ERROR_STATE::NONE;
+	faultaddr = 0;
+	faultpc = 0;
+}
 
-	while (ticks_remaining > 0) {
+void Emulator2A03::powerCycle()
+{
+	mapper.powerCycle();
+	initializeCPU(cpu);
+	//S comes up at 0, so the reset leaves it at $FD
+	cpu.stackp.unsigned8 = 0x00;
+	scheduler.clear();
+	scheduler.setClock(0);
+	control.resume();
+	group = NULL;
+	stopemulation.store(false);
+	reset();
+}
 
-		//Make sure we weren't stopped by another thread.
-		/* $STUB$ REVISE
-		ticks_remaining_m.lock();
-		if (stopemulation)
-			return ticks_remaining;
-		ticks_remaining_m.unlock();
-		*/
-		OPCODE code = mapper.readMemory(cpu.progcount);
+/* Attach a recompiled module, dropping the blocks recorded so far. */
+bool Emulator2A03::attachModule(std::shared_ptr<const RecompiledModule> module)
+{
+	if (!module->matches(mapper))
+		return false;
+	if (dispatch != Dispatch::BLOCK && dispatch != Dispatch::JIT)
+		dispatch = Dispatch::BLOCK;
+	if (!blocks)
+		blocks.reset(new BlockCache());
+	for (int i = 0; i < BLOCK_SLOTS; i++)
+		blocks->blocks[i].page = NULL;
+	blocks->module = module;
+	return true;
+}
+
+/* Fork the machine, sharing mapper pages copy-on-write. */
+std::unique_ptr<Machine> Emulator2A03::fork(Arena* arena)
+{
+	std::unique_ptr<Machine> child(new (arena) Machine(mapper.fork(arena), cpu));
+	child->emulator.scheduler.setClock(scheduler.now());
+	child->emulator.pending.store(pending.load());
+	child->emulator.errstate = errstate;
+	child->emulator.faultaddr = faultaddr;
+	child->emulator.faultpc = faultpc;
+	child->emulator.dispatch = dispatch;
+	return child;
+}
+
+/* Reference dispatch. Decodes each opcode with a switch, falling back to the
+ * AAABBBCC bit pattern decode for everything not handled explicitly. */
+static int dispatch_switch(Mapper& mapper, CPU& cpu, int ticks, ERROR_STATE& err, uint64_t& skips, const std::atomic<uint32_t>& pending)
+{
+	ADDR_16B busy = 0;
+	while (ticks > 0 && !interrupt_due(cpu, pending)) {
+		ADDR_16B pc = cpu.progcount;
+		OPCODE code = read_byte(mapper, cpu.progcount);
 		++cpu.progcount;
-		ticks_remaining -= OPTICK[code];
+		ticks -= OPTICK[code];
 
 		switch (code)
 		{
@@ -599,8 +1380,8 @@ int Emulator2A03::emulate_cpu(int exec_ticks)
 		case OP_KIL9:
 		case OP_KILA:
 		case OP_KILB:
-			errstate = ERROR_STATE::CPU_LOCK;
-			return ticks_remaining;
+			err = ERROR_STATE::CPU_LOCK;
+			return ticks;
 
 		//NOPs
 		case OP_NOP:
@@ -633,36 +1414,28 @@ int Emulator2A03::emulate_cpu(int exec_ticks)
 		//Increment/Decrement x/y registers
 		case OP_INX:
 			++cpu.xindex.signed8;
-			//Negative Flag
-			SETF_NEG(cpu.procstat, cpu.xindex.signed8 < 0);
-			//Zero Flag
-			SETF_ZERO(cpu.procstat, cpu.xindex.signed8 == 0);
+			//Negative and Zero Flags
+			LAZY_NZ(cpu, cpu.xindex.unsigned8);
 			break;
 		case OP_INY:
 			++cpu.yindex.signed8;
-			//Negative Flag
-			SETF_NEG(cpu.procstat, cpu.yindex.signed8 < 0);
-			//Zero Flag
-			SETF_ZERO(cpu.procstat, cpu.yindex.signed8 == 0);
+			//Negative and Zero Flags
+			LAZY_NZ(cpu, cpu.yindex.unsigned8);
 			break;
 		case OP_DEX:
 			--cpu.xindex.signed8;
-			//Negative Flag
-			SETF_NEG(cpu.procstat, cpu.xindex.signed8 < 0);
-			//Zero Flag
-			SETF_ZERO(cpu.procstat, cpu.xindex.signed8 == 0);
+			//Negative and Zero Flags
+			LAZY_NZ(cpu, cpu.xindex.unsigned8);
 			break;
 		case OP_DEY:
 			--cpu.yindex.signed8;
-			//Negative Flag
-			SETF_NEG(cpu.procstat, cpu.yindex.signed8 < 0);
-			//Zero Flag
-			SETF_ZERO(cpu.procstat, cpu.yindex.signed8 == 0);
+			//Negative and Zero Flags
+			LAZY_NZ(cpu, cpu.yindex.unsigned8);
 			break;
 
 
 		//Branch instructions
-#define JMP_CODE cpu.progcount += static_cast<int>(mapper.readMemory(cpu.progcount)) + 1;
+#define JMP_CODE cpu.progcount += static_cast<int>(read_byte(mapper, cpu.progcount)) + 1;
 
 		case OP_BCC:
 			if (!F_CARRY(cpu.procstat))
@@ -681,7 +1454,7 @@ int Emulator2A03::emulate_cpu(int exec_ticks)
 				++cpu.progcount;
 			break;
 		case OP_BEQ:
-			if (F_ZERO(cpu.procstat))
+			if (LAZYF_ZERO(cpu))
 			{
 				JMP_CODE;
 			}
@@ -689,7 +1462,7 @@ int Emulator2A03::emulate_cpu(int exec_ticks)
 				++cpu.progcount;
 			break;
 		case OP_BMI:
-			if (F_NEG(cpu.procstat))
+			if (LAZYF_NEG(cpu))
 			{
 				JMP_CODE;
 			}
@@ -697,7 +1470,7 @@ int Emulator2A03::emulate_cpu(int exec_ticks)
 				++cpu.progcount;
 			break;
 		case OP_BNE:
-			if (!F_ZERO(cpu.procstat))
+			if (!LAZYF_ZERO(cpu))
 			{
 				JMP_CODE;
 			}
@@ -705,7 +1478,7 @@ int Emulator2A03::emulate_cpu(int exec_ticks)
 				++cpu.progcount;
 			break;
 		case OP_BPL:
-			if (!F_NEG(cpu.procstat))
+			if (!LAZYF_NEG(cpu))
 			{
 				JMP_CODE;
 			}
@@ -732,45 +1505,33 @@ int Emulator2A03::emulate_cpu(int exec_ticks)
 		//Transfer instructions
 		case OP_TAX:
 			cpu.xindex = cpu.accumulator;
-			//Negative Flag
-			SETF_NEG(cpu.procstat, cpu.xindex.signed8 < 0);
-			//Zero Flag
-			SETF_ZERO(cpu.procstat, cpu.xindex.signed8 == 0);
+			//Negative and Zero Flags
+			LAZY_NZ(cpu, cpu.xindex.unsigned8);
 			break;
 		case OP_TXA:
 			cpu.accumulator = cpu.xindex;
-			//Negative Flag
-			SETF_NEG(cpu.procstat, cpu.accumulator.signed8 < 0);
-			//Zero Flag
-			SETF_ZERO(cpu.procstat, cpu.accumulator.signed8 == 0);
+			//Negative and Zero Flags
+			LAZY_NZ(cpu, cpu.accumulator.unsigned8);
 			break;
 		case OP_TAY:
 			cpu.yindex = cpu.accumulator;
-			//Negative Flag
-			SETF_NEG(cpu.procstat, cpu.yindex.signed8 < 0);
-			//Zero Flag
-			SETF_ZERO(cpu.procstat, cpu.yindex.signed8 == 0);
+			//Negative and Zero Flags
+			LAZY_NZ(cpu, cpu.yindex.unsigned8);
 			break;
 		case OP_TYA:
 			cpu.accumulator = cpu.yindex;
-			//Negative Flag
-			SETF_NEG(cpu.procstat, cpu.accumulator.signed8 < 0);
-			//Zero Flag
-			SETF_ZERO(cpu.procstat, cpu.xindex.signed8 == 0);
+			//Negative and Zero Flags
+			LAZY_NZ(cpu, cpu.accumulator.unsigned8);
 			break;
 		case OP_TSX:
 			cpu.xindex = cpu.stackp;
-			//Negative Flag
-			SETF_NEG(cpu.procstat, cpu.xindex.signed8 < 0);
-			//Zero Flag
-			SETF_ZERO(cpu.procstat, cpu.xindex.signed8 == 0);
+			//Negative and Zero Flags
+			LAZY_NZ(cpu, cpu.xindex.unsigned8);
 			break;
 		case OP_TXS:
 			cpu.stackp = cpu.xindex;
-			//Negative Flag
-			SETF_NEG(cpu.procstat, cpu.stackp.signed8 < 0);
-			//Zero Flag
-			SETF_ZERO(cpu.procstat, cpu.stackp.signed8 == 0);
+			//Negative and Zero Flags
+			LAZY_NZ(cpu, cpu.stackp.unsigned8);
 			break;
 
 		//Stack instructions - $STUB$ Implement stack overflow
@@ -780,19 +1541,18 @@ int Emulator2A03::emulate_cpu(int exec_ticks)
 			break;
 		case OP_PLA:
 			++cpu.stackp.unsigned8;
-			cpu.accumulator.unsigned8 = mapper.readMemory(L_STACKT + cpu.stackp.unsigned8);
-			//Negative Flag
-			SETF_NEG(cpu.procstat, cpu.accumulator.signed8 < 0);
-			//Zero Flag
-			SETF_ZERO(cpu.procstat, cpu.accumulator.signed8 == 0);
+			cpu.accumulator.unsigned8 = read_byte(mapper, L_STACKT + cpu.stackp.unsigned8);
+			//Negative and Zero Flags
+			LAZY_NZ(cpu, cpu.accumulator.unsigned8);
 			break;
 		case OP_PHP:
-			mapper.writeMemory(L_STACKT + cpu.stackp.unsigned8, cpu.procstat);
+			mapper.writeMemory(L_STACKT + cpu.stackp.unsigned8, settledFlags(cpu));
 			--cpu.stackp.unsigned8;
 			break;
 		case OP_PLP:
 			++cpu.stackp.unsigned8;
-			cpu.procstat = mapper.readMemory(L_STACKT + cpu.stackp.unsigned8);
+			cpu.procstat = read_byte(mapper, L_STACKT + cpu.stackp.unsigned8);
+			loadFlags(cpu);
 			break;
 
 		//Set and Clear
@@ -827,10 +1587,10 @@ int Emulator2A03::emulate_cpu(int exec_ticks)
 			mapper.writeMemory(L_STACKT + cpu.stackp.unsigned8, (cpu.progcount >> 8));
 			--cpu.stackp.unsigned8;
 			//Push PSW
-			mapper.writeMemory(L_STACKT + cpu.stackp.unsigned8, cpu.procstat);
+			mapper.writeMemory(L_STACKT + cpu.stackp.unsigned8, settledFlags(cpu));
 			--cpu.stackp.unsigned8;
 			//Go to BRK address
-			cpu.progcount = mapper.readMemory(L_BRKHNDL) | mapper.readMemory(L_BRKHNDL + 1) << 8;
+			cpu.progcount = read_byte(mapper, L_BRKHNDL) | read_byte(mapper, L_BRKHNDL + 1) << 8;
 			SETF_BRKCMD(cpu.procstat, 1);
 			break;
 		case OP_JSRABS:
@@ -840,124 +1600,617 @@ int Emulator2A03::emulate_cpu(int exec_ticks)
 			mapper.writeMemory(L_STACKT + cpu.stackp.unsigned8, (cpu.progcount + 1) >> 8);
 			--cpu.stackp.unsigned8;
 			//Go to address specified by operand
-			cpu.progcount = mapper.readMemory(cpu.progcount) | (mapper.readMemory(cpu.progcount + 1) << 8);
+			cpu.progcount = read_byte(mapper, cpu.progcount) | (read_byte(mapper, cpu.progcount + 1) << 8);
 			break;
 		case OP_RTI:
 			//Pop PSW
-			cpu.procstat = mapper.readMemory(L_STACKT + cpu.stackp.unsigned8);
 			++cpu.stackp.unsigned8;
+			cpu.procstat = read_byte(mapper, L_STACKT + cpu.stackp.unsigned8);
+			loadFlags(cpu);
 			//Pop PC - Return address
 			++cpu.stackp.unsigned8;
-			cpu.progcount = mapper.readMemory(L_STACKT + cpu.stackp.unsigned8) << 8;
+			cpu.progcount = read_byte(mapper, L_STACKT + cpu.stackp.unsigned8) << 8;
 			++cpu.stackp.unsigned8;
-			cpu.progcount |= mapper.readMemory(L_STACKT + cpu.stackp.unsigned8);
+			cpu.progcount |= read_byte(mapper, L_STACKT + cpu.stackp.unsigned8);
 			break;
 		case OP_RTS:
 			//Pop PC - Return address
 			++cpu.stackp.unsigned8;
-			cpu.progcount = mapper.readMemory(L_STACKT + cpu.stackp.unsigned8) << 8;
+			cpu.progcount = read_byte(mapper, L_STACKT + cpu.stackp.unsigned8) << 8;
 			++cpu.stackp.unsigned8;
-			cpu.progcount |= mapper.readMemory(L_STACKT + cpu.stackp.unsigned8);
+			cpu.progcount |= read_byte(mapper, L_STACKT + cpu.stackp.unsigned8);
 			++cpu.progcount;
 			break;
 		case OP_JMP:
 			//Indirection
-			cpu.progcount = mapper.readMemory(cpu.progcount) |
-				(mapper.readMemory(cpu.progcount + 1) << 8);
-			cpu.progcount = mapper.readMemory(cpu.progcount) |
-				(mapper.readMemory(cpu.progcount + 1) << 8);
+			cpu.progcount = read_byte(mapper, cpu.progcount) |
+				(read_byte(mapper, cpu.progcount + 1) << 8);
+			cpu.progcount = read_byte(mapper, cpu.progcount) |
+				(read_byte(mapper, cpu.progcount + 1) << 8);
 			break;
 		case OP_JMPABS:
-			cpu.progcount = mapper.readMemory(cpu.progcount) | (mapper.readMemory(cpu.progcount + 1) << 8);
+			cpu.progcount = read_byte(mapper, cpu.progcount) | (read_byte(mapper, cpu.progcount + 1) << 8);
+			ticks = skip_idle(mapper, cpu, ticks, busy, skips);
 			break;
 
 		//Handle OPCODEs with AAABBBCC bit patterns
 		default:
+			err = translate_AAABBBCC(mapper, cpu, code);
+			if (err != ERROR_STATE::NONE)
+				return ticks;
+		}
+		if (mapper.hasFault()) {
+			//Stop on the opcode refused an access
+			cpu.progcount = pc;
+			err = fault_error(mapper.getFault());
+			return ticks;
+		}
+	}
+
+	return ticks;
+}
 
-			//$STUB$ reinterperet_cast to maintain bit patterns
-			switch (code & MASK_AAACC)
+/* Table dispatch. One indirect call per opcode through a 256 entry handler table. */
+template<class MAPPER>
+static int dispatch_table(MAPPER& mapper, CPU& cpu, int ticks, ERROR_STATE& err, uint64_t& skips, const std::atomic<uint32_t>& pending)
+{
+	const OpHandler<MAPPER>* optable = op_table<MAPPER>();
+	ADDR_16B busy = 0;
+
+	while (ticks > 0 && !interrupt_due(cpu, pending)) {
+		OPCODE code = read_byte(mapper, cpu.progcount);
+		++cpu.progcount;
+		ticks -= OPTICK[code];
+
+		ERROR_STATE result = optable[code](mapper, cpu);
+		if (result != ERROR_STATE::NONE) {
+			err = result;
+			return ticks;
+		}
+		if (code == OP_JMPABS)
+			ticks = skip_idle(mapper, cpu, ticks, busy, skips);
+	}
+
+	return ticks;
+}
+
+#ifdef DISPATCH_HOST_GOTO
+/* Threaded dispatch. Every handler is inlined behind its own label and ends with
+ * its own copy of the fetch and indirect jump to the next handler. */
+template<class MAPPER>
+static int dispatch_threaded(MAPPER& mapper, CPU& cpu, int ticks, ERROR_STATE& err, uint64_t& skips, const std::atomic<uint32_t>& pending)
+{
+#define OPLABEL_ADDR(CODE) &&L_##CODE,
+	static void* const labels[256] = { OPCODES(OPLABEL_ADDR) };
+	OPCODE code;
+	ERROR_STATE result;
+	ADDR_16B busy = 0;
+
+#define NEXT_OP \
+	if (ticks <= 0 || interrupt_due(cpu, pending)) \
+		return ticks; \
+	code = read_byte(mapper, cpu.progcount); \
+	++cpu.progcount; \
+	ticks -= OPTICK[code]; \
+	goto *labels[code];
+
+#define OPLABEL(CODE) \
+	L_##CODE: \
+	result = run_op<MAPPER, CODE>(mapper, cpu); \
+	if (result != ERROR_STATE::NONE) { \
+		err = result; \
+		return ticks; \
+	} \
+	if (CODE == OP_JMPABS) \
+		ticks = skip_idle(mapper, cpu, ticks, busy, skips); \
+	NEXT_OP
+
+	NEXT_OP
+	OPCODES(OPLABEL)
+#undef NEXT_OP
+#undef OPLABEL
+#undef OPLABEL_ADDR
+}
+#endif
+
+emu::BlockCache::BlockCache()
+{
+	for (int i = 0; i < BLOCK_SLOTS; i++)
+		blocks[i].page = NULL;
+	host.pagegen = NULL;
+}
+
+emu::BlockCache::~BlockCache()
+{
+}
+
+void emu::BlockCache::flushNative()
+{
+	for (int i = 0; i < BLOCK_SLOTS; i++) {
+		blocks[i].native = NULL;
+		blocks[i].hits = 0;
+	}
+	if (jit)
+		jit->flush();
+}
+
+bool emu::BlockCache::endsBlock(OPCODE code)
+{
+	if ((code & 0x1F) == 0x10) //Branches
+		return true;
+	switch (code)
+	{
+	case OP_BRK:
+	case OP_JSRABS:
+	case OP_RTI:
+	case OP_RTS:
+	case OP_JMP:
+	case OP_JMPABS:
+		return true;
+	}
+	return false;
+}
+
+//Fused Opcodes ========================================
+
+/* Pairs of opcodes a block runs whole as one step, as FUSION(NAME, FIRST, SECOND). FIRST
+ * never ends a block nor writes memory, so a block still sees writes to its own page. */
+#define FUSIONS(FUSION) \
+	FUSION(DEX_BNE, OP_DEX, OP_BNE) \
+	FUSION(DEY_BNE, OP_DEY, OP_BNE) \
+	FUSION(DEX_BPL, OP_DEX, OP_BPL) \
+	FUSION(DEY_BPL, OP_DEY, OP_BPL) \
+	FUSION(INX_BNE, OP_INX, OP_BNE) \
+	FUSION(INY_BNE, OP_INY, OP_BNE) \
+	FUSION(CLC_ADCI, OP_CLC, OP_ADC | AMODE_IMMED) \
+	FUSION(CLC_ADCZ, OP_CLC, OP_ADC | AMODE_ZPAGE) \
+	FUSION(SEC_SBCI, OP_SEC, OP_SBC | AMODE_IMMED) \
+	FUSION(SEC_SBCZ, OP_SEC, OP_SBC | AMODE_ZPAGE) \
+	FUSION(LDAI_STAZ, OP_LDA | AMODE_IMMED, OP_STA | AMODE_ZPAGE) \
+	FUSION(LDAI_STAA, OP_LDA | AMODE_IMMED, OP_STA | AMODE_ABS) \
+	FUSION(LDAZ_STAZ, OP_LDA | AMODE_ZPAGE, OP_STA | AMODE_ZPAGE) \
+	FUSION(LDAA_STAA, OP_LDA | AMODE_ABS, OP_STA | AMODE_ABS)
+
+//Steps up to 0xFF run a single opcode
+#define FUSION_STEP(NAME, FIRST, SECOND) FUSE_##NAME,
+enum Fusion { FUSE_BASE = 0xFF, FUSIONS(FUSION_STEP) FUSE_END };
+#undef FUSION_STEP
+
+//Ops covered by a step
+#define STEP_OPS(STEP) (1 + ((STEP) >> 8))
+
+/* Runs the step starting at ops[0] of a block run whole. */
+template<class MAPPER>
+using StepHandler = ERROR_STATE (*)(MAPPER& mapper, CPU& cpu, const MicroOp* ops);
+
+template<class MAPPER, OPCODE CODE>
+ERROR_STATE single_step(MAPPER& mapper, CPU& cpu, const MicroOp* ops)
+{
+	cpu.progcount = ops[0].pc + 1;
+	return run_op<MAPPER, CODE>(mapper, cpu);
+}
+
+/* Both handlers inlined into one, so flags set by FIRST and read by SECOND stay in registers. */
+template<class MAPPER, OPCODE FIRST, OPCODE SECOND>
+ERROR_STATE fused_step(MAPPER& mapper, CPU& cpu, const MicroOp* ops)
+{
+	cpu.progcount = ops[0].pc + 1;
+	ERROR_STATE result = run_op<MAPPER, FIRST>(mapper, cpu);
+	if (result != ERROR_STATE::NONE)
+		return result;
+	//Past the operands of FIRST is SECOND
+	++cpu.progcount;
+	return run_op<MAPPER, SECOND>(mapper, cpu);
+}
+
+/* The handler table of every step, opcodes first. */
+template<class MAPPER>
+static const StepHandler<MAPPER>* step_table()
+{
+#define STEP_ENTRY(CODE) &single_step<MAPPER, CODE>,
+#define FUSED_ENTRY(NAME, FIRST, SECOND) &fused_step<MAPPER, FIRST, SECOND>,
+	static constexpr StepHandler<MAPPER> steptable[FUSE_END] = { OPCODES(STEP_ENTRY) FUSIONS(FUSED_ENTRY) };
+#undef STEP_ENTRY
+#undef FUSED_ENTRY
+	return steptable;
+}
+
+/* Fill in the steps of a block, fusing pairs greedily from its first op. */
+static void plan_steps(Block& block)
+{
+#define FUSION_CASE(NAME, FIRST, SECOND) case (FIRST) << 8 | (SECOND): id = FUSE_##NAME; break;
+	block.stepcount = 0;
+	int i = 0;
+	while (i < block.count) {
+		uint16_t id = block.ops[i].code;
+		if (i + 1 < block.count) {
+			switch (block.ops[i].code << 8 | block.ops[i + 1].code)
 			{
-			//==== Start of CC 01 ====
-			case OP_ORA:
-				translate_CC01_get(mapper, cpu, code, cpu.accumulator, operations::BIT_OR);
-				break;
-			case OP_AND:
-				translate_CC01_get(mapper, cpu, code, cpu.accumulator, operations::BIT_AND);
-				break;
-			case OP_EOR:
-				translate_CC01_get(mapper, cpu, code, cpu.accumulator, operations::BIT_XOR);
-				break;
-			case OP_ADC:
-				translate_CC01_get(mapper, cpu, code, cpu.accumulator, operations::ADD);
-				break;
-			case OP_STA:
-				translate_CC01_set(mapper, cpu, code, cpu.accumulator);
-				break;
-			case OP_LDA:
-				translate_CC01_get(mapper, cpu, code, cpu.accumulator, operations::EQL);
-				break;
-			case OP_CMP:
-				translate_CC01_get(mapper, cpu, code, cpu.accumulator, operations::CMP);
-				break;
-			case OP_SBC:
-				translate_CC01_get(mapper, cpu, code, cpu.accumulator, operations::SUB);
-				break;
-
-			//==== Start of CC 10 ====
-			case OP_ASL:
-				//translate_CC10_get(mapper, cpu, code, cpu.accumulator, operations::ASL);
-				break;
-			case OP_ROL:
-				//translate_CC10_get(mapper, cpu, code, cpu.accumulator, operations::ROL);
-				break;
-			case OP_LSR:
-				//translate_CC10_get(mapper, cpu, code, cpu.accumulator, operations::LSR);
-				break;
-			case OP_ROR:
-				//translate_CC10_get(mapper, cpu, code, cpu.accumulator, operations::ROR);
-				break;
-			case OP_STX:
-				//translate_CC10_set(mapper, cpu, code, cpu.xindex);
-				break;
-			case OP_LDX:
-				//translate_CC10_get(mapper, cpu, code, cpu.xindex, operations::EQL);
-				break;
-			case OP_DEC:
-				//$STUB$
-				break;
-			case OP_INC:
-				//$STUB$
-				break;
-
-		    //==== Start of CC 00 ====
-			case OP_BIT:
-				//TRANSLATE_CC00_GET(code, mapper, cpu.temp.signed8, = );
-				//Zero Flag
-				SETF_ZERO(cpu.procstat, (uint8_t)((cpu.accumulator.unsigned8 & cpu.temp.unsigned8) == 0));
-				//Negative Flag
-				SETF_NEG(cpu.procstat, cpu.temp.signed8 < 0);
-				//Overflow Flag
-				SETF_OVRFLOW(cpu.procstat, BIT6(cpu.temp.unsigned8));
-				break;
-			case OP_STY:
-				//translate_CC00_set(mapper, cpu, code, cpu.yindex);
-				break;
-			case OP_LDY:
-				//translate_CC00_get(mapper, cpu, code, cpu.yindex, operations::EQL);
-				break;
-			case OP_CPY:
-				//translate_CC00_get(mapper, cpu, code, cpu.yindex, operations::CMP);
-				break;
-			case OP_CPX:
-				//translate_CC00_get(mapper, cpu, code, cpu.xindex, operations::CMP);
-				break;
-
-			default:
-				errstate = ERROR_STATE::UNKNOWN_INSTRUCTION;
-				return ticks_remaining;
+			FUSIONS(FUSION_CASE)
+			}
+		}
+		BlockStep& step = block.steps[block.stepcount++];
+		step.id = id;
+		step.op = i;
+		i += STEP_OPS(id);
+	}
+#undef FUSION_CASE
+}
+
+/* Run from progcount to the end of a block with a budget check per opcode, recording the
+ * opcodes into block. A NULL block runs a single opcode. A block cut short by the budget
+ * or by a write to its own page is dropped. */
+template<class MAPPER>
+static int record_block(MAPPER& mapper, CPU& cpu, int ticks, ERROR_STATE& err, Block* block)
+{
+	const OpHandler<MAPPER>* optable = op_table<MAPPER>();
+	const uint32_t* pagegen = mapper.getPageGenerations();
+	int page = cpu.progcount >> 12;
+	bool complete = false;
+
+	if (block != NULL) {
+		block->pc = cpu.progcount;
+		block->page = mapper.getReadPages()[page];
+		block->gen = pagegen[page];
+		block->count = 0;
+		block->cost = 0;
+		block->hits = 0;
+		block->native = NULL;
+		block->aot = NULL;
+		mapper.markCodePage(page);
+	}
+
+	while (ticks > 0) {
+		OPCODE code = read_byte(mapper, cpu.progcount);
+		if (block != NULL) {
+			MicroOp& op = block->ops[block->count++];
+			op.code = code;
+			op.ticks = OPTICK[code];
+			op.pc = cpu.progcount;
+			block->lead = block->cost;
+			block->cost += OPTICK[code];
+		}
+		++cpu.progcount;
+		ticks -= OPTICK[code];
+
+		ERROR_STATE result = optable[code](mapper, cpu);
+		if (result != ERROR_STATE::NONE) {
+			err = result;
+			complete = true;
+			break;
+		}
+		if (block == NULL)
+			return ticks;
+		if (pagegen[page] != block->gen)
+			break;
+		if (BlockCache::endsBlock(code) || block->count == BLOCK_MAX_OPS || (cpu.progcount >> 12) != page) {
+			complete = true;
+			break;
+		}
+	}
+
+	if (block != NULL && !complete)
+		block->page = NULL;
+	else if (block != NULL)
+		plan_steps(*block);
+	return ticks;
+}
+
+/* Translate a block that has run whole JIT_THRESHOLD times, starting the arena over if it
+ * is full. */
+template<class MAPPER>
+static NativeBlock compile_block(MAPPER& mapper, BlockCache& blocks, const Block& block)
+{
+	static const struct Handlers {
+		Handlers() {
+			for (int i = 0; i < 256; i++)
+				addr[i] = reinterpret_cast<const void*>(op_table<MAPPER>()[i]);
+		}
+		const void* addr[256];
+	} handlers;
+
+	if (!blocks.jit)
+		blocks.jit.reset(new JitX64());
+	NativeBlock native = blocks.jit->compile(block, handlers.addr, mapper);
+	if (native == NULL) {
+		blocks.flushNative();
+		native = blocks.jit->compile(block, handlers.addr, mapper);
+	}
+	return native;
+}
+
+/* Fill block from the attached module if it has a block for pc as currently mapped. */
+template<class MAPPER>
+static bool load_recompiled(MAPPER& mapper, BlockCache& blocks, Block& block, ADDR_16B pc)
+{
+	int32_t prgoffset = mapper.getPrgOffset(pc);
+	if (prgoffset < 0)
+		return false;
+	const RecompiledBlock* aot = blocks.module->find(pc, prgoffset);
+	if (aot == NULL)
+		return false;
+
+	if (blocks.host.pagegen == NULL) {
+		for (int i = 0; i < 256; i++)
+			blocks.host.handlers[i] = recompiled_table<MAPPER>()[i];
+		blocks.host.pagegen = mapper.getPageGenerations();
+	}
+
+	int page = pc >> 12;
+	block.pc = pc;
+	block.page = mapper.getReadPages()[page];
+	block.gen = mapper.getPageGenerations()[page];
+	block.count = aot->count;
+	block.cost = 0;
+	for (int i = 0; i < aot->count; i++) {
+		block.ops[i] = aot->ops[i];
+		block.lead = block.cost;
+		block.cost += aot->ops[i].ticks;
+	}
+	plan_steps(block);
+	block.hits = 0;
+	block.native = NULL;
+	block.aot = aot->fn;
+	mapper.markCodePage(page);
+	return true;
+}
+
+/* Blocks run whole that end in OP_JMPABS may have closed an idle loop. */
+template<class MAPPER>
+inline int block_ended(MAPPER& mapper, const CPU& cpu, const Block& block, int ticks, ADDR_16B& busy, uint64_t& skips)
+{
+	return block.ops[block.count - 1].code == OP_JMPABS ? skip_idle(mapper, cpu, ticks, busy, skips) : ticks;
+}
+
+/* Block dispatch. Replays cached blocks with one budget check per block when the budget
+ * covers the whole block, and per opcode otherwise, so the ticks left match the other
+ * dispatchers exactly. Blocks run whole go a step at a time, fused pairs of opcodes being
+ * a single step, or once hot as one native call if JIT. Code on pages without a direct read
+ * pointer is never cached. Interrupts are taken between blocks. */
+template<class MAPPER, bool JIT>
+static int dispatch_block(MAPPER& mapper, CPU& cpu, int ticks, ERROR_STATE& err, uint64_t& skips, const std::atomic<uint32_t>& pending, BlockCache& blocks)
+{
+	const OpHandler<MAPPER>* optable = op_table<MAPPER>();
+	const StepHandler<MAPPER>* steptable = step_table<MAPPER>();
+	const uint32_t* pagegen = mapper.getPageGenerations();
+	ADDR_16B busy = 0;
+
+	while (ticks > 0 && !interrupt_due(cpu, pending)) {
+		ADDR_16B pc = cpu.progcount;
+		int page = pc >> 12;
+		const BYTE* base = mapper.getReadPages()[page];
+		Block& block = blocks.slot(pc);
+
+		if (base == NULL || block.page != base || block.pc != pc || block.gen != pagegen[page]) {
+			if (base != NULL && blocks.module && load_recompiled(mapper, blocks, block, pc))
+				continue;
+			ticks = record_block(mapper, cpu, ticks, err, base != NULL ? &block : NULL);
+			if (err != ERROR_STATE::NONE)
+				return ticks;
+			continue;
+		}
+
+		if (ticks > block.lead) {
+			if (block.aot != NULL) {
+				ticks -= block.cost;
+				int ran = block.aot(&mapper, &cpu, &blocks.host);
+				for (int i = ran >> 8; i < block.count; i++)
+					ticks += block.ops[i].ticks;
+				if ((ran & 0xFF) != ERROR_STATE::NONE) {
+					err = static_cast<ERROR_STATE>(ran & 0xFF);
+					return ticks;
+				}
+				ticks = block_ended(mapper, cpu, block, ticks, busy, skips);
+				continue;
+			}
+			if (JIT && block.native == NULL && ++block.hits == JIT_THRESHOLD)
+				block.native = compile_block(mapper, blocks, block);
+			if (JIT && block.native != NULL) {
+				ticks -= block.cost;
+				int ran = block.native(&mapper, &cpu);
+				//Stopped early on an error or a write to its own page
+				for (int i = ran >> 8; i < block.count; i++)
+					ticks += block.ops[i].ticks;
+				if ((ran & 0xFF) != ERROR_STATE::NONE) {
+					err = static_cast<ERROR_STATE>(ran & 0xFF);
+					return ticks;
+				}
+				ticks = block_ended(mapper, cpu, block, ticks, busy, skips);
+				continue;
+			}
+			ticks -= block.cost;
+			for (int i = 0; i < block.stepcount; i++) {
+				const BlockStep& step = block.steps[i];
+				ERROR_STATE result = steptable[step.id](mapper, cpu, &block.ops[step.op]);
+				if (result != ERROR_STATE::NONE) {
+					//Give back the ticks of the ops after the one stopped on, which is left at
+					//progcount on a fault
+					for (int op = block.count - 1; op > step.op && block.ops[op].pc > cpu.progcount; op--)
+						ticks += block.ops[op].ticks;
+					err = result;
+					return ticks;
+				}
+				if (pagegen[page] != block.gen) {
+					//The block wrote to its own page, give back the ticks of the ops not run
+					for (int op = step.op + STEP_OPS(step.id); op < block.count; op++)
+						ticks += block.ops[op].ticks;
+					break;
+				}
+			}
+			ticks = block_ended(mapper, cpu, block, ticks, busy, skips);
+		}
+		else {
+			for (int i = 0; i < block.count && ticks > 0; i++) {
+				cpu.progcount = block.ops[i].pc + 1;
+				ticks -= block.ops[i].ticks;
+				ERROR_STATE result = optable[block.ops[i].code](mapper, cpu);
+				if (result != ERROR_STATE::NONE) {
+					err = result;
+					return ticks;
+				}
+				if (pagegen[page] != block.gen)
+					break;
 			}
 		}
 	}
 
-	return ticks_remaining;
-}
\ No newline at end of file
+	return ticks;
+}
+
+/* Run the interpreter for dispatch. Dispatch::SWITCH always goes through the virtual
+ * Mapper interface. */
+template<class MAPPER>
+int emu::Core2A03<MAPPER>::run(MAPPER& mapper, CPU& cpu, int ticks, ERROR_STATE& err, uint64_t& skips,
+	const std::atomic<uint32_t>& pending, Dispatch dispatch, BlockCache* blocks)
+{
+	//procstat may have been set from outside; N and Z are only recorded while running
+	loadFlags(cpu);
+	switch (dispatch)
+	{
+	case Dispatch::SWITCH:
+		ticks = dispatch_switch(mapper, cpu, ticks, err, skips, pending);
+		break;
+	case Dispatch::THREADED:
+#ifdef DISPATCH_HOST_GOTO
+		ticks = dispatch_threaded(mapper, cpu, ticks, err, skips, pending);
+		break;
+#endif
+	case Dispatch::TABLE:
+		ticks = dispatch_table(mapper, cpu, ticks, err, skips, pending);
+		break;
+	case Dispatch::BLOCK:
+		ticks = dispatch_block<MAPPER, false>(mapper, cpu, ticks, err, skips, pending, *blocks);
+		break;
+	case Dispatch::JIT:
+		ticks = dispatch_block<MAPPER, true>(mapper, cpu, ticks, err, skips, pending, *blocks);
+		break;
+	}
+	settleFlags(cpu);
+	return ticks;
+}
+
+template struct emu::Core2A03<Mapper>;
+template struct emu::Core2A03<DefaultMapper>;
+template struct emu::Core2A03<StrictMapper>;
+
+/* Adapts Core2A03<MAPPER> to Emulator2A03::CoreFn. */
+template<class MAPPER>
+static int run_core(Mapper& mapper, CPU& cpu, int ticks, ERROR_STATE& err, uint64_t& skips,
+	const std::atomic<uint32_t>& pending, Dispatch dispatch, BlockCache* blocks)
+{
+	return Core2A03<MAPPER>::run(static_cast<MAPPER&>(mapper), cpu, ticks, err, skips, pending, dispatch, blocks);
+}
+
+/* Pick the interpreter instantiation for a mapper, and with it the mapper's enforcement policy.
+ * Mappers without a dedicated instantiation use virtual memory access. */
+Emulator2A03::CoreFn Emulator2A03::selectCore(Mapper& mapper)
+{
+	switch (mapper.getMapperNumber())
+	{
+	case 0:
+		if (dynamic_cast<DefaultMapper*>(&mapper) != NULL)
+			return &run_core<DefaultMapper>;
+		if (dynamic_cast<StrictMapper*>(&mapper) != NULL)
+			return &run_core<StrictMapper>;
+		break;
+	}
+	return &run_core<Mapper>;
+}
+
+/* Fall back on TABLE without computed goto, and on BLOCK where JitX64 cannot translate. */
+Dispatch Emulator2A03::hostDispatch(Dispatch use)
+{
+#ifndef DISPATCH_HOST_GOTO
+	if (use == Dispatch::THREADED)
+		return Dispatch::TABLE;
+#endif
+#ifndef JIT_HOST_X64
+	if (use == Dispatch::JIT)
+		return Dispatch::BLOCK;
+#endif
+	return use;
+}
+
+/* Emulate the CPU for a number of cycles, in slices ending at the next scheduled event and
+ * at most RUN_POLL_TICKS long, with a poll of the run requests before each. Slicing leaves the
+ * same ticks as one run: a slice stops after the opcode that uses up its ticks, and so would
+ * the run unless that also used up the budget. Events run once the opcode crossing their
+ * deadline has. The core stops before the first opcode (block under BLOCK and JIT) it would
+ * run while an interrupt is due, which is then taken here, so one raised by another thread or
+ * unmasked by CLI, PLP or RTI is not left until the end of the slice. */
+int Emulator2A03::emulate_cpu(int exec_ticks)
+{
+	ERROR_STATE err = ERROR_STATE::NONE;
+
+	if (!blocks && (dispatch == Dispatch::BLOCK || dispatch == Dispatch::JIT))
+		blocks.reset(new BlockCache());
+	running.store(true);
+	//Events scheduled in the past since the last run
+	scheduler.advance(0);
+	int ticks = exec_ticks;
+	while (ticks > 0 && !pollRequests()) {
+		if (mapper.hasFault()) {
+			//Refused outside the core, by the host or a scheduled event
+			errstate = recordFault();
+			break;
+		}
+		int limit = ticks < RUN_POLL_TICKS ? ticks : RUN_POLL_TICKS;
+		if (pending.load(std::memory_order_relaxed) != 0 && takeInterrupt()) {
+			ticks -= INT_TICKS;
+			scheduler.advance(INT_TICKS);
+			continue;
+		}
+		int slice = scheduler.ticksUntilNext(limit);
+		int used = slice - core(mapper, cpu, slice, err, idleskips, pending, dispatch, blocks.get());
+		ticks -= used;
+		scheduler.advance(used);
+		if (err != ERROR_STATE::NONE) {
+			//The core stops on an opcode refused an access
+			if (err == ERROR_STATE::BAD_READ || err == ERROR_STATE::BAD_WRITE)
+				recordFault();
+			errstate = err;
+			break;
+		}
+	}
+	running.store(false);
+	return ticks;
+}
+
+//======================================================
+//RunControl
+//======================================================
+
+void RunControl::pause()
+{
+	std::lock_guard<std::mutex> lock(m);
+	if (!(epoch.load() & 1))
+		epoch.fetch_add(1);
+}
+
+void RunControl::resume()
+{
+	{
+		std::lock_guard<std::mutex> lock(m);
+		if (epoch.load() & 1)
+			epoch.fetch_add(1);
+	}
+	cv.notify_all();
+}
+
+void RunControl::wait(const std::atomic<bool>* stop)
+{
+	std::unique_lock<std::mutex> lock(m);
+	uint32_t seen = epoch.load();
+	if (!(seen & 1))
+		return;
+	cv.wait(lock, [&] { return epoch.load() != seen || (stop != NULL && stop->load()); });
+}
+
+void RunControl::wake()
+{
+	{
+		//Taken so a wait between its check and its sleep does not miss the notify
+		std::lock_guard<std::mutex> lock(m);
+	}
+	cv.notify_all();
+}
@@ -7,33 +7,179 @@
 #endif
 
 #include "NTDef.h"
+#include "CPU.h"
 #include "Mapper.h"
 #include "Debug.h"
+#include "Scheduler.h"
+#include <atomic>
+#include <condition_variable>
 #include <mutex>
 #include <memory>
+
+//Hosts with computed goto, which Dispatch::THREADED needs
+#ifdef __GNUC__
+#define DISPATCH_HOST_GOTO
+#endif
+
+//Hosts JitX64 can translate for
+#if defined __x86_64__ && (defined __unix__ || defined __APPLE__)
+#define JIT_HOST_X64
+#endif
+
+/* Dispatch emulators start on. Define one of DISPATCH_SWITCH, DISPATCH_TABLE, DISPATCH_THREADED,
+ * DISPATCH_BLOCK or DISPATCH_JIT at build time for another than Dispatch::THREADED. Every
+ * dispatch is built either way; see Emulator2A03::setDispatch.
+ */
+#if defined DISPATCH_SWITCH
+#define DISPATCH_DEFAULT Dispatch::SWITCH
+#elif defined DISPATCH_TABLE
+#define DISPATCH_DEFAULT Dispatch::TABLE
+#elif defined DISPATCH_JIT
+#define DISPATCH_DEFAULT Dispatch::JIT
+#elif defined DISPATCH_BLOCK
+#define DISPATCH_DEFAULT Dispatch::BLOCK
+#else
+#define DISPATCH_DEFAULT Dispatch::THREADED
+#endif
+
 namespace emu {
-	extern const BYTE OPTICK[];
-
-	enum ERROR_STATE { NONE, CPU_LOCK, UNKNOWN_INSTRUCTION };
-
-	struct CPU {
-		REG_S16B progcount;
-		REG_S8B accumulator;
-		REG_S8B xindex;
-		REG_S8B yindex;
-		REG_S8B stackp;
-		uint8_t procstat;
-		REG_S8B temp;
-		REG_S8B debug;
+	/* Opcode dispatch used by Emulator2A03::emulate_cpu.
+	 * SWITCH   - Nested switch decode. Reference implementation.
+	 * TABLE    - One indirect call per opcode through a 256 entry handler table.
+	 * THREADED - One indirect jump per opcode through a 256 entry label table (computed goto).
+	 * BLOCK    - Replays straight-line runs of opcodes recorded in a per-emulator block cache.
+	 * JIT      - BLOCK, translating hot blocks into x86-64 code (see Jit.h).
+	 * THREADED falls back to TABLE on compilers without computed goto, and JIT to BLOCK on
+	 * anything but x86-64 with POSIX mmap.
+	 */
+	enum class Dispatch { SWITCH, TABLE, THREADED, BLOCK, JIT };
+
+	//Blocks cached per emulator, a power of 2
+	#define BLOCK_SLOTS 256
+
+	/* One call made by a block run whole: op is the first of the ops it runs, and id its
+	 * opcode, or above 0xFF a fusion of it and the op after it (see FUSIONS in Emulator.cpp). */
+	struct BlockStep {
+		uint16_t id;
+		uint8_t op;
+	};
+
+	/* Straight-line run of opcodes from one 4 Kb page, ending after the first opcode that
+	 * can branch, jump or halt. Valid while the page still shows the same storage at the
+	 * same generation (see Mapper::getPageGenerations).
+	 */
+	struct Block {
+		ADDR_16B pc;
+		const BYTE* page;
+		uint32_t gen;
+		int count;
+		//Ticks of all ops, and of all but the last. A budget above lead runs the whole block.
+		int cost;
+		int lead;
+		//Whole runs so far, and the translation made once hot (Dispatch::JIT only)
+		uint16_t hits;
+		NativeBlock native;
+		//Code from an attached RecompiledModule, run in place of native
+		RecompiledFn aot;
+		MicroOp ops[BLOCK_MAX_OPS];
+		//What a run of the whole block does, one handler call per step
+		int stepcount;
+		BlockStep steps[BLOCK_MAX_OPS];
+	};
+
+	class JitX64;
+	class RecompiledModule;
+
+	/* Direct mapped cache of blocks keyed by start address and the storage of its page. */
+	struct BlockCache {
+		BlockCache();
+		~BlockCache();
+		Block& slot(ADDR_16B pc) { return blocks[(pc ^ (pc >> 8)) & (BLOCK_SLOTS - 1)]; }
+		//Drop every native translation; blocks count their runs toward JIT_THRESHOLD afresh
+		void flushNative();
+		//Returns true for opcodes that may leave progcount anywhere but just past their operands
+		static bool endsBlock(OPCODE code);
+		Block blocks[BLOCK_SLOTS];
+		//Created on the first translation
+		std::unique_ptr<JitX64> jit;
+		//Attached by Emulator2A03::attachModule. host is filled in on first use.
+		std::shared_ptr<const RecompiledModule> module;
+		RecompiledHost host;
+	};
+
+	/* Complete machine state saved by Emulator2A03::saveState. Plain data; keep it wherever
+	 * is convenient (stack, arena, memory mapped file). PRG-ROM is referenced, not copied. */
+	struct MachineState {
+		CPU cpu;
+		uint64_t clocks_used;
+		uint32_t pending;
+		ERROR_STATE errstate;
+		ADDR_16B faultaddr;
+		ADDR_16B faultpc;
+		MapperState mapper;
 	};
 
-	void initializeCPU(CPU& cpu);
+	/* CPU interpreter instantiated on a concrete mapper type so that memory access can be
+	 * inlined. Instantiated for Mapper (virtual memory access), DefaultMapper and StrictMapper,
+	 * so a fast instance runs code with no enforcement checks at all. dispatch must be one the
+	 * host has (see Emulator2A03::setDispatch). blocks is only used by BLOCK and JIT. Stops early
+	 * once pending holds an interrupt the CPU would take. Passes of idle loops skipped are added
+	 * to skips.
+	 * @return The number of ticks left. err is set if execution stopped on an error.
+	 */
+	template<class MAPPER>
+	struct Core2A03 {
+		static int run(MAPPER& mapper, CPU& cpu, int ticks, ERROR_STATE& err, uint64_t& skips,
+			const std::atomic<uint32_t>& pending, Dispatch dispatch, BlockCache* blocks);
+	};
+
+	//Most ticks emulate_cpu runs between two looks at its stop and pause requests. A request is
+	//seen within this many ticks plus one opcode.
+	#define RUN_POLL_TICKS 8192
+
+	//Interrupt sources for Emulator2A03::raiseInterrupt, bits of one pending word. INT_NMI is an
+	//edge, taken once per raise. The rest are IRQ lines, held until cleared and taken while the
+	//I flag is clear.
+	#define INT_NMI			0x01
+	#define INT_IRQ_FRAME	0x02
+	#define INT_IRQ_DMC		0x04
+	#define INT_IRQ_MAPPER	0x08
+	#define INT_IRQ_EXTERNAL	0x10
+	#define INT_IRQ_MASK	0x1E
+	//Ticks taken to push PC and P and jump through the vector
+	#define INT_TICKS		7
+
+	/* Pause switch for emulators. Every emulator has its own, and may also follow one shared by a
+	 * pool of them (see Emulator2A03::setRunControl), so that one call pauses them all. Paused
+	 * emulators sleep in emulate_cpu at their next poll. Thread-safe.
+	 */
+	class RunControl {
+	public:
+		RunControl() : epoch(0) {};
+		RunControl(const RunControl&) = delete;
+		RunControl& operator=(const RunControl&) = delete;
+		void pause();
+		void resume();
+		bool isPaused() const { return (epoch.load(std::memory_order_relaxed) & 1) != 0; }
+		/* Sleep until resumed, or until stop is set and wake is called. Returns at once if not paused. */
+		void wait(const std::atomic<bool>* stop = NULL);
+		/* Wake every wait to look at its stop flag again. */
+		void wake();
+	private:
+		//Odd while paused. Bumped on every pause and resume, so a sleeper can tell it changed.
+		std::atomic<uint32_t> epoch;
+		std::mutex m;
+		std::condition_variable cv;
+	};
+
+	struct Machine;
 
 	class Emulator2A03 {
 	public:
 		Emulator2A03(Mapper& mappa, CPU& proc) : 
-			cpu(proc), mapper(mappa), 
-			stopemulation(false),  errstate(ERROR_STATE::NONE)
+			errstate(ERROR_STATE::NONE), faultaddr(0), faultpc(0), idleskips(0), mapper(mappa), cpu(proc),
+			stopemulation(false), running(false), pending(0),
+			group(NULL), core(selectCore(mappa)), dispatch(hostDispatch(DISPATCH_DEFAULT))
 		{};
 		/* Emulate the CPU for a specified number of cycles.
 		 * @exec_ticks A parameter that specifies the number of clock cycles to execute.
@@ -42,23 +188,118 @@ namespace emu {
 		 */
 		int emulate_cpu(int exec_ticks);
 		/* Returns the number of cycles emulated thus far. */
-		int getCycleCount() const { return clocks_used; }
-		/* Stop the CPU and return the remaining ticks. Is thread-safe. */
+		uint64_t getCycleCount() const { return scheduler.now(); }
+		/* Passes of idle loops skipped instead of run since the emulator was created. The ticks
+		 * left and the state are those of running them. */
+		uint64_t getIdleSkips() const { return idleskips; }
+		/* The master clock, see Scheduler. */
+		Scheduler& getScheduler() { return scheduler; }
+		/* Make the emulate_cpu in progress return at its next poll, with the ticks it has left.
+		 * If none is in progress the next one returns without running. Is thread-safe.
+		 * @return 1 if an emulate_cpu was in progress, 0 if the stop is left for the next one.
+		 */
 		int stopEmulation();
+		/* Hold emulate_cpu at its next poll until resumeEmulation. Is thread-safe. */
+		void pauseEmulation() { control.pause(); }
+		void resumeEmulation() { control.resume(); }
+		/* Sleep while paused. Returns true, taking the request, if a stop was requested. emulate_cpu
+		 * polls before every slice; hosts that run the CPU by other means poll as often. */
+		bool pollRequests();
+		/* Also pause whenever shared is paused, NULL for none. Not thread-safe with emulate_cpu. */
+		void setRunControl(RunControl* shared) { group = shared; }
+		/* Assert interrupt sources (INT_ bits). Taken before the next opcode emulate_cpu runs, or
+		 * the next block under BLOCK and JIT, so one raised by a scheduled event is taken at its
+		 * deadline. Is thread-safe. */
+		void raiseInterrupt(uint32_t sources) { pending.fetch_or(sources); }
+		/* Release IRQ lines, as acknowledging their source would. Is thread-safe. */
+		void clearInterrupt(uint32_t sources) { pending.fetch_and(~sources); }
+		uint32_t getPendingInterrupts() const { return pending.load(); }
 		/* Return a copy of the CPU. */
 		CPU getCopyCPU() const { return cpu; }
 		/* Set the CPU parameters. */
 		void setCPU(CPU& proc) { cpu = proc; }
 		/* Return a copy of the last CPU error state. */
 		ERROR_STATE getErrorState() const { return errstate; }
+		/* Address of the access refused when the error state is BAD_READ or BAD_WRITE. The access
+		 * itself is dropped, and the run stops on the opcode making it. */
+		ADDR_16B getFaultAddress() const { return faultaddr; }
+		/* Address of that opcode, where progcount is left. For an access made outside the run,
+		 * by the host or a scheduled event, progcount when it was found. */
+		ADDR_16B getFaultPC() const { return faultpc; }
+		/* Save the CPU, mapper and emulator state into state. Does not allocate. */
+		void saveState(MachineState& state) const;
+		/* Restore a state saved from an emulator running the same ROM. Not thread-safe with emulate_cpu.
+		 * @return false if the state does not fit the mapper, in which case nothing is changed.
+		 */
+		bool restoreState(const MachineState& state);
+		/* Soft reset, as the reset line does: S drops by 3, I is set and the CPU jumps through
+		 * L_PORHNDL. Memory is kept; pending interrupts and the error state are cleared. Not
+		 * thread-safe with emulate_cpu.
+		 */
+		void reset();
+		/* Power the machine off and on: the mapper's power-on image (see Mapper::powerCycle), a
+		 * fresh CPU, the clock back at 0 with no events pending, and a reset. The machine comes
+		 * up resumed and leaves any shared RunControl. Not thread-safe with emulate_cpu.
+		 */
+		void powerCycle();
+		/* Fork the machine. The child shares every memory page of the mapper copy-on-write and starts
+		 * from the same CPU and emulator state. The child and everything it allocates are carved
+		 * from arena if given, which must outlive it. Not thread-safe with emulate_cpu.
+		 */
+		std::unique_ptr<Machine> fork(Arena* arena = NULL);
+		/* Run later emulate_cpu calls on another dispatch. All leave the same ticks and state.
+		 * Not thread-safe with emulate_cpu.
+		 * @return The dispatch used, which differs from the one asked for if the host lacks it.
+		 */
+		Dispatch setDispatch(Dispatch use) { return dispatch = hostDispatch(use); }
+		Dispatch getDispatch() const { return dispatch; }
+		/* Run the blocks of a module recompiled from this emulator's ROM instead of interpreting
+		 * them, wherever the ROM is mapped and unmodified. Switches to Dispatch::BLOCK unless
+		 * the emulator already caches blocks.
+		 * @return false if the module is for another ROM.
+		 */
+		bool attachModule(std::shared_ptr<const RecompiledModule> module);
 	private:
-		long clocks_used;
+		typedef int (*CoreFn)(Mapper& mapper, CPU& cpu, int ticks, ERROR_STATE& err, uint64_t& skips,
+			const std::atomic<uint32_t>& pending, Dispatch dispatch, BlockCache* blocks);
+		/* Picks the Core2A03 instantiation for the mapper. */
+		static CoreFn selectCore(Mapper& mapper);
+		/* The dispatch the host runs in place of use. */
+		static Dispatch hostDispatch(Dispatch use);
+		/* Take the pending NMI, or an IRQ if the I flag allows. Returns false if neither. */
+		bool takeInterrupt();
+		/* Take the mapper's fault into faultaddr and faultpc. Returns BAD_READ or BAD_WRITE. */
+		ERROR_STATE recordFault();
+
+		Scheduler scheduler;
 		ERROR_STATE errstate;
-		int ticks_remaining;
-		std::mutex ticks_remaining_m;
+		ADDR_16B faultaddr;
+		ADDR_16B faultpc;
+		//See getIdleSkips
+		uint64_t idleskips;
 		Mapper& mapper;
 		CPU& cpu;
-		bool stopemulation;
+		std::atomic<bool> stopemulation;
+		//Set while emulate_cpu runs
+		std::atomic<bool> running;
+		//INT_ bits raised and not yet taken or cleared
+		std::atomic<uint32_t> pending;
+		RunControl control;
+		RunControl* group;
+		CoreFn core;
+		Dispatch dispatch;
+		//Allocated on the first run with BLOCK or JIT
+		std::unique_ptr<BlockCache> blocks;
+	};
+
+	/* A mapper, a CPU and the emulator running on them, owned together. */
+	struct Machine : ArenaObject {
+		Machine(Mapper* mappa, const CPU& proc) : mapper(mappa), cpu(proc), emulator(*mappa, cpu) {};
+		Machine(const Machine&) = delete;
+		Machine& operator=(const Machine&) = delete;
+		std::unique_ptr<Mapper> mapper;
+		CPU cpu;
+		Emulator2A03 emulator;
 	};
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,273 @@
+#include "Jit.h"
+
+using namespace emu;
+
+#ifdef JIT_HOST_X64
+#include "Instructions.h"
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <sys/mman.h>
+
+//======================================================
+//Emitter
+//======================================================
+
+//Low 3 bits of the host registers holding guest state. All need a REX prefix.
+//rbx = mapper, rbp = cpu, r12 = A, r13 = X, r14 = Y, r15 = value N/Z are pending from
+#define HOST_A 4
+#define HOST_X 5
+#define HOST_Y 6
+#define HOST_NZ 7
+
+//Offsets into CPU, reached through rbp with an 8 bit displacement
+#define CPU_PC static_cast<BYTE>(offsetof(CPU, progcount))
+#define CPU_A static_cast<BYTE>(offsetof(CPU, accumulator))
+#define CPU_X static_cast<BYTE>(offsetof(CPU, xindex))
+#define CPU_Y static_cast<BYTE>(offsetof(CPU, yindex))
+#define CPU_PS static_cast<BYTE>(offsetof(CPU, procstat))
+#define CPU_N static_cast<BYTE>(offsetof(CPU, nresult))
+#define CPU_Z static_cast<BYTE>(offsetof(CPU, zresult))
+
+//Group 1 /digit of the byte ALU ops, and the matching r/m8, r8 opcodes
+#define ALU_OR 1
+#define ALU_AND 4
+#define ALU_XOR 6
+#define ALURR_MOV 0x88
+#define ALURR_OR 0x08
+#define ALURR_AND 0x20
+#define ALURR_XOR 0x30
+
+struct Emitter {
+	std::vector<BYTE> code;
+
+	void emit(std::initializer_list<BYTE> bytes) { code.insert(code.end(), bytes); }
+	void imm16(uint16_t v) { emit({ BYTE(v), BYTE(v >> 8) }); }
+	void imm32(uint32_t v) { imm16(uint16_t(v)); imm16(uint16_t(v >> 16)); }
+	void imm64(uint64_t v) { imm32(uint32_t(v)); imm32(uint32_t(v >> 32)); }
+
+	//Short forward jump, patched by land()
+	size_t jump(BYTE opcode) { emit({ opcode, 0 }); return code.size(); }
+	void land(size_t from) { code[from - 1] = static_cast<BYTE>(code.size() - from); }
+
+	void prologue() {
+		emit({ 0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57 }); //push rbx, rbp, r12-r15
+		emit({ 0x48, 0x83, 0xEC, 0x08 });                                    //sub rsp, 8
+		emit({ 0x48, 0x89, 0xFB, 0x48, 0x89, 0xF5 });                        //mov rbx, rdi; mov rbp, rsi
+	}
+	void epilogue() {
+		emit({ 0x48, 0x83, 0xC4, 0x08 });                                    //add rsp, 8
+		emit({ 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B }); //pop r15-r12, rbp, rbx
+		emit({ 0xC3 });
+	}
+	//Return (ran << 8), or (ran << 8) | eax when orEax is set
+	void exit(int ran, bool orEax) {
+		emit({ BYTE(orEax ? 0x0D : 0xB8) });                                  //or eax / mov eax, imm32
+		imm32(ran << 8);
+		epilogue();
+	}
+
+	//movzx host, byte [rbp + disp] / mov byte [rbp + disp], host
+	void load(int host, BYTE disp) { emit({ 0x44, 0x0F, 0xB6, BYTE(0x40 | host << 3 | 5), disp }); }
+	void store(int host, BYTE disp) { emit({ 0x44, 0x88, BYTE(0x40 | host << 3 | 5), disp }); }
+	//mov dst, src (both byte registers)
+	void move(int dst, int src) { emit({ 0x45, 0x88, BYTE(0xC0 | src << 3 | dst) }); }
+	//mov dst, imm8
+	void moveImm(int dst, BYTE imm) { emit({ 0x41, BYTE(0xB0 | dst), imm }); }
+	//op dst, imm8 for a group 1 /digit
+	void aluImm(int digit, int dst, BYTE imm) { emit({ 0x41, 0x80, BYTE(0xC0 | digit << 3 | dst), imm }); }
+	//op dst, al
+	void aluAl(BYTE opcode, int dst) { emit({ 0x41, opcode, BYTE(0xC0 | dst) }); }
+	//inc/dec dst
+	void step(int dst, bool up) { emit({ 0x41, 0xFE, BYTE((up ? 0xC0 : 0xC8) | dst) }); }
+	//and/or byte [rbp + disp], imm8
+	void flagsAnd(BYTE disp, BYTE imm) { emit({ 0x80, 0x65, disp, imm }); }
+	void flagsOr(BYTE disp, BYTE imm) { emit({ 0x80, 0x4D, disp, imm }); }
+
+	//movzx eax, byte [readpages[0] + zpage]
+	void loadZeroPage(const BYTE* const* readpages, BYTE zpage) {
+		emit({ 0x48, 0xA1 });                                                //mov rax, [moffs64]
+		imm64(reinterpret_cast<uint64_t>(readpages));
+		emit({ 0x0F, 0xB6, 0x80 });                                          //movzx eax, byte [rax + disp32]
+		imm32(zpage);
+	}
+
+	//Record the pending N/Z value, as LAZY_NZ does
+	void settleFlags() {
+		store(HOST_NZ, CPU_N);
+		store(HOST_NZ, CPU_Z);
+	}
+	void spill(bool pending) {
+		store(HOST_A, CPU_A);
+		store(HOST_X, CPU_X);
+		store(HOST_Y, CPU_Y);
+		if (pending)
+			settleFlags();
+	}
+	void reload() {
+		load(HOST_A, CPU_A);
+		load(HOST_X, CPU_X);
+		load(HOST_Y, CPU_Y);
+	}
+};
+
+/* Emit op inline if it is one of the translated opcodes. operands points at the bytes after
+ * the opcode, or is NULL if they are not on the block's page. Sets pending when N/Z now come
+ * from HOST_NZ. */
+static bool translate(Emitter& e, const MicroOp& op, const BYTE* operands, const Mapper& mapper, bool& pending)
+{
+	int dst;
+	switch (op.code)
+	{
+	case OP_NOP:
+		return true;
+	case OP_CLC:
+		e.flagsAnd(CPU_PS, 0xFE);
+		return true;
+	case OP_SEC:
+		e.flagsOr(CPU_PS, 0x01);
+		return true;
+	case OP_CLV:
+		e.flagsAnd(CPU_PS, 0xBF);
+		return true;
+	case OP_INX: e.step(dst = HOST_X, true); break;
+	case OP_INY: e.step(dst = HOST_Y, true); break;
+	case OP_DEX: e.step(dst = HOST_X, false); break;
+	case OP_DEY: e.step(dst = HOST_Y, false); break;
+	case OP_TAX: e.move(dst = HOST_X, HOST_A); break;
+	case OP_TAY: e.move(dst = HOST_Y, HOST_A); break;
+	case OP_TXA: e.move(dst = HOST_A, HOST_X); break;
+	default:
+		if (operands == NULL)
+			return false;
+		dst = HOST_A;
+		switch (op.code)
+		{
+		case OP_LDA | AMODE_IMMED: e.moveImm(HOST_A, operands[0]); break;
+		case OP_ORA | AMODE_IMMED: e.aluImm(ALU_OR, HOST_A, operands[0]); break;
+		case OP_AND | AMODE_IMMED: e.aluImm(ALU_AND, HOST_A, operands[0]); break;
+		case OP_EOR | AMODE_IMMED: e.aluImm(ALU_XOR, HOST_A, operands[0]); break;
+		case OP_LDA | AMODE_ZPAGE:
+		case OP_ORA | AMODE_ZPAGE:
+		case OP_AND | AMODE_ZPAGE:
+		case OP_EOR | AMODE_ZPAGE:
+			//The zero page is RAM; its page pointer is read at run time since forks move it
+			if (!mapper.isPlainPage(0))
+				return false;
+			e.loadZeroPage(mapper.getReadPages(), operands[0]);
+			e.aluAl(op.code == (OP_LDA | AMODE_ZPAGE) ? ALURR_MOV : op.code == (OP_ORA | AMODE_ZPAGE) ? ALURR_OR :
+				op.code == (OP_AND | AMODE_ZPAGE) ? ALURR_AND : ALURR_XOR, HOST_A);
+			break;
+		default:
+			return false;
+		}
+	}
+	e.move(HOST_NZ, dst);
+	pending = true;
+	return true;
+}
+
+//Bytes an inline translated opcode takes
+static int translatedLength(OPCODE code)
+{
+	return (code & CMODE_01) ? 2 : 1;
+}
+
+//======================================================
+//JitX64
+//======================================================
+
+JitX64::JitX64() : used(0), blockcount(0)
+{
+	void* mem = mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	arena = mem == MAP_FAILED ? NULL : static_cast<BYTE*>(mem);
+}
+
+JitX64::~JitX64()
+{
+	if (arena != NULL)
+		munmap(arena, JIT_ARENA_SIZE);
+}
+
+void JitX64::flush()
+{
+	used = 0;
+	blockcount = 0;
+}
+
+/* Translate a block. The arena is only writable while code is copied into it. */
+NativeBlock JitX64::compile(const Block& block, const void* const* handlers, const Mapper& mapper)
+{
+	if (arena == NULL)
+		return NULL;
+
+	int page = block.pc >> 12;
+	const BYTE* base = mapper.getReadPages()[page];
+	ADDR_16B mask = mapper.getPageMasks()[page];
+	Emitter e;
+	bool pending = false;
+	bool inlined = false;
+
+	e.prologue();
+	e.reload();
+	for (int i = 0; i < block.count; i++) {
+		const MicroOp& op = block.ops[i];
+		const BYTE* operands = ((op.pc + 1) >> 12) == page ? base + ((op.pc + 1) & mask) : NULL;
+		inlined = translate(e, op, operands, mapper, pending);
+		if (inlined)
+			continue;
+
+		//Call the handler with the guest state in memory
+		e.spill(pending);
+		pending = false;
+		e.emit({ 0x66, 0xC7, 0x45, CPU_PC });                                //mov word [rbp + PC], imm16
+		e.imm16(op.pc + 1);
+		e.emit({ 0x48, 0x89, 0xDF, 0x48, 0x89, 0xEE });                      //mov rdi, rbx; mov rsi, rbp
+		e.emit({ 0x48, 0xB8 });                                              //mov rax, imm64
+		e.imm64(reinterpret_cast<uint64_t>(handlers[op.code]));
+		e.emit({ 0xFF, 0xD0 });                                              //call rax
+		e.emit({ 0x85, 0xC0 });                                              //test eax, eax
+		size_t ok = e.jump(0x74);
+		e.exit(i + 1, true);
+		e.land(ok);
+
+		//Leave if the handler wrote over the block's page
+		e.emit({ 0x48, 0xB8 });                                              //mov rax, imm64
+		e.imm64(reinterpret_cast<uint64_t>(&mapper.getPageGenerations()[page]));
+		e.emit({ 0x81, 0x38 });                                              //cmp dword [rax], imm32
+		e.imm32(block.gen);
+		size_t same = e.jump(0x74);
+		e.exit(i + 1, false);
+		e.land(same);
+		e.reload();
+	}
+	if (inlined) {
+		const MicroOp& last = block.ops[block.count - 1];
+		e.spill(pending);
+		e.emit({ 0x66, 0xC7, 0x45, CPU_PC });
+		e.imm16(last.pc + translatedLength(last.code));
+	}
+	e.exit(block.count, false);
+
+	if (used + e.code.size() > JIT_ARENA_SIZE)
+		return NULL;
+	if (mprotect(arena, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE) != 0)
+		return NULL;
+	BYTE* entry = arena + used;
+	memcpy(entry, e.code.data(), e.code.size());
+	used = (used + e.code.size() + 15) & ~size_t(15);
+	if (mprotect(arena, JIT_ARENA_SIZE, PROT_READ | PROT_EXEC) != 0)
+		return NULL;
+
+	++blockcount;
+	return reinterpret_cast<NativeBlock>(entry);
+}
+
+#else
+
+JitX64::JitX64() : arena(NULL), used(0), blockcount(0) {}
+JitX64::~JitX64() {}
+void JitX64::flush() {}
+NativeBlock JitX64::compile(const Block&, const void* const*, const Mapper&) { return NULL; }
+
+#endif
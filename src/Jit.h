@@ -0,0 +1,46 @@
+#pragma once
+
+#ifdef __JIT_H__
+#error __JIT_H__ Already defined!
+#else
+#define __JIT_H__
+#endif
+
+#include "Emulator.h"
+
+//Whole runs of a block before it is translated
+#define JIT_THRESHOLD 16
+//Bytes of native code per emulator
+#define JIT_ARENA_SIZE 0x40000
+
+namespace emu {
+
+	/* Translates blocks recorded by Dispatch::JIT into x86-64 code. A, X and Y live in host
+	 * registers and N/Z are only worked out before a handler call or on exit. Transfers,
+	 * increments, flag ops and LDA/ORA/AND/EOR immediate and zero page are translated
+	 * inline; every other opcode calls its interpreter handler, after which the block exits
+	 * if its page generation moved. Ticks are accounted by the caller from the block, as for
+	 * the interpreted block.
+	 */
+	class JitX64 {
+	public:
+		JitX64();
+		~JitX64();
+		/* Translate block. handlers holds the handler of each opcode for the mapper's core.
+		 * @return NULL if the arena is full (flush and retry) or could not be mapped.
+		 */
+		NativeBlock compile(const Block& block, const void* const* handlers, const Mapper& mapper);
+		/* Free the whole arena. Every NativeBlock handed out becomes invalid. */
+		void flush();
+		/* Number of blocks translated since the last flush. */
+		int getBlockCount() const { return blockcount; }
+	private:
+		JitX64(const JitX64&) = delete;
+		JitX64& operator=(const JitX64&) = delete;
+
+		BYTE* arena;
+		size_t used;
+		int blockcount;
+	};
+
+}
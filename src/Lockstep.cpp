@@ -0,0 +1,415 @@
+#include "Lockstep.h"
+#include "Instructions.h"
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace emu;
+
+//======================================================
+//Lane Vectors
+//======================================================
+
+/* LOCKSTEP_WIDTH lanes of 8 bit registers. SSE2 where available, otherwise plain loops
+ * the compiler is free to vectorize. Comparisons return 0xFF for true and 0x00 for false. */
+namespace simd {
+#ifdef __SSE2__
+	typedef __m128i vec;
+	inline vec load(const uint8_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+	inline void store(uint8_t* p, vec v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+	inline vec splat(uint8_t b) { return _mm_set1_epi8(static_cast<char>(b)); }
+	inline vec vadd(vec a, vec b) { return _mm_add_epi8(a, b); }
+	inline vec vsub(vec a, vec b) { return _mm_sub_epi8(a, b); }
+	inline vec vand(vec a, vec b) { return _mm_and_si128(a, b); }
+	inline vec vor(vec a, vec b) { return _mm_or_si128(a, b); }
+	inline vec vxor(vec a, vec b) { return _mm_xor_si128(a, b); }
+	inline vec veq(vec a, vec b) { return _mm_cmpeq_epi8(a, b); }
+	//Signed greater than
+	inline vec vgt(vec a, vec b) { return _mm_cmpgt_epi8(a, b); }
+	//a where m is set, b elsewhere
+	inline vec vsel(vec m, vec a, vec b) { return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b)); }
+#else
+	struct vec { uint8_t b[LOCKSTEP_WIDTH]; };
+#define LANEWISE(EXPR) vec r; for (int i = 0; i < LOCKSTEP_WIDTH; i++) r.b[i] = static_cast<uint8_t>(EXPR); return r;
+	inline vec load(const uint8_t* p) { vec r; memcpy(r.b, p, LOCKSTEP_WIDTH); return r; }
+	inline void store(uint8_t* p, vec v) { memcpy(p, v.b, LOCKSTEP_WIDTH); }
+	inline vec splat(uint8_t b) { LANEWISE(b) }
+	inline vec vadd(vec a, vec b) { LANEWISE(a.b[i] + b.b[i]) }
+	inline vec vsub(vec a, vec b) { LANEWISE(a.b[i] - b.b[i]) }
+	inline vec vand(vec a, vec b) { LANEWISE(a.b[i] & b.b[i]) }
+	inline vec vor(vec a, vec b) { LANEWISE(a.b[i] | b.b[i]) }
+	inline vec vxor(vec a, vec b) { LANEWISE(a.b[i] ^ b.b[i]) }
+	inline vec veq(vec a, vec b) { LANEWISE(a.b[i] == b.b[i] ? 0xFF : 0x00) }
+	inline vec vgt(vec a, vec b) { LANEWISE(static_cast<int8_t>(a.b[i]) > static_cast<int8_t>(b.b[i]) ? 0xFF : 0x00) }
+	inline vec vsel(vec m, vec a, vec b) { LANEWISE((m.b[i] & a.b[i]) | (~m.b[i] & b.b[i])) }
+#undef LANEWISE
+#endif
+
+	/* Negative and Zero flags of a result, as procstat bits. */
+	inline vec flags_nz(vec r) { return vor(vand(r, splat(0x80)), vand(veq(r, splat(0)), splat(0x02))); }
+	/* Replace the Negative and Zero flags of procstat with those of a result. */
+	inline vec set_nz(vec p, vec r) { return vor(vand(p, splat(0x7D)), flags_nz(r)); }
+}
+
+//======================================================
+//Opcode Kernels
+//======================================================
+
+namespace {
+	/* Work done for a group of lanes. K_PEEL opcodes are run on the scalar core. */
+	enum Kernel {
+		K_PEEL, K_NOP, K_BRANCH, K_JMP,
+		K_ORA, K_AND, K_EOR, K_ADC, K_SBC, K_LDA, K_CMP,
+		K_INX, K_INY, K_DEX, K_DEY, K_TAX, K_TXA, K_TAY, K_TYA, K_TSX, K_TXS,
+		K_SETP, K_CLRP
+	};
+
+	/* Operand fetched per lane, mirroring the GET_* helpers of Emulator.cpp. */
+	enum Fetch { F_NONE, F_SKIP, F_IMMED, F_ZPAGE, F_ZPAGEX, F_ABS, F_ABSX, F_ABSY };
+
+	struct OpKernel {
+		Kernel kernel;
+		Fetch fetch;
+		BYTE bits;	//Flag bits for K_SETP, K_CLRP and K_BRANCH
+		bool taken;	//K_BRANCH is taken when the bits are set (true) or clear (false)
+	};
+
+	OpKernel classify(OPCODE code) {
+		OpKernel k = { K_PEEL, F_NONE, 0, false };
+		switch (code)
+		{
+		case OP_NOP: case OP_NOP0: case OP_NOP1: case OP_NOP2: case OP_NOP3: case OP_NOP4: case OP_NOP5:
+			k.kernel = K_NOP; return k;
+		case OP_DNOP0: case OP_DNOP1: case OP_DNOP2: case OP_DNOP3: case OP_DNOP4: case OP_DNOP5: case OP_DNOP6:
+		case OP_DNOP7: case OP_DNOP8: case OP_DNOP9: case OP_DNOPA: case OP_DNOPB: case OP_DNOPC: case OP_DNOPD:
+			k.kernel = K_NOP; k.fetch = F_SKIP; return k;
+		case OP_INX: k.kernel = K_INX; return k;
+		case OP_INY: k.kernel = K_INY; return k;
+		case OP_DEX: k.kernel = K_DEX; return k;
+		case OP_DEY: k.kernel = K_DEY; return k;
+		case OP_TAX: k.kernel = K_TAX; return k;
+		case OP_TXA: k.kernel = K_TXA; return k;
+		case OP_TAY: k.kernel = K_TAY; return k;
+		case OP_TYA: k.kernel = K_TYA; return k;
+		case OP_TSX: k.kernel = K_TSX; return k;
+		case OP_TXS: k.kernel = K_TXS; return k;
+		case OP_SEC: k.kernel = K_SETP; k.bits = 0x01; return k;
+		case OP_SEI: k.kernel = K_SETP; k.bits = 0x04; return k;
+		case OP_SED: k.kernel = K_SETP; k.bits = 0x08; return k;
+		case OP_CLC: k.kernel = K_CLRP; k.bits = 0x01; return k;
+		case OP_CLI: k.kernel = K_CLRP; k.bits = 0x04; return k;
+		case OP_CLD: k.kernel = K_CLRP; k.bits = 0x08; return k;
+		case OP_CLV: k.kernel = K_CLRP; k.bits = 0x40; return k;
+		case OP_BPL: k.kernel = K_BRANCH; k.bits = 0x80; k.taken = false; return k;
+		case OP_BMI: k.kernel = K_BRANCH; k.bits = 0x80; k.taken = true; return k;
+		case OP_BVC: k.kernel = K_BRANCH; k.bits = 0x40; k.taken = false; return k;
+		case OP_BVS: k.kernel = K_BRANCH; k.bits = 0x40; k.taken = true; return k;
+		case OP_BCC: k.kernel = K_BRANCH; k.bits = 0x01; k.taken = false; return k;
+		case OP_BCS: k.kernel = K_BRANCH; k.bits = 0x01; k.taken = true; return k;
+		case OP_BNE: k.kernel = K_BRANCH; k.bits = 0x02; k.taken = false; return k;
+		case OP_BEQ: k.kernel = K_BRANCH; k.bits = 0x02; k.taken = true; return k;
+		case OP_JMPABS: k.kernel = K_JMP; return k;
+		}
+
+		if ((code & 0x03) != CMODE_01)
+			return k;
+		switch (code & MASK_BBB)
+		{
+		case AMODE_IMMED: k.fetch = F_IMMED; break;
+		case AMODE_ZPAGE: k.fetch = F_ZPAGE; break;
+		case AMODE_ZPAGEX: k.fetch = F_ZPAGEX; break;
+		case AMODE_ABS: k.fetch = F_ABS; break;
+		case AMODE_ABSX: k.fetch = F_ABSX; break;
+		case AMODE_ABSY: k.fetch = F_ABSY; break;
+		default: return k; //Indirect modes are peeled
+		}
+		switch (code & MASK_AAACC)
+		{
+		case OP_ORA: k.kernel = K_ORA; break;
+		case OP_AND: k.kernel = K_AND; break;
+		case OP_EOR: k.kernel = K_EOR; break;
+		case OP_ADC: k.kernel = K_ADC; break;
+		case OP_SBC: k.kernel = K_SBC; break;
+		case OP_LDA: k.kernel = K_LDA; break;
+		case OP_CMP: k.kernel = K_CMP; break;
+		default: k.fetch = F_NONE; break; //STA is peeled
+		}
+		return k;
+	}
+
+	struct KernelTable {
+		OpKernel op[256];
+		KernelTable() {
+			for (int code = 0; code < 256; code++)
+				op[code] = classify(static_cast<OPCODE>(code));
+		}
+	};
+	const KernelTable kernels;
+
+	/* Read a byte the same way read_byte in Emulator.cpp does. */
+	inline BYTE lane_read(Mapper& mapper, ADDR_16B addr) {
+		const BYTE* page = mapper.getReadPages()[addr >> 12];
+		if (page != NULL)
+			return page[addr & mapper.getPageMasks()[addr >> 12]];
+		return mapper.readMemory(addr);
+	}
+
+	inline ADDR_16B lane_word(Mapper& mapper, ADDR_16B addr) {
+		return lane_read(mapper, addr) | (lane_read(mapper, addr + 1) << 8);
+	}
+
+	/* Returns true if the lane's emulator would take an interrupt before its next opcode, the
+	 * same test as interrupt_due in Emulator.cpp. */
+	inline bool lane_interrupt_due(const Emulator2A03& emulator, BYTE procstat) {
+		uint32_t lines = emulator.getPendingInterrupts();
+		return lines != 0 && ((lines & INT_NMI) || ((lines & INT_IRQ_MASK) && !F_INTDIS(procstat)));
+	}
+}
+
+//======================================================
+//LockstepGroup
+//======================================================
+
+int LockstepGroup::addLane(Mapper* mapper, const CPU& cpu) {
+	int lane = (int)lanes.size();
+	lanes.emplace_back(new Machine(mapper, cpu));
+
+	size_t padded = (lanes.size() + LOCKSTEP_WIDTH - 1) / LOCKSTEP_WIDTH * LOCKSTEP_WIDTH;
+	accumulator.resize(padded);
+	xindex.resize(padded);
+	yindex.resize(padded);
+	stackp.resize(padded);
+	procstat.resize(padded);
+	progcount.resize(padded);
+	group.resize(padded);
+	operand.resize(padded);
+	ticks.resize(lanes.size());
+	halted.resize(lanes.size());
+	mayfault.push_back(mapper->getEnforcement() != Enforcement::FAST);
+	setCPU(lane, cpu);
+	return lane;
+}
+
+CPU LockstepGroup::getCopyCPU(int lane) const {
+	CPU cpu = lanes[lane]->cpu;
+	cpu.accumulator.unsigned8 = accumulator[lane];
+	cpu.xindex.unsigned8 = xindex[lane];
+	cpu.yindex.unsigned8 = yindex[lane];
+	cpu.stackp.unsigned8 = stackp[lane];
+	cpu.procstat = procstat[lane];
+	cpu.progcount = progcount[lane];
+	return cpu;
+}
+
+void LockstepGroup::setCPU(int lane, const CPU& cpu) {
+	lanes[lane]->cpu = cpu;
+	accumulator[lane] = cpu.accumulator.unsigned8;
+	xindex[lane] = cpu.xindex.unsigned8;
+	yindex[lane] = cpu.yindex.unsigned8;
+	stackp[lane] = cpu.stackp.unsigned8;
+	procstat[lane] = cpu.procstat;
+	progcount[lane] = cpu.progcount;
+}
+
+void LockstepGroup::run(int exec_ticks) {
+	const int count = (int)lanes.size();
+	for (int lane = 0; lane < count; lane++) {
+		ticks[lane] = exec_ticks;
+		halted[lane] = lanes[lane]->emulator.getErrorState() != ERROR_STATE::NONE;
+		//Events scheduled in the past since the last run
+		if (!halted[lane])
+			lanes[lane]->emulator.getScheduler().advance(0);
+	}
+
+	//Ticks run by any lane since the last poll, starting with one before the first step
+	int sincepoll = RUN_POLL_TICKS;
+	for (;;) {
+		if (sincepoll >= RUN_POLL_TICKS) {
+			pollLanes();
+			sincepoll = 0;
+		}
+
+		//Lead with the lane furthest behind so that lanes on the same path stay together
+		int lead = -1;
+		int most = 0;
+		for (int lane = 0; lane < count; lane++) {
+			if (!halted[lane] && ticks[lane] > most) {
+				most = ticks[lane];
+				lead = lane;
+			}
+		}
+		if (lead < 0)
+			break;
+
+		const ADDR_16B pc = progcount[lead];
+		const OPCODE code = lane_read(*lanes[lead]->mapper, pc);
+		//The scalar core takes interrupts
+		if (kernels.op[code].kernel == K_PEEL || mayfault[lead] || lane_interrupt_due(lanes[lead]->emulator, procstat[lead])) {
+			sincepoll += stepScalar(lead);
+			continue;
+		}
+
+		int members = 0;
+		for (int lane = 0; lane < count; lane++) {
+			bool member = !halted[lane] && !mayfault[lane] && ticks[lane] > 0 && progcount[lane] == pc &&
+				(lane == lead || (lane_read(*lanes[lane]->mapper, pc) == code &&
+				!lane_interrupt_due(lanes[lane]->emulator, procstat[lane])));
+			group[lane] = member ? 0xFF : 0x00;
+			members += member;
+		}
+		if (members == 1) {
+			sincepoll += stepScalar(lead);
+		}
+		else {
+			stepVector(code, members);
+			//Each lane's clock, and the events it reached, as emulate_cpu runs them after a slice
+			for (int lane = 0; lane < count; lane++) {
+				if (group[lane])
+					lanes[lane]->emulator.getScheduler().advance(OPTICK[code]);
+			}
+			sincepoll += OPTICK[code];
+		}
+	}
+}
+
+int LockstepGroup::stepScalar(int lane) {
+	Machine& l = *lanes[lane];
+	l.cpu = getCopyCPU(lane);
+	int used = 1 - l.emulator.emulate_cpu(1);
+	ticks[lane] -= used;
+	setCPU(lane, l.cpu);
+	//Nothing run and no error means emulate_cpu took a stop request
+	if (l.emulator.getErrorState() != ERROR_STATE::NONE || used == 0)
+		halted[lane] = 1;
+	++counters.scalarsteps;
+	return used;
+}
+
+void LockstepGroup::pollLanes() {
+	for (size_t lane = 0; lane < lanes.size(); lane++) {
+		if (!halted[lane] && ticks[lane] > 0 && lanes[lane]->emulator.pollRequests())
+			halted[lane] = 1;
+	}
+}
+
+void LockstepGroup::stepVector(OPCODE code, int members) {
+	using namespace simd;
+	const OpKernel& k = kernels.op[code];
+	const int count = (int)lanes.size();
+
+	//Fetch operands and move each lane's PC
+	for (int lane = 0; lane < count; lane++) {
+		if (!group[lane])
+			continue;
+		Mapper& mapper = *lanes[lane]->mapper;
+		ADDR_16B pc = progcount[lane] + 1;
+		ADDR_16B addr;
+		ticks[lane] -= OPTICK[code];
+
+		switch (k.fetch)
+		{
+		case F_NONE:
+			break;
+		case F_SKIP:
+			++pc;
+			break;
+		case F_IMMED:
+			operand[lane] = lane_read(mapper, pc);
+			++pc;
+			break;
+		case F_ZPAGE:
+			operand[lane] = lane_read(mapper, lane_read(mapper, pc));
+			++pc;
+			break;
+		case F_ZPAGEX:
+			operand[lane] = lane_read(mapper, static_cast<BYTE>(lane_read(mapper, pc) + xindex[lane]));
+			++pc;
+			break;
+		case F_ABS:
+		case F_ABSX:
+		case F_ABSY:
+			addr = lane_word(mapper, pc);
+			if (k.fetch == F_ABSX)
+				addr += xindex[lane];
+			else if (k.fetch == F_ABSY)
+				addr += yindex[lane];
+			operand[lane] = lane_read(mapper, addr);
+			pc += 2;
+			break;
+		}
+
+		if (k.kernel == K_BRANCH) {
+			if (((procstat[lane] & k.bits) != 0) == k.taken)
+				pc += static_cast<int>(lane_read(mapper, pc)) + 1;
+			else
+				++pc;
+		}
+		else if (k.kernel == K_JMP)
+			pc = lane_word(mapper, pc);
+		progcount[lane] = pc;
+	}
+
+	++counters.vectorsteps;
+	counters.vectorlanes += members;
+	if (k.kernel == K_NOP || k.kernel == K_BRANCH || k.kernel == K_JMP)
+		return;
+
+	//Register and flag work, LOCKSTEP_WIDTH lanes at a time
+	const vec zero = splat(0);
+	for (size_t c = 0; c < group.size(); c += LOCKSTEP_WIDTH) {
+		vec m = load(&group[c]);
+		vec a = load(&accumulator[c]), x = load(&xindex[c]), y = load(&yindex[c]);
+		vec s = load(&stackp[c]), p = load(&procstat[c]), rv = load(&operand[c]);
+		vec na = a, nx = x, ny = y, ns = s, np = p;
+
+		switch (k.kernel)
+		{
+		case K_ORA: na = vor(a, rv); np = set_nz(p, na); break;
+		case K_AND: na = vand(a, rv); np = set_nz(p, na); break;
+		case K_EOR: na = vxor(a, rv); np = set_nz(p, na); break;
+		case K_LDA: na = rv; np = set_nz(p, na); break;
+		case K_ADC:
+		case K_SBC: {
+			//Same as operations::add_carry. SBC adds the two's complement of the operand and carry.
+			vec carry = vand(p, splat(0x01));
+			if (k.kernel == K_SBC) {
+				rv = vsub(zero, rv);
+				carry = vsub(zero, carry);
+			}
+			na = vadd(vadd(a, rv), carry);
+			vec ovrflow = vgt(zero, vand(vxor(a, na), vxor(rv, na)));
+			vec bias = splat(0x80);
+			vec wrap = vgt(vxor(a, bias), vxor(vadd(a, rv), bias));
+			np = vor(vor(vand(p, splat(0x3C)), flags_nz(na)),
+				vor(vand(ovrflow, splat(0x40)), vand(wrap, splat(0x01))));
+			break;
+		}
+		case K_CMP: {
+			//Signed compare, same as operations::Cmp
+			vec ge = vxor(vgt(rv, a), splat(0xFF));
+			np = vor(vor(vand(p, splat(0x7C)), flags_nz(vsub(a, rv))), vand(ge, splat(0x01)));
+			break;
+		}
+		case K_INX: nx = vadd(x, splat(0x01)); np = set_nz(p, nx); break;
+		case K_INY: ny = vadd(y, splat(0x01)); np = set_nz(p, ny); break;
+		case K_DEX: nx = vsub(x, splat(0x01)); np = set_nz(p, nx); break;
+		case K_DEY: ny = vsub(y, splat(0x01)); np = set_nz(p, ny); break;
+		case K_TAX: nx = a; np = set_nz(p, nx); break;
+		case K_TXA: na = x; np = set_nz(p, na); break;
+		case K_TAY: ny = a; np = set_nz(p, ny); break;
+		case K_TYA: na = y; np = set_nz(p, na); break;
+		case K_TSX: nx = s; np = set_nz(p, nx); break;
+		case K_TXS: ns = x; np = set_nz(p, ns); break;
+		case K_SETP: np = vor(p, splat(k.bits)); break;
+		case K_CLRP: np = vand(p, splat(static_cast<uint8_t>(~k.bits))); break;
+		default: break;
+		}
+
+		store(&accumulator[c], vsel(m, na, a));
+		store(&xindex[c], vsel(m, nx, x));
+		store(&yindex[c], vsel(m, ny, y));
+		store(&stackp[c], vsel(m, ns, s));
+		store(&procstat[c], vsel(m, np, p));
+	}
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#ifdef __LOCKSTEP_H__
+#error __LOCKSTEP_H__ Already defined!
+#else
+#define __LOCKSTEP_H__
+#endif
+
+#include "NTDef.h"
+#include "Mapper.h"
+#include "Emulator.h"
+#include <memory>
+#include <vector>
+
+//Lanes processed per vector operation
+#define LOCKSTEP_WIDTH 16
+
+namespace emu {
+
+	/* Counts of instructions executed by a LockstepGroup. */
+	struct LockstepCounters {
+		unsigned long long vectorsteps;	//Instructions executed for a group of lanes at once
+		unsigned long long vectorlanes;	//Lane instructions executed by vectorsteps
+		unsigned long long scalarsteps;	//Lane instructions peeled off to the scalar core
+	};
+
+	/* Runs many instances of the same ROM in lockstep. The registers of every lane are kept as
+	 * a struct of arrays; lanes at the same PC execute the same instruction together, with the
+	 * register and flag work of CC01 reads, register transfers, increments and flag set/clear done
+	 * LOCKSTEP_WIDTH lanes at a time (SSE2, or a portable fallback). Branches and JMP are resolved
+	 * per lane. Every other instruction, any lane without company, any lane with an interrupt
+	 * to take and every lane whose mapper may refuse an access (see MemoryFault) are stepped on
+	 * the lane's own Emulator2A03.
+	 */
+	class LockstepGroup {
+	public:
+		LockstepGroup() {};
+		LockstepGroup(const LockstepGroup&) = delete;
+		LockstepGroup& operator=(const LockstepGroup&) = delete;
+
+		/* Add a lane. Takes ownership of mapper. Lanes should be created from the same ROM.
+		 * @return The lane index.
+		 */
+		int addLane(Mapper* mapper, const CPU& cpu);
+		int getLaneCount() const { return (int)lanes.size(); }
+
+		/* Emulate every lane for a number of ticks. Lanes that hit an error stop and keep their error
+		 * state. Every lane's run requests are polled at least every RUN_POLL_TICKS of progress: a lane
+		 * asked to stop sits out the rest of the run with the ticks it has left, and a paused lane
+		 * holds the whole group.
+		 */
+		void run(int exec_ticks);
+
+		/* Return a copy of the CPU of a lane. */
+		CPU getCopyCPU(int lane) const;
+		/* Set the CPU of a lane. */
+		void setCPU(int lane, const CPU& cpu);
+		Mapper& getMapper(int lane) { return *lanes[lane]->mapper; }
+		/* The emulator of a lane, for its run requests. Its CPU is only current between runs through getCopyCPU. */
+		Emulator2A03& getEmulator(int lane) { return lanes[lane]->emulator; }
+		/* Ticks left over by the last run, as returned by Emulator2A03::emulate_cpu. */
+		int getTicksRemaining(int lane) const { return ticks[lane]; }
+		ERROR_STATE getErrorState(int lane) const { return lanes[lane]->emulator.getErrorState(); }
+		LockstepCounters getCounters() const { return counters; }
+	private:
+		//Run one instruction of a lane on its scalar core. Returns the ticks it took.
+		int stepScalar(int lane);
+		//Run code for every lane set in group. members is the number of lanes set.
+		void stepVector(OPCODE code, int members);
+		//Poll the run requests of every lane still running, halting those asked to stop
+		void pollLanes();
+
+		std::vector<std::unique_ptr<Machine>> lanes;
+		//Struct of arrays, padded to a multiple of LOCKSTEP_WIDTH
+		std::vector<uint8_t> accumulator;
+		std::vector<uint8_t> xindex;
+		std::vector<uint8_t> yindex;
+		std::vector<uint8_t> stackp;
+		std::vector<uint8_t> procstat;
+		std::vector<uint16_t> progcount;
+		std::vector<int> ticks;
+		//Lanes that hit an error or were stopped, and are not run
+		std::vector<uint8_t> halted;
+		//Lanes whose mapper may refuse an access, only run on the scalar core so that a fault is
+		//recorded against the opcode making it
+		std::vector<uint8_t> mayfault;
+		//Per step scratch. group is 0xFF for lanes taking part, operand holds their fetched operand.
+		std::vector<uint8_t> group;
+		std::vector<uint8_t> operand;
+		LockstepCounters counters = { 0, 0, 0 };
+	};
+
+}
@@ -0,0 +1,36 @@
+#include "MachinePool.h"
+
+using namespace emu;
+
+//======================================================
+//MachinePool
+//======================================================
+
+MachinePool::MachinePool(Mapper* mapper) {
+	CPU cpu;
+	initializeCPU(cpu);
+	prototype.reset(new Machine(mapper, cpu));
+	prototype->emulator.powerCycle();
+}
+
+std::unique_ptr<Machine> MachinePool::acquire() {
+	std::lock_guard<std::mutex> lock(m);
+	if (!idle.empty()) {
+		std::unique_ptr<Machine> recycled = std::move(idle.back());
+		idle.pop_back();
+		return recycled;
+	}
+	//The prototype never runs, so its forks start at power-on
+	return prototype->emulator.fork(&arena);
+}
+
+void MachinePool::release(std::unique_ptr<Machine> machine) {
+	machine->emulator.powerCycle();
+	std::lock_guard<std::mutex> lock(m);
+	idle.push_back(std::move(machine));
+}
+
+size_t MachinePool::getIdleCount() {
+	std::lock_guard<std::mutex> lock(m);
+	return idle.size();
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#ifdef __MACHINEPOOL_H__
+#error __MACHINEPOOL_H__ Already defined!
+#else
+#define __MACHINEPOOL_H__
+#endif
+
+#include "NTDef.h"
+#include "Arena.h"
+#include "Mapper.h"
+#include "Emulator.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace emu {
+
+	/* Hands out powered-on machines running one ROM and takes them back for reuse, for workloads
+	 * made of many short episodes. New machines are forks of a powered-on prototype carved from
+	 * the pool's arena, and released ones are power cycled, so neither parses the ROM nor copies
+	 * PRG-ROM. Machines must be released or destroyed before the pool. Thread-safe.
+	 */
+	class MachinePool {
+	public:
+		/* Takes ownership of mapper, fresh from Mapper::createMapper. */
+		explicit MachinePool(Mapper* mapper);
+		MachinePool(const MachinePool&) = delete;
+		MachinePool& operator=(const MachinePool&) = delete;
+
+		/* A machine at power-on, recycled if one has been released. */
+		std::unique_ptr<Machine> acquire();
+		/* Give back a machine acquired from this pool. It is power cycled on the calling thread. */
+		void release(std::unique_ptr<Machine> machine);
+		/* Number of released machines waiting to be acquired again. */
+		size_t getIdleCount();
+	private:
+		//Outlives every machine carved from it
+		Arena arena;
+		std::unique_ptr<Machine> prototype;
+		std::mutex m;
+		std::vector<std::unique_ptr<Machine>> idle;
+	};
+
+}
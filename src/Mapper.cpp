@@ -1,5 +1,18 @@
 #include "Mapper.h"
 #include "Debug.h"
+#include "RomCache.h"
+#include <cassert>
+#include <cstddef>
+#if defined _WIN32 || defined _WIN64
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace emu;
 
@@ -26,6 +39,8 @@ const char* BadRomException::what() const {
 		return "This NES ROM lists 0 PRG-ROM banks.";
 	case UNSUPPORTEDMAPPER:
 		return "This NES ROM uses an unsupported mapper.";
+	case BADFILE:
+		return "The ROM file could not be opened or mapped.";
 	default:
 		return "An unsupported error occured :(.";
 	}
@@ -35,54 +50,49 @@ const char* BadRomException::what() const {
 //Mapper
 //======================================================
 
-/* MEMMAP -> N** map (4k pages) to set
- * PAGEMAP -> N** page map (16k pages) to configure map for
- * PAGE -> PAGE number in PAGEMAP
+/* MAPPER -> Mapper whose map (4k pages) to set from its rompages (16k pages)
+ * PAGE -> PAGE number in rompages
  * HILOW -> Put page at HI=1 (0xC000) or LOW=0 (0x8000) 
  */
 #define HI_PAGE 1
 #define LOW_PAGE 0
-#define SWAP_PAGE(MEMMAP, PAGEMAP, PAGE, HILOW) \
-	MEMMAP[8 + 4*HILOW] = PAGEMAP[PAGE]; \
-	MEMMAP[9 + 4*HILOW] = PAGEMAP[PAGE] + 0x1000; \
-	MEMMAP[10 + 4*HILOW] = PAGEMAP[PAGE] + 0x2000; \
-	MEMMAP[11 + 4*HILOW] = PAGEMAP[PAGE] + 0x3000;
+#define SWAP_PAGE(MAPPER, PAGE, HILOW) \
+	for (int i = 0; i < 4; i++) { \
+		MAPPER->map[8 + 4*(HILOW) + i] = MAPPER->rompages[PAGE] + i * 0x1000; \
+		MAPPER->pageref[8 + 4*(HILOW) + i] = -1 - ((PAGE) * SZ_PRGROM_BLOCK + i * 0x1000); \
+	}
 
 //Minimum sensible ROM size.
-const long MINROMSIZE = sizeof(INES_Header)+(unsigned)SZ_PRGROM_BLOCK + (unsigned)SZ_CHRROM_BLOCK;
+const long MINROMSIZE = INES_HEADER_SIZE + (unsigned)SZ_PRGROM_BLOCK + (unsigned)SZ_CHRROM_BLOCK;
 
-/* Creates a mapper from an INES ROM stream. */
-void Mapper::createMapper(std::istream& iNesRom, Mapper*& mapper)
-{
-	INES_Header nesh;
+#define HAS_BATTERY BIT1(nesh.rom_cr1)
+#define HAS_TRAINER BIT2(nesh.rom_cr1)
+#define HAS_VSUNI BIT0(nesh.rom_cr2)
+#define HAS_PLAYCHOICE BIT1(nesh.rom_cr2)
+#define HAS_NES2 BIT2(nesh.rom_cr2)
 
-	//Get ROM size
-	iNesRom.seekg(0, iNesRom.end);
-	std::streampos romsize = iNesRom.tellg();
-	romsize += 1;
-	iNesRom.seekg(0, iNesRom.beg);
-	
+/* Validates the 16 byte iNES header in raw, with the load-time checks of enforce, and fills
+ * nesh. Returns the mapper number. */
+static int parseHeader(const BYTE* raw, long romsize, INES_Header& nesh, Enforcement enforce)
+{
 	//Make sure rom is at least 16 bytes + 1 PRG BLOCK + 1 CHR BLOCK
 	if (romsize < MINROMSIZE)
 		throw BadRomException(BadRomException::BADSIZE);
-	
-	iNesRom.read(nesh.NES, 4);
+
+	memcpy(nesh.NES, raw, 4);
 	nesh.NES[4] = '\0';
 
-	
 	//Validate that the NES\x1A tag is present.
 	if (strcmp(nesh.NES, "NES\x1A") != 0)
 		throw BadRomException(BadRomException::BADTAG);
 
-
-	//Read iNES header
-	iNesRom.read(reinterpret_cast<char*>(&nesh.cnt_prgblocks), 1);
-	iNesRom.read(reinterpret_cast<char*>(&nesh.cnt_chrblocks), 1);
-	iNesRom.read(reinterpret_cast<char*>(&nesh.rom_cr1), 1);
-	iNesRom.read(reinterpret_cast<char*>(&nesh.rom_cr2), 1);
-	iNesRom.read(reinterpret_cast<char*>(&nesh.cnt_rambanks), 1);
-	iNesRom.read(reinterpret_cast<char*>(&nesh.vstndrd), 1);
-	iNesRom.read(reinterpret_cast<char*>(&nesh.fill), 6);
+	nesh.cnt_prgblocks = raw[4];
+	nesh.cnt_chrblocks = raw[5];
+	nesh.rom_cr1 = raw[6];
+	nesh.rom_cr2 = raw[7];
+	nesh.cnt_rambanks = raw[8];
+	nesh.vstndrd = raw[9];
+	memcpy(nesh.fill, raw + 10, 6);
 
 	//Make sure reserved bits are zero'd
 	if ((nesh.rom_cr2 & 0x0E) != 0)
@@ -91,17 +101,10 @@ void Mapper::createMapper(std::istream& iNesRom, Mapper*& mapper)
 	if (nesh.cnt_rambanks == 0)
 		nesh.cnt_rambanks = 1;
 
-#define HAS_BATTERY BIT1(nesh.rom_cr1)
-#define HAS_TRAINER BIT2(nesh.rom_cr1)
-#define HAS_VSUNI BIT0(nesh.rom_cr2)
-#define HAS_PLAYCHOICE BIT1(nesh.rom_cr2)
-#define HAS_NES2 BIT2(nesh.rom_cr2)
-
-#ifdef ENFORCE_NOTRAINER
 	//Make sure a trainer is not included $STUB$ SUPPORT TRAINERS
-	if (HAS_TRAINER)
+	bool notrainer = enforce == Enforcement::STRICT ? StrictPolicy::notrainer : FastPolicy::notrainer;
+	if (notrainer && HAS_TRAINER)
 		throw BadRomException(BadRomException::TRAINERUSED);
-#endif
 	//Check if SRAM is battery backed
 	//if (HAS_BATTERY);
 	//$STUB$
@@ -125,143 +128,436 @@ void Mapper::createMapper(std::istream& iNesRom, Mapper*& mapper)
 	}
 
 	//Get mapper number from flags
-	int mappernumber = (nesh.rom_cr1 >> 4) & (nesh.rom_cr2 & 0xF0);
+	return (nesh.rom_cr1 >> 4) & (nesh.rom_cr2 & 0xF0);
+}
+
+/* Creates a mapper from an INES ROM stream. */
+void Mapper::createMapper(std::istream& iNesRom, Mapper*& mapper, Enforcement enforce)
+{
+	INES_Header nesh;
+	BYTE raw[INES_HEADER_SIZE];
+
+	//Get ROM size
+	iNesRom.seekg(0, iNesRom.end);
+	std::streampos romsize = iNesRom.tellg();
+	iNesRom.seekg(0, iNesRom.beg);
+
+	//Read and validate the iNES header
+	iNesRom.read(reinterpret_cast<char*>(raw), INES_HEADER_SIZE);
+	int mappernumber = parseHeader(raw, (long)romsize, nesh, enforce);
 	
 	//Create Mapper
+	mapper = construct(mappernumber, enforce);
+	
+	//Initialize Mapper (duh)
+	mapper->initialize();
+	mapper->mapper_num = mappernumber;
+	
+	//Initialize Mapper PRG-ROM from the image shared by every mapper of this ROM
+	std::vector<BYTE> prg((size_t)SZ_PRGROM_BLOCK * nesh.cnt_prgblocks);
+	iNesRom.read(reinterpret_cast<char*>(prg.data()), prg.size());
+	PageBlock block = { RomCache::instance().intern(prg.data(), prg.size()), (unsigned)prg.size() };
+	mapper->mapSharedRom(block, block.data.get(), nesh.cnt_prgblocks);
+	mapper->capturePowerOn();
+
+	//Initialize SRAM
+	//$STUB$ Has 8k (0x2000) bank size L_SRAM SZ_PRGRAM_BLOCK
+
+	//Initialize Mapper CHR-ROM
+	//$STUB$ Has 8K (0x2000) bank size
+}
+
+/* Memory map a file read-only. The mapping is released with the last share of the returned
+ * pointer. Returns NULL if the file cannot be mapped. */
+static std::shared_ptr<BYTE> mapFile(const char* path, size_t& size)
+{
+#if defined _WIN32 || defined _WIN64
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+	LARGE_INTEGER filesize;
+	HANDLE mapping = NULL;
+	if (GetFileSizeEx(file, &filesize) && filesize.QuadPart > 0)
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (mapping == NULL)
+		return NULL;
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (view == NULL)
+		return NULL;
+	size = (size_t)filesize.QuadPart;
+	return std::shared_ptr<BYTE>(static_cast<BYTE*>(view), [](BYTE* view) { UnmapViewOfFile(view); });
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct stat st;
+	void* view = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+		view = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (view == MAP_FAILED)
+		return NULL;
+	size = (size_t)st.st_size;
+	size_t length = size;
+	return std::shared_ptr<BYTE>(static_cast<BYTE*>(view), [length](BYTE* view) { munmap(view, length); });
+#endif
+}
+
+/* Creates a mapper from an INES ROM file. The file is memory mapped read-only and PRG-ROM is
+ * used in place, so loading takes the same time for any ROM size and the pages are shared
+ * through the page cache with every process mapping the file. */
+void Mapper::createMapper(const char* path, Mapper*& mapper, Enforcement enforce)
+{
+	size_t romsize = 0;
+	std::shared_ptr<BYTE> rom = mapFile(path, romsize);
+	if (!rom)
+		throw BadRomException(BadRomException::BADFILE);
+
+	INES_Header nesh;
+	int mappernumber = parseHeader(rom.get(), (long)romsize, nesh, enforce);
+	size_t prgstart = INES_HEADER_SIZE + (HAS_TRAINER ? 512 : 0);
+	if (prgstart + nesh.cnt_prgblocks * (size_t)SZ_PRGROM_BLOCK > romsize)
+		throw BadRomException(BadRomException::BADSIZE);
+
+	Mapper* created = construct(mappernumber, enforce);
+	created->initialize();
+	created->mapper_num = mappernumber;
+	PageBlock block = { rom, (unsigned)romsize };
+	created->mapSharedRom(block, rom.get() + prgstart, nesh.cnt_prgblocks);
+	created->capturePowerOn();
+	mapper = created;
+}
+
+/* Point the PRG-ROM banks into read-only storage shared with other mappers. Banks past the
+ * first two are reached by bank switching. */
+void Mapper::mapSharedRom(const PageBlock& block, BYTE* prg, int banks) {
+	pushStorage(block);
+	romtable.reset(new BYTE*[banks], std::default_delete<BYTE*[]>());
+	rompages = romtable.get();
+	rp_count = banks;
+	for (int i = 0; i < banks; i++)
+		rompages[i] = prg + i * SZ_PRGROM_BLOCK;
+
+	//One bank is mirrored into both halves
+	SWAP_PAGE(this, 0, LOW_PAGE);
+	SWAP_PAGE(this, (banks > 1 ? 1 : 0), HI_PAGE);
+	romshared = true;
+	cowpages |= 0xFF00;
+	remapReadPages();
+}
+
+/* Create an uninitialized mapper for an iNES mapper number. */
+Mapper* Mapper::construct(int mappernumber, Enforcement enforce, Arena* arena) {
+	Mapper* created;
 	switch (mappernumber)
 	{
 	case 0:
-		mapper = new DefaultMapper();
+		if (enforce == Enforcement::STRICT)
+			created = new (arena) StrictMapper();
+		else
+			created = new (arena) DefaultMapper();
 		break;
 	default:
 		throw BadRomException(BadRomException::UNSUPPORTEDMAPPER);
 	}
-	
-	//Initialize Mapper (duh)
-	mapper->initialize();
-	
-	//Initialize Mapper PRG-ROM
-	if (nesh.cnt_prgblocks > 2) //Bank Switching
-	{
-		mapper->rompages = new BYTE*[nesh.cnt_prgblocks];
-		mapper->rp_count = nesh.cnt_prgblocks;
+	created->enforcement = enforce;
+	created->arena = arena;
+	created->storagecount = 0;
+	created->rompages = NULL;
+	created->rp_count = 0;
+	created->fault.kind = MemoryFault::NOFAULT;
+	created->fault.addr = 0;
+	return created;
+}
 
-		//Load ROM Pages
-		for (int i = 0; i < nesh.cnt_prgblocks; i++) {
-			mapper->rompages[i] = new BYTE[(unsigned)SZ_PRGROM_BLOCK];
-			iNesRom.read(reinterpret_cast<char*>(mapper->rompages[i]), (unsigned)SZ_PRGROM_BLOCK);
-		}
-		
-		SWAP_PAGE(mapper->map, mapper->rompages, 0, LOW_PAGE);
-		SWAP_PAGE(mapper->map, mapper->rompages, 1, HI_PAGE);
-	}
-	else                        //Direct Mapping
-	{
-		//Map blocks to memory
-		mapper->rompages = NULL;
-		mapper->rp_count = 0;
-		BYTE* taddr = mapper->memory + (unsigned)L_PRGROM;
-		iNesRom.read(reinterpret_cast<char*>(taddr) , (unsigned)SZ_PRGROM_BLOCK * nesh.cnt_prgblocks);
-
-		//Mirror if one block
-		if (nesh.cnt_prgblocks == 1)
-			memcpy(taddr + (unsigned)SZ_PRGROM_BLOCK, taddr, (unsigned)SZ_PRGROM_BLOCK);
+/* Keep the first refused access until it is taken. */
+BYTE Mapper::refuseAccess(MemoryFault::Kind kind, ADDR_16B addr) {
+	if (fault.kind == MemoryFault::NOFAULT) {
+		fault.kind = kind;
+		fault.addr = addr;
 	}
+	return 0;
+}
 
-	//Initialize SRAM
-	//$STUB$ Has 8k (0x2000) bank size L_SRAM SZ_PRGRAM_BLOCK
+MemoryFault Mapper::takeFault() {
+	MemoryFault taken = fault;
+	fault.kind = MemoryFault::NOFAULT;
+	return taken;
+}
 
-	//Initialize Mapper CHR-ROM
-	//$STUB$ Has 8K (0x2000) bank size
+/* A zeroed MapperMemory block, carved from arena if given. */
+static std::shared_ptr<BYTE> newMapperMemory(Arena* arena) {
+	if (arena != NULL) {
+		std::shared_ptr<BYTE> carved = Arena::allocateShared(arena, sizeof(MapperMemory));
+		memset(carved.get(), 0, sizeof(MapperMemory));
+		return carved;
+	}
+	return std::shared_ptr<BYTE>(reinterpret_cast<BYTE*>(new MapperMemory()),
+		[](BYTE* data) { delete reinterpret_cast<MapperMemory*>(data); });
 }
 
 /* Initialize mapper arrays and set some default values. */
 void Mapper::initialize() {
-	//16 * 4Kb = 64Kb
-	memory = new BYTE[0x10000];
-	map = new BYTE*[16];
-	map[0] = memory;
-	for (int i = 1; i < 16; i++)
-		map[i] = map[i - 1] + 0x1000;
-
-	//Zero out the i/o registers
-	memset(memory + L_IOREGBLOCK1, 0, SZ_IOREGBLOCK1);
-	memset(memory + L_IOREGBLOCK2, 0, SZ_IOREGBLOCK2);
+	//Zeroed, so a new machine starts the same every time
+	PageBlock block = { newMapperMemory(arena), sizeof(MapperMemory) };
+	pushStorage(block);
+	memory = block.data.get();
+	cowpages = 0;
+	codepages = 0;
+	memset(pagegen, 0, sizeof(pagegen));
+	forked = false;
+	romshared = false;
+
+	//2 Kb of internal RAM mirrored up to $1FFF
+	mapHome(0, offsetof(MapperMemory, ram), SZ_RAM - 1);
+	mapHome(1, offsetof(MapperMemory, ram), SZ_RAM - 1);
+	//8 PPU registers mirrored up to $3FFF
+	mapHome(2, offsetof(MapperMemory, ppuregs), SZ_PPUREGS - 1);
+	mapHome(3, offsetof(MapperMemory, ppuregs), SZ_PPUREGS - 1);
+	//APU and i/o registers. The expansion area up to $5FFF that NROM leaves empty is mapped
+	//onto them too, but readMemory and writeMemory never reach them from there.
+	mapHome(4, offsetof(MapperMemory, ioregs), SZ_IOREGBLOCK2 - 1);
+	mapHome(5, offsetof(MapperMemory, ioregs), SZ_IOREGBLOCK2 - 1);
+	//8 Kb of SRAM, which PRG-ROM pages also show until mapSharedRom
+	for (int i = 6; i < 16; i++)
+		mapHome(i, offsetof(MapperMemory, sram) + (i & 1) * 0x1000, 0x0FFF);
+
+	MapperMemory* home = reinterpret_cast<MapperMemory*>(memory);
 	//Set joysticks to defaults
-	memory[L_JOYSTICK1] = 0x80;
-	memory[L_JOYSTICK2] = 0x80;
+	home->ioregs[L_JOYSTICK1 - L_IOREGBLOCK2] = 0x80;
+	home->ioregs[L_JOYSTICK2 - L_IOREGBLOCK2] = 0x80;
 	//Turn on sound channels
-	memory[L_ENBLSND] = 0x1F;
+	home->ioregs[L_ENBLSND - L_IOREGBLOCK2] = 0x1F;
+
+	//Everything but the register pages ($2000 - $5FFF) is plain memory
+	plainpages = 0xFFFF;
+	for (int addr = L_IOREGBLOCK1; addr < L_SRAM; addr += 0x1000)
+		plainpages &= ~(1 << (addr >> 12));
+	remapReadPages();
 }
 
-Mapper::~Mapper() {
-	delete[] map;
-	delete[] rompages;
-	delete memory;
+void Mapper::mapHome(int page, size_t offset, ADDR_16B mask) {
+	map[page] = memory + offset;
+	pageref[page] = (int32_t)offset;
+	pagemask[page] = mask;
 }
 
-//======================================================
-//Default Mapper
-//======================================================
+/* Point readpages at the mapped pages that can be read directly. Code cached from the old map is stale. */
+void Mapper::remapReadPages() {
+	for (int i = 0; i < 16; i++) {
+		readpages[i] = BIT(plainpages, i) ? map[i] : NULL;
+		++pagegen[i];
+	}
+	codepages = 0;
+}
 
-/* Read a BYTE from mapper memory. */
-BYTE DefaultMapper::readMemory(ADDR_16B addr) {
-#ifdef ENFORCE_WRITEONLY_MINIMUM
-	//$STUB$ More selectively include cases
-	switch (addr)
-	{
-	case 0x2000:
-	case 0x2001:
-	case 0x2003:
-	case 0x2005:
-	case 0x2006:
-	case 0x4000:
-	case 0x4001:
-	case 0x4002:
-	case 0x4003:
-	case 0x4004:
-	case 0x4005:
-	case 0x4006:
-	case 0x4007:
-	case 0x4008:
-	case 0x4009:
-	case 0x400A:
-	case 0x400B:
-	case 0x400C:
-	case 0x400D:
-	case 0x400E:
-	case 0x400F:
-	case 0x4010:
-	case 0x4011:
-	case 0x4012:
-	case 0x4013:
-	case 0x4014:
-		throw BadReadException(addr);
+/* Set the code bit of page and of every page showing the same storage. */
+void Mapper::markCodePage(int page) {
+	for (int i = 0; i < 16; i++) {
+		if (map[i] == map[page])
+			codepages |= 1 << i;
 	}
-#endif
-	return map[addr >> 12][addr & 0x0FFF];
 }
 
-/* Write a BYTE to mapper memory. */
-void DefaultMapper::writeMemory(ADDR_16B addr, BYTE data) {
-#ifdef ENFORCE_READONLY_STRICT
-	if(addr == 0x2002)
-		throw BadWriteException(addr);
-#endif
-#ifdef ENFORCE_READONLY_MINIMUM
-	//Make sure we do not write to PRG-ROM or Expansion ROM
-	if (addr >> 15 || addr >= 0x4020 && addr <= 0x5FFF)
-		throw BadWriteException(addr);
-#endif
-#ifdef ENFORCE_STACK_MIRROR
-	//Stack
-	if(addr < 0x2000)
-	{
-		map[addr >> 12][addr & 0x07FF] = data;
-		map[addr >> 12][(addr & 0x07FF) + 0x800] = data;
-		map[addr >> 12][(addr & 0x07FF) + 0x1000] = data;
-		map[addr >> 12][(addr & 0x07FF) + 0x1800] = data;
+/* Decode pageref for addr. Pages showing PRG-ROM still point into rompages until written to. */
+int32_t Mapper::getPrgOffset(ADDR_16B addr) const {
+	int page = addr >> 12;
+	if (!romshared || pageref[page] >= 0)
+		return -1;
+	int32_t offset = -1 - pageref[page];
+	int bank = offset / SZ_PRGROM_BLOCK;
+	if (bank >= rp_count || map[page] != rompages[bank] + offset % SZ_PRGROM_BLOCK)
+		return -1;
+	return offset + (addr & pagemask[page]);
+}
+
+/* Copy a shared page before writing to it, and retire code cached from a page about to change. */
+void Mapper::trapWrite(int page) {
+	if (BIT(cowpages, page))
+		copyPage(page);
+	if (BIT(codepages, page)) {
+		for (int i = 0; i < 16; i++) {
+			if (map[i] == map[page]) {
+				++pagegen[i];
+				codepages &= ~(1 << i);
+			}
+		}
 	}
-#endif
-	map[addr >> 12][addr & 0x0FFF] = data;
+}
+
+/* Create a mapper sharing every page of this one. Both mappers copy a page on their first write to it. */
+Mapper* Mapper::fork(Arena* arena) {
+	Mapper* child = construct(mapper_num, enforcement, arena);
+	child->mapper_num = mapper_num;
+	child->memory = memory;
+	for (int i = 0; i < 16; i++) {
+		child->map[i] = map[i];
+		child->pageref[i] = pageref[i];
+		child->pagemask[i] = pagemask[i];
+	}
+	child->plainpages = plainpages;
+	child->romshared = romshared;
+	child->rp_count = rp_count;
+	child->romtable = romtable;
+	child->rompages = rompages;
+	child->poweron = poweron;
+	for (int b = 0; b < storagecount; b++)
+		child->storage[b] = storage[b];
+	child->storagecount = storagecount;
+	child->releaseStorage();
+
+	child->codepages = 0;
+	memset(child->pagegen, 0, sizeof(child->pagegen));
+	cowpages = child->cowpages = 0xFFFF;
+	forked = child->forked = true;
+	child->remapReadPages();
+	return child;
+}
+
+/* Give map entry page a private copy of the bytes it shows, along with every mirror of it. A
+ * page only reaches as far as its mask, so a copy of RAM or a register file is that size. */
+void Mapper::copyPage(int page) {
+	BYTE* shared = map[page];
+	unsigned size = 0;
+	for (int i = 0; i < 16; i++) {
+		if (map[i] == shared && pagemask[i] + 1u > size)
+			size = pagemask[i] + 1u;
+	}
+	PageBlock block = { Arena::allocateShared(arena, size), size };
+	memcpy(block.data.get(), shared, size);
+	for (int i = 0; i < 16; i++) {
+		if (map[i] == shared) {
+			map[i] = block.data.get();
+			cowpages &= ~(1 << i);
+		}
+	}
+	pushStorage(block);
+	releaseStorage();
+	remapReadPages();
+}
+
+/* Drop shares of storage no longer referenced by map or rompages. The block holding memory is always kept. */
+void Mapper::releaseStorage() {
+	int kept = 0;
+	for (int b = 0; b < storagecount; b++) {
+		const BYTE* data = storage[b].data.get();
+		bool used = data == memory;
+		for (int i = 0; i < 16 && !used; i++)
+			used = map[i] >= data && map[i] < data + storage[b].size;
+		for (int i = 0; i < rp_count && !used; i++)
+			used = rompages[i] >= data && rompages[i] < data + storage[b].size;
+		if (used)
+			storage[kept++] = storage[b];
+	}
+	for (int b = kept; b < storagecount; b++)
+		storage[b].data.reset();
+	storagecount = kept;
+}
+
+/* Add block to storage. Running out means a new kind of block was added without growing MAPPER_STORAGE. */
+void Mapper::pushStorage(const PageBlock& block) {
+	assert(storagecount < MAPPER_STORAGE);
+	storage[storagecount++] = block;
+}
+
+/* Save the bank selection and the writable memory pages. PRG-ROM pages are referenced. */
+void Mapper::saveState(MapperState& state) const {
+	state.mapper_num = mapper_num;
+	state.rp_count = rp_count;
+	state.plainpages = plainpages;
+	state.savedpages = 0;
+
+	for (int i = 0; i < 16; i++) {
+		state.pageref[i] = pageref[i];
+		state.pagemask[i] = pagemask[i];
+		if (pageref[i] < 0)
+			continue;
+		bool mirror = false;
+		for (int j = 0; j < i && !mirror; j++)
+			mirror = pageref[j] == pageref[i];
+		if (!mirror) {
+			state.savedpages |= 1 << i;
+			memcpy(state.ram + pageref[i], map[i], pagemask[i] + 1);
+		}
+	}
+}
+
+/* Restore the bank selection and writable memory pages saved by saveState. */
+bool Mapper::restoreState(const MapperState& state) {
+	if (state.mapper_num != mapper_num || state.rp_count != rp_count)
+		return false;
+	for (int i = 0; i < 16; i++) {
+		if (state.pageref[i] >= 0 && state.pageref[i] + state.pagemask[i] + 1 > (int32_t)sizeof(MapperMemory))
+			return false;
+		if (state.pageref[i] < -rp_count * SZ_PRGROM_BLOCK)
+			return false;
+	}
+
+	for (int i = 0; i < 16; i++) {
+		int32_t ref = state.pageref[i];
+		pagemask[i] = state.pagemask[i];
+		if (ref == pageref[i])
+			continue; //Keep the current, possibly private, storage of the page
+		if (ref >= 0)
+			map[i] = memory + ref;
+		else
+			map[i] = rompages[(-1 - ref) / SZ_PRGROM_BLOCK] + (-1 - ref) % SZ_PRGROM_BLOCK;
+		pageref[i] = ref;
+		//The home block and ROM banks of a forked mapper may be shared
+		if (forked || (ref < 0 && romshared))
+			cowpages |= 1 << i;
+	}
+	plainpages = state.plainpages;
+	releaseStorage();
+
+	for (int i = 0; i < 16; i++) {
+		if (pageref[i] < 0 || !BIT(state.savedpages, i))
+			continue;
+		if (BIT(cowpages, i))
+			copyPage(i);
+		memcpy(map[i], state.ram + pageref[i], pagemask[i] + 1);
+	}
+	remapReadPages();
+	return true;
+}
+
+void Mapper::capturePowerOn() {
+	std::shared_ptr<MapperState> image(new MapperState());
+	saveState(*image);
+	poweron = image;
+}
+
+/* Rebuild the power-on map over the home block and PRG-ROM, then copy the image into the
+ * home block. Private page copies and copies of PRG-ROM are dropped. */
+void Mapper::powerCycle() {
+	const MapperState& image = *poweron;
+	if (forked) {
+		PageBlock block = { newMapperMemory(arena), sizeof(MapperMemory) };
+		pushStorage(block);
+		memory = block.data.get();
+		forked = false;
+	}
+	memcpy(memory, image.ram, sizeof(MapperMemory));
+
+	cowpages = 0;
+	for (int i = 0; i < 16; i++) {
+		int32_t ref = image.pageref[i];
+		if (ref >= 0)
+			map[i] = memory + ref;
+		else
+			map[i] = rompages[(-1 - ref) / SZ_PRGROM_BLOCK] + (-1 - ref) % SZ_PRGROM_BLOCK;
+		pageref[i] = ref;
+		pagemask[i] = image.pagemask[i];
+		if (ref < 0 && romshared)
+			cowpages |= 1 << i;
+	}
+	plainpages = image.plainpages;
+	fault.kind = MemoryFault::NOFAULT;
+	releaseStorage();
+	remapReadPages();
+}
+
+Mapper::~Mapper() {
 }
\ No newline at end of file
@@ -7,10 +7,14 @@
 #endif
 
 #include "NTDef.h"
+#include "Debug.h"
+#include "Arena.h"
 #include <exception>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <vector>
 
 namespace emu {
 
@@ -18,7 +22,8 @@ namespace emu {
 	public:
 		enum ErrorType {
 			BADSIZE, BADRBITS, BADVSTD, BADFILL,
-			BADTAG, NOPRG, TRAINERUSED, UNSUPPORTEDMAPPER
+			BADTAG, NOPRG, TRAINERUSED, UNSUPPORTEDMAPPER,
+			BADFILE
 		};
 		BadRomException(ErrorType err) : error(err) {};
 		const char* what() const;
@@ -26,40 +31,90 @@ namespace emu {
 		ErrorType error;
 	};
 
+	/* Mappers no longer throw these; the emulator reports refused accesses through its
+	 * ERROR_STATE (see MemoryFault). Kept for callers that rethrow a fault. */
 	class EmulationException : public std::exception {
 	public:
-		EmulationException(int loc) : memloc(loc) {};
-		virtual void initMessage() = 0;
+		EmulationException(int loc, const char* what) : memloc(loc) {
+			std::stringstream text;
+			text << what << std::hex << loc;
+			msg = text.str();
+		};
 		const char* what() const {
-			return msg.str().c_str();
+			return msg.c_str();
 		}
+		int getLocation() const { return memloc; }
 	protected:
 		int memloc;
-		std::stringstream msg;
+		std::string msg;
 	};
 
 	class BadWriteException : public EmulationException {
 	public:
-		virtual void initMessage() {
-			msg << "Bad write from memory location " << std::hex << memloc;
-		}
+		BadWriteException(int loc) : EmulationException(loc, "Bad write from memory location ") {};
 	};
 
 	class BadReadException : public EmulationException {
 	public:
-		virtual void initMessage() {
-			msg << "Bad read from memory location " << std::hex << memloc;
-		}
+		BadReadException(int loc) : EmulationException(loc, "Bad read from memory location ") {};
+	};
+
+	/* An access refused by a mapper's enforcement policy (see Debug.h). */
+	struct MemoryFault {
+		enum Kind { NOFAULT, BADREAD, BADWRITE };
+		Kind kind;
+		ADDR_16B addr;
+	};
+
+	/* Writable memory of one mapper, in a single cache line aligned block of about 10 KB. Only
+	 * what the machine has is stored: mirrors, the expansion area and PRG-ROM are mapped onto
+	 * it or referenced (see Mapper::initialize). Each register file is padded to a cache line.
+	 */
+	struct alignas(64) MapperMemory {
+		//$0000, mirrored up to $1FFF
+		BYTE ram[SZ_RAM];
+		//$2000, SZ_PPUREGS registers mirrored up to $3FFF
+		BYTE ppuregs[64];
+		//$4000, SZ_IOREGBLOCK2 registers. The expansion area after them has no storage.
+		BYTE ioregs[64];
+		//$6000
+		BYTE sram[SZ_PRGRAM_BLOCK];
+	};
+
+	/* Writable state of a Mapper. Plain data with no pointers, so it can live in any caller
+	 * provided storage and be restored into any mapper created from the same ROM. PRG-ROM is
+	 * treated as immutable and referenced by page rather than copied.
+	 */
+	struct MapperState {
+		int mapper_num;
+		int rp_count;
+		//Pages of plain memory (see Mapper::plainpages)
+		uint16_t plainpages;
+		//Bit n is set if the bytes map page n shows are held in ram. Mirrors are held once.
+		uint16_t savedpages;
+		//Per 4 Kb page: offset into MapperMemory, or -1 - (rompage * SZ_PRGROM_BLOCK + offset) for a PRG-ROM bank
+		int32_t pageref[16];
+		ADDR_16B pagemask[16];
+		//MapperMemory as the map shows it, at the offsets in pageref
+		BYTE ram[sizeof(MapperMemory)];
 	};
 
-	class Mapper {
+	//Most blocks of storage a mapper can hold: its memory, the ROM image, a private copy of each
+	//page, and one more while a page is being copied
+	#define MAPPER_STORAGE 19
+
+	class Mapper : public ArenaObject {
 	public:
 		virtual ~Mapper();
-		static void createMapper(std::istream& iNesRom, Mapper*& mapper);
+		//Create a mapper from an iNES stream, checking what enforce asks for (see Debug.h).
+		static void createMapper(std::istream& iNesRom, Mapper*& mapper, Enforcement enforce = Enforcement::FAST);
+		//Create a mapper from an iNES file, memory mapping PRG-ROM read-only. Writes to PRG-ROM are copy-on-write.
+		static void createMapper(const char* path, Mapper*& mapper, Enforcement enforce = Enforcement::FAST);
 		virtual BYTE readMemory(ADDR_16B addr) = 0;
 		virtual void writeMemory(ADDR_16B addr, BYTE data) = 0;
 
-		//Get a pointer to mapper memory (const)
+		//Get a pointer to the mapper's MapperMemory (const). RAM is at its start, so getMemory()[addr] is RAM for addr < SZ_RAM.
+		//Pages a forked mapper has written to live elsewhere, read those through readMemory.
 		const BYTE* getMemory() const {
 			return memory;
 		}
@@ -73,24 +128,218 @@ namespace emu {
 			return rp_count;
 		}
 
+		//Get the iNES mapper number
+		int getMapperNumber() const {
+			return mapper_num;
+		}
+
+		//Get the enforcement policy the mapper was created with. Forks keep it.
+		Enforcement getEnforcement() const {
+			return enforcement;
+		}
+
+		//Returns true if the policy refused an access since the last takeFault.
+		bool hasFault() const {
+			return fault.kind != MemoryFault::NOFAULT;
+		}
+
+		//Get the first access refused since the last takeFault, leaving it to be taken.
+		MemoryFault getFault() const {
+			return fault;
+		}
+
+		//Get and clear the first access refused since the last call. kind is NOFAULT if none was.
+		MemoryFault takeFault();
+
+		//Get the direct read page table. Entries are NULL for pages that must be read through readMemory.
+		const BYTE * const * getReadPages() const {
+			return readpages;
+		}
+
+		//Get the offset mask of each page. A byte is at map[addr >> 12][addr & mask[addr >> 12]].
+		const ADDR_16B* getPageMasks() const {
+			return pagemask;
+		}
+
+		//Returns true if reads from the 4 Kb page holding addr may bypass readMemory.
+		bool isPlainPage(ADDR_16B addr) const {
+			return BIT(plainpages, (addr >> 12));
+		}
+
+		//Get the generation of each page. A page's generation changes whenever code cached from it may be stale.
+		const uint32_t* getPageGenerations() const {
+			return pagegen;
+		}
+
+		//Watch the page (and every page mirroring it) for writes, which advance its generation.
+		void markCodePage(int page);
+
+		//Get the offset into PRG-ROM shown at addr, or -1 if its page does not show shared, unmodified PRG-ROM.
+		int32_t getPrgOffset(ADDR_16B addr) const;
+
+		//Create a mapper sharing every page of this one copy-on-write. Costs a few hundred bytes; either mapper copies a page on its first write to it.
+		//The child, its page copies and its own forks are carved from arena if given.
+		Mapper* fork(Arena* arena = NULL);
+
+		//Save the memory map and every writable page into state. Does not allocate.
+		virtual void saveState(MapperState& state) const;
+		//Restore a state saved from a mapper of the same ROM. Returns false if the state does not fit this mapper.
+		//Allocates only for pages a forked mapper shares.
+		virtual bool restoreState(const MapperState& state);
+		//Put the map and memory back as createMapper left them, from an image taken then and shared with forks. Memory is restored
+		//with one copy; a mapper sharing its memory with forks takes a fresh block for it and leaves the forks theirs.
+		void powerCycle();
+
 	protected:
+		//Storage this mapper holds a share of, with its size in bytes
+		struct PageBlock {
+			std::shared_ptr<BYTE> data;
+			unsigned size;
+		};
+
 		int mapper_num;
-		//Initialize the memory map into sixteen 4 Kb pages.
+		Enforcement enforcement;
+		//First access refused since the last takeFault
+		MemoryFault fault;
+		//Record an access the policy refused, which is then dropped. Refused reads return 0. Out of
+		//line so that the checks add no more than a compare to the inline accessors.
+		BYTE refuseAccess(MemoryFault::Kind kind, ADDR_16B addr);
+		//Create an uninitialized mapper for an iNES mapper number, instantiated on the policy for enforce.
+		static Mapper* construct(int mappernumber, Enforcement enforce, Arena* arena = NULL);
+		//Allocate the MapperMemory block and map the sixteen 4 Kb pages below PRG-ROM onto it.
 		void initialize();
+		//Point map entry page at offset into memory, showing the bytes mask covers.
+		void mapHome(int page, size_t offset, ADDR_16B mask);
+		//Slow path of writeMemory for pages in cowpages or codepages.
+		void trapWrite(int page);
+		//Give map entry page its own copy of its storage.
+		void copyPage(int page);
+		//Drop shares of storage map no longer points into.
+		void releaseStorage();
+		//Hold block in storage, which MAPPER_STORAGE sizes for every block map can point into.
+		void pushStorage(const PageBlock& block);
+		//Use banks PRG-ROM banks starting at prg, inside read-only storage shared with other mappers.
+		void mapSharedRom(const PageBlock& block, BYTE* prg, int banks);
+		//Take the image powerCycle restores. Call once the mapper is fully created.
+		void capturePowerOn();
+		//Rebuild readpages from map and plainpages and advance every page generation. Call whenever either changes.
+		void remapReadPages();
+		//Pages (bit n = page n) holding only RAM or ROM. Pages with I/O or mapper registers are cleared.
+		uint16_t plainpages;
+		//Direct read pointers into map for plain pages, NULL otherwise
+		const BYTE* readpages[16];
 		//4 kb page map of address space
-		BYTE** map;
-		//64 KB address space
+		BYTE* map[16];
+		//Offset mask for each page in map. Mirrored regions use a mask smaller than the page.
+		ADDR_16B pagemask[16];
+		//What each page in map shows, encoded as in MapperState::pageref
+		int32_t pageref[16];
+		//Pages (bit n = page n) in map shared with a fork, copied before the first write
+		uint16_t cowpages;
+		//Pages (bit n = page n) holding cached code, see markCodePage
+		uint16_t codepages;
+		//Generation of each page in map
+		uint32_t pagegen[16];
+		//Set once the mapper has been forked or forked from
+		bool forked;
+		//Set if rompages point into read-only shared storage. Pages showing them are always copy-on-write.
+		bool romshared;
+		//Every block of storage map points into, memory included
+		PageBlock storage[MAPPER_STORAGE];
+		int storagecount;
+		//Where page copies and forks are carved from, NULL for the heap
+		Arena* arena;
+		//The MapperMemory block, owned through storage
 		BYTE* memory;
-		//Switchable PRG-ROM pages in 16 KB size - used by map to switch
+		//Switchable PRG-ROM pages in 16 KB size - used by map to switch. Owned through romtable,
+		//which forks share.
 		BYTE** rompages;
+		std::shared_ptr<BYTE*> romtable;
+		//State right after createMapper, shared with forks
+		std::shared_ptr<const MapperState> poweron;
 		//Get number of PRG-ROM pages
 		int rp_count;
 	};
 
-	class DefaultMapper : public Mapper {
+	/* NROM. Final and defined inline so that Core2A03<DefaultMapper> can inline memory access.
+	 * POLICY (see Debug.h) decides which accesses are checked; the checks of a policy without
+	 * them compile away. */
+	template<class POLICY>
+	class BasicDefaultMapper final : public Mapper {
 	public:
+		typedef POLICY Policy;
 		virtual BYTE readMemory(ADDR_16B addr);
 		virtual void writeMemory(ADDR_16B addr, BYTE data);
 	};
 
+	typedef BasicDefaultMapper<FastPolicy> DefaultMapper;
+	typedef BasicDefaultMapper<StrictPolicy> StrictMapper;
+
+	//======================================================
+	//Default Mapper
+	//======================================================
+
+	/* Read a BYTE from mapper memory. */
+	template<class POLICY>
+	inline BYTE BasicDefaultMapper<POLICY>::readMemory(ADDR_16B addr) {
+		//$STUB$ More selectively include cases
+		if (POLICY::writeonly_minimum) switch (addr < L_IOREGBLOCK2 ? addr & 0xE007 : addr) //Fold PPU register mirrors
+		{
+		case 0x2000:
+		case 0x2001:
+		case 0x2003:
+		case 0x2005:
+		case 0x2006:
+		case 0x4000:
+		case 0x4001:
+		case 0x4002:
+		case 0x4003:
+		case 0x4004:
+		case 0x4005:
+		case 0x4006:
+		case 0x4007:
+		case 0x4008:
+		case 0x4009:
+		case 0x400A:
+		case 0x400B:
+		case 0x400C:
+		case 0x400D:
+		case 0x400E:
+		case 0x400F:
+		case 0x4010:
+		case 0x4011:
+		case 0x4012:
+		case 0x4013:
+		case 0x4014:
+			return refuseAccess(MemoryFault::BADREAD, addr);
+		}
+		//Expansion ROM, which NROM leaves empty, reads as an open bus
+		if ((ADDR_16B)(addr - L_EXPROM) < SZ_EXPROM)
+			return 0;
+		return map[addr >> 12][addr & pagemask[addr >> 12]];
+	}
+
+	/* Write a BYTE to mapper memory. */
+	template<class POLICY>
+	inline void BasicDefaultMapper<POLICY>::writeMemory(ADDR_16B addr, BYTE data) {
+		if (POLICY::readonly_strict && (addr & 0xE007) == 0x2002) { //Includes PPU register mirrors
+			refuseAccess(MemoryFault::BADWRITE, addr);
+			return;
+		}
+		//Make sure we do not write to Expansion ROM, where writes are dropped either way
+		if ((ADDR_16B)(addr - L_EXPROM) < SZ_EXPROM) {
+			if (POLICY::readonly_minimum)
+				refuseAccess(MemoryFault::BADWRITE, addr);
+			return;
+		}
+		//or to PRG-ROM
+		if (POLICY::readonly_minimum && addr >> 15) {
+			refuseAccess(MemoryFault::BADWRITE, addr);
+			return;
+		}
+		if (BIT((cowpages | codepages), (addr >> 12)))
+			trapWrite(addr >> 12);
+		map[addr >> 12][addr & pagemask[addr >> 12]] = data;
+	}
+
 }
\ No newline at end of file
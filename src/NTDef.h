@@ -82,6 +82,9 @@ typedef BYTE OPCODE;
 #define F_RCBRES(x)		(x & 0x0F)
 #define F_HIBMAPN(x)	(x & 0xF0)
 
+//Size of the INES header in a ROM file
+#define INES_HEADER_SIZE 16
+
 //INES header for NES ROMs
 struct INES_Header {
 	char NES[5];
@@ -161,6 +164,10 @@ struct INES_Header {
 
 #define L_IOREGBLOCK1	0x2000
 #define L_IOREGBLOCK2	0x4000
+#define L_EXPROM		0x4020
+
+#define SZ_RAM			0x0800
+#define SZ_PPUREGS		0x0008
 
 #define SZ_PRGROM_BLOCK	0x4000
 #define SZ_PRGRAM_BLOCK 0x2000
@@ -168,6 +175,7 @@ struct INES_Header {
 
 #define SZ_IOREGBLOCK1	0x2000
 #define SZ_IOREGBLOCK2	0x0020
+#define SZ_EXPROM		0x1FE0
 
 #define L_JOYSTICK1		0x4016
 #define	L_JOYSTICK2		0x4017
@@ -0,0 +1,75 @@
+#include "Recompiled.h"
+#include "Mapper.h"
+#include "RomCache.h"
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+using namespace emu;
+
+//======================================================
+//RecompiledModule
+//======================================================
+
+std::shared_ptr<RecompiledModule> RecompiledModule::load(const char* path) {
+#ifdef _WIN32
+	HMODULE library = LoadLibraryA(path);
+	if (library == NULL)
+		return NULL;
+	RecompiledEntry entry = reinterpret_cast<RecompiledEntry>(GetProcAddress(library, RECOMPILED_ENTRY));
+#else
+	void* library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (library == NULL)
+		return NULL;
+	RecompiledEntry entry = reinterpret_cast<RecompiledEntry>(dlsym(library, RECOMPILED_ENTRY));
+#endif
+	const RecompiledImage* image = entry != NULL ? entry() : NULL;
+	if (image == NULL || image->abi != RECOMPILED_ABI) {
+#ifdef _WIN32
+		FreeLibrary(library);
+#else
+		dlclose(library);
+#endif
+		return NULL;
+	}
+
+	std::shared_ptr<RecompiledModule> module(new RecompiledModule(image));
+	module->library = library;
+	return module;
+}
+
+RecompiledModule::~RecompiledModule() {
+	if (library == NULL)
+		return;
+#ifdef _WIN32
+	FreeLibrary(static_cast<HMODULE>(library));
+#else
+	dlclose(library);
+#endif
+}
+
+uint64_t RecompiledModule::romHash(const Mapper& mapper) {
+	//Banks are laid out back to back (see Mapper::mapSharedRom)
+	return RomCache::hash(mapper.getMemoryPages()[0], mapper.getMemoryPageCount() * SZ_PRGROM_BLOCK);
+}
+
+bool RecompiledModule::matches(const Mapper& mapper) const {
+	return mapper.getMemoryPageCount() > 0 && image->romhash == romHash(mapper);
+}
+
+const RecompiledBlock* RecompiledModule::find(ADDR_16B pc, int32_t prgoffset) const {
+	const RecompiledBlock* end = image->blocks + image->blockcount;
+	const RecompiledBlock* it = std::lower_bound(image->blocks, end, pc,
+		[](const RecompiledBlock& block, ADDR_16B key) { return block.pc < key; });
+	for (; it != end && it->pc == pc; ++it) {
+		if (it->prgoffset == prgoffset)
+			return it;
+	}
+	return NULL;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#ifdef __RECOMPILED_H__
+#error __RECOMPILED_H__ Already defined!
+#else
+#define __RECOMPILED_H__
+#endif
+
+#include "CPU.h"
+#include <memory>
+
+/* ABI between the emulator and modules written by the recompiler (tools/Recompile.cpp).
+ * A module is a shared object built from the generated source with only src/ on the include
+ * path. It exports RECOMPILED_ENTRY, returning a RecompiledImage.
+ */
+
+//Bump whenever CPU, RecompiledImage, RecompiledBlock, RecompiledHost or MicroOp change
+#define RECOMPILED_ABI 2
+//Name of the exported function, and the same as a string for dlsym/GetProcAddress
+#define RECOMPILED_ENTRY_NAME nesode_recompiled
+#define RECOMPILED_STRINGIFY(X) #X
+#define RECOMPILED_NAME_STRING(X) RECOMPILED_STRINGIFY(X)
+#define RECOMPILED_ENTRY RECOMPILED_NAME_STRING(RECOMPILED_ENTRY_NAME)
+
+#ifdef _WIN32
+#define RECOMPILED_EXPORT extern "C" __declspec(dllexport)
+#else
+#define RECOMPILED_EXPORT extern "C" __attribute__((visibility("default")))
+#endif
+
+namespace emu {
+
+	class Mapper;
+
+	/* One block of a module. ops are the opcodes it covers, used for tick accounting and for
+	 * budgets too small to run it whole. */
+	struct RecompiledBlock {
+		ADDR_16B pc;
+		//Offset into PRG-ROM of pc, see Mapper::getPrgOffset
+		int32_t prgoffset;
+		int count;
+		const MicroOp* ops;
+		RecompiledFn fn;
+	};
+
+	/* Everything a module exports. blocks are sorted by pc, then prgoffset. */
+	struct RecompiledImage {
+		int abi;
+		//RomCache::hash of the PRG-ROM the module was built from
+		uint64_t romhash;
+		int blockcount;
+		const RecompiledBlock* blocks;
+	};
+
+	typedef const RecompiledImage* (*RecompiledEntry)();
+
+	/* A loaded module. Immutable, so one module can be attached to any number of emulators. */
+	class RecompiledModule {
+	public:
+		/* Load a module from a shared object.
+		 * @return NULL if it cannot be loaded or was built against another ABI.
+		 */
+		static std::shared_ptr<RecompiledModule> load(const char* path);
+		/* Wrap an image linked into the program. */
+		explicit RecompiledModule(const RecompiledImage* img) : image(img), library(NULL) {};
+		~RecompiledModule();
+		/* Returns true if the module was built from the PRG-ROM of mapper. */
+		bool matches(const Mapper& mapper) const;
+		/* Find the block starting at pc with PRG-ROM offset prgoffset, or NULL. */
+		const RecompiledBlock* find(ADDR_16B pc, int32_t prgoffset) const;
+		const RecompiledImage* getImage() const { return image; }
+		/* Hash of a mapper's PRG-ROM, as stored in RecompiledImage::romhash. */
+		static uint64_t romHash(const Mapper& mapper);
+	private:
+		RecompiledModule(const RecompiledModule&) = delete;
+		RecompiledModule& operator=(const RecompiledModule&) = delete;
+
+		const RecompiledImage* image;
+		//Handle of the shared object, NULL for a linked image
+		void* library;
+	};
+
+}
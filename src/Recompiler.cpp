@@ -0,0 +1,195 @@
+#include "Recompiler.h"
+#include "Instructions.h"
+#include <algorithm>
+#include <set>
+#include <sstream>
+
+using namespace emu;
+
+//Where probed opcodes are placed in the fork's RAM
+#define PROBE_ADDR 0x0200
+
+//Zero and negative flags from REG, as the register transfer handlers set them
+#define NZ_SOURCE "#define NZ(REG) LAZY_NZ(*cpu, cpu->REG.unsigned8)"
+
+//======================================================
+//Recompiler
+//======================================================
+
+Recompiler::Recompiler(Mapper& mappa) : mapper(mappa) {
+	probeLengths();
+}
+
+/* Lengths come from the interpreter itself, so stubbed opcodes are cut the way they run. */
+void Recompiler::probeLengths() {
+	for (int code = 0; code < 256; code++) {
+		length[code] = 0;
+		if (BlockCache::endsBlock(code))
+			continue;
+
+		CPU cpu;
+		initializeCPU(cpu);
+		cpu.progcount = PROBE_ADDR;
+		Machine probe(mapper.fork(), cpu);
+		probe.mapper->writeMemory(PROBE_ADDR, code);
+		probe.mapper->writeMemory(PROBE_ADDR + 1, 0);
+		probe.mapper->writeMemory(PROBE_ADDR + 2, 0);
+		probe.emulator.emulate_cpu(1);
+		if (probe.emulator.getErrorState() == ERROR_STATE::NONE)
+			length[code] = probe.cpu.progcount - PROBE_ADDR;
+	}
+}
+
+void Recompiler::decode(ADDR_16B pc, FoundBlock& block, std::vector<ADDR_16B>& next) const {
+	int page = pc >> 12;
+	ADDR_16B at = pc;
+	block.pc = pc;
+	block.prgoffset = mapper.getPrgOffset(pc);
+	block.ops.clear();
+
+	for (;;) {
+		OPCODE code = mapper.readMemory(at);
+		MicroOp op = { code, OPTICK[code], at };
+		block.ops.push_back(op);
+
+		if (BlockCache::endsBlock(code)) {
+			ADDR_16B target = mapper.readMemory(at + 1) | (mapper.readMemory(at + 2) << 8);
+			if ((code & 0x1F) == 0x10) {
+				//Branch offsets are unsigned in this core
+				next.push_back(at + 2 + mapper.readMemory(at + 1));
+				next.push_back(at + 2);
+			}
+			else if (code == OP_JSRABS) {
+				next.push_back(target);
+				next.push_back(at + 3);
+			}
+			else if (code == OP_JMPABS)
+				next.push_back(target);
+			return;
+		}
+		if (length[code] == 0)
+			return;
+
+		at += length[code];
+		if (block.ops.size() == BLOCK_MAX_OPS || (at >> 12) != page) {
+			next.push_back(at);
+			return;
+		}
+	}
+}
+
+int Recompiler::discover() {
+	std::vector<ADDR_16B> pending;
+	std::set<ADDR_16B> seen;
+	const ADDR_16B vectors[] = { L_PORHNDL, L_NMIHNDL, L_BRKHNDL };
+	for (ADDR_16B vector : vectors)
+		pending.push_back(mapper.readMemory(vector) | (mapper.readMemory(vector + 1) << 8));
+
+	found.clear();
+	while (!pending.empty()) {
+		ADDR_16B pc = pending.back();
+		pending.pop_back();
+		if (pc < L_PRGROM || mapper.getPrgOffset(pc) < 0 || !seen.insert(pc).second)
+			continue;
+		FoundBlock block;
+		decode(pc, block, pending);
+		found.push_back(block);
+	}
+
+	std::sort(found.begin(), found.end(), [](const FoundBlock& a, const FoundBlock& b) {
+		return a.pc < b.pc || (a.pc == b.pc && a.prgoffset < b.prgoffset);
+	});
+	return static_cast<int>(found.size());
+}
+
+/* Opcodes simple enough to write out in C++, mirroring their handlers. */
+bool Recompiler::emitInline(std::ostream& out, const MicroOp& op) const {
+	unsigned operand = mapper.readMemory(op.pc + 1);
+	switch (op.code)
+	{
+	case OP_NOP: return true;
+	case OP_CLC: out << "\tSETF_CARRY(cpu->procstat, 0);\n"; return true;
+	case OP_SEC: out << "\tSETF_CARRY(cpu->procstat, 1);\n"; return true;
+	case OP_CLV: out << "\tSETF_OVRFLOW(cpu->procstat, 0);\n"; return true;
+	case OP_INX: out << "\t++cpu->xindex.signed8;\n\tNZ(xindex);\n"; return true;
+	case OP_INY: out << "\t++cpu->yindex.signed8;\n\tNZ(yindex);\n"; return true;
+	case OP_DEX: out << "\t--cpu->xindex.signed8;\n\tNZ(xindex);\n"; return true;
+	case OP_DEY: out << "\t--cpu->yindex.signed8;\n\tNZ(yindex);\n"; return true;
+	case OP_TAX: out << "\tcpu->xindex = cpu->accumulator;\n\tNZ(xindex);\n"; return true;
+	case OP_TAY: out << "\tcpu->yindex = cpu->accumulator;\n\tNZ(yindex);\n"; return true;
+	case OP_TXA: out << "\tcpu->accumulator = cpu->xindex;\n\tNZ(accumulator);\n"; return true;
+	case OP_LDA | AMODE_IMMED: out << "\tcpu->accumulator.unsigned8 = 0x" << operand << ";\n\tNZ(accumulator);\n"; return true;
+	case OP_ORA | AMODE_IMMED: out << "\tcpu->accumulator.unsigned8 |= 0x" << operand << ";\n\tNZ(accumulator);\n"; return true;
+	case OP_AND | AMODE_IMMED: out << "\tcpu->accumulator.unsigned8 &= 0x" << operand << ";\n\tNZ(accumulator);\n"; return true;
+	case OP_EOR | AMODE_IMMED: out << "\tcpu->accumulator.unsigned8 ^= 0x" << operand << ";\n\tNZ(accumulator);\n"; return true;
+	}
+	return false;
+}
+
+void Recompiler::emit(std::ostream& out) const {
+	out << std::hex;
+	out << "//Generated by the recompiler (tools/Recompile.cpp). Do not edit.\n";
+	out << "#include \"Recompiled.h\"\n\n";
+	out << "using namespace emu;\n\n";
+	out << NZ_SOURCE << "\n";
+
+	for (const FoundBlock& block : found) {
+		std::ostringstream name;
+		name << std::hex << block.pc << "_" << block.prgoffset;
+		int count = static_cast<int>(block.ops.size());
+
+		out << "\nstatic const MicroOp ops_" << name.str() << "[] = {";
+		for (const MicroOp& op : block.ops)
+			out << "\n\t{ 0x" << unsigned(op.code) << ", " << std::dec << unsigned(op.ticks) << std::hex << ", 0x" << op.pc << " },";
+		out << "\n};\n\n";
+
+		//Same contract as NativeBlock
+		std::ostringstream body;
+		body << std::hex;
+		bool calls = false;
+		bool checks = false;
+		bool inlined = false;
+		for (int i = 0; i < count; i++) {
+			const MicroOp& op = block.ops[i];
+			inlined = emitInline(body, op);
+			if (inlined)
+				continue;
+			calls = true;
+			body << "\tcpu->progcount = 0x" << ADDR_16B(op.pc + 1) << ";\n";
+			body << "\tif ((err = host->handlers[0x" << unsigned(op.code) << "](mapper, cpu)) != 0)\n";
+			body << "\t\treturn " << std::dec << (i + 1) << std::hex << " << 8 | err;\n";
+			if (i + 1 == count)
+				continue;
+			checks = true;
+			body << "\tif (host->pagegen[0x" << (block.pc >> 12) << "] != gen)\n";
+			body << "\t\treturn " << std::dec << (i + 1) << std::hex << " << 8;\n";
+		}
+		if (inlined) {
+			const MicroOp& last = block.ops[count - 1];
+			body << "\tcpu->progcount = 0x" << ADDR_16B(last.pc + length[last.code]) << ";\n";
+		}
+
+		out << "static int block_" << name.str() << "(void* mapper, CPU* cpu, const RecompiledHost* host)\n{\n";
+		if (checks)
+			out << "\tconst uint32_t gen = host->pagegen[0x" << (block.pc >> 12) << "];\n";
+		if (calls)
+			out << "\tint err;\n";
+		out << body.str();
+		out << "\treturn " << std::dec << count << std::hex << " << 8;\n}\n";
+	}
+
+	out << "\nstatic const RecompiledBlock blocks[] = {";
+	for (const FoundBlock& block : found) {
+		std::ostringstream name;
+		name << std::hex << block.pc << "_" << block.prgoffset;
+		out << "\n\t{ 0x" << block.pc << ", 0x" << block.prgoffset << ", " << std::dec << block.ops.size() << std::hex
+			<< ", ops_" << name.str() << ", block_" << name.str() << " },";
+	}
+	if (found.empty())
+		out << "\n\t{ 0, -1, 0, NULL, NULL }";
+	out << "\n};\n\n";
+
+	out << "static const RecompiledImage image = { RECOMPILED_ABI, 0x" << RecompiledModule::romHash(mapper) << "ull, "
+		<< std::dec << found.size() << ", blocks };\n\n";
+	out << "RECOMPILED_EXPORT const RecompiledImage* RECOMPILED_ENTRY_NAME()\n{\n\treturn &image;\n}\n";
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#ifdef __RECOMPILER_H__
+#error __RECOMPILER_H__ Already defined!
+#else
+#define __RECOMPILER_H__
+#endif
+
+#include "Recompiled.h"
+#include "Emulator.h"
+#include <ostream>
+#include <vector>
+
+namespace emu {
+
+	/* Finds the blocks reachable from the reset, NMI and BRK vectors of a ROM and writes them
+	 * out as the C++ source of a module (see Recompiled.h). Blocks are cut exactly where
+	 * Dispatch::BLOCK cuts them. OP_JMP (indirect), RTS and RTI end the walk; whatever they
+	 * reach is left to the interpreter at run time.
+	 */
+	class Recompiler {
+	public:
+		struct FoundBlock {
+			ADDR_16B pc;
+			int32_t prgoffset;
+			std::vector<MicroOp> ops;
+		};
+
+		/* mapper is never run or written to, but is forked to measure opcode lengths. */
+		explicit Recompiler(Mapper& mapper);
+		/* Walk all code reachable from the vectors.
+		 * @return The number of blocks found.
+		 */
+		int discover();
+		/* Write the source of a module holding every block found. */
+		void emit(std::ostream& out) const;
+		const std::vector<FoundBlock>& getBlocks() const { return found; }
+	private:
+		//Run every opcode once on a fork to learn how far it moves progcount
+		void probeLengths();
+		//Decode the block at pc, adding the addresses it can continue at to next
+		void decode(ADDR_16B pc, FoundBlock& block, std::vector<ADDR_16B>& next) const;
+		//Write one opcode of a block, returning false if it is left to its handler
+		bool emitInline(std::ostream& out, const MicroOp& op) const;
+
+		Mapper& mapper;
+		//Bytes taken by each opcode not ending a block, 0 if it stops the CPU
+		int length[256];
+		std::vector<FoundBlock> found;
+	};
+
+}
@@ -0,0 +1,56 @@
+#include "RomCache.h"
+#include <cstring>
+
+using namespace emu;
+
+//======================================================
+//RomCache
+//======================================================
+
+RomCache& RomCache::instance() {
+	static RomCache cache;
+	return cache;
+}
+
+uint64_t RomCache::hash(const BYTE* data, size_t size) {
+	uint64_t h = 0xCBF29CE484222325ull;
+	for (size_t i = 0; i < size; i++) {
+		h ^= data[i];
+		h *= 0x100000001B3ull;
+	}
+	return h;
+}
+
+std::shared_ptr<BYTE> RomCache::intern(const BYTE* data, size_t size) {
+	uint64_t key = hash(data, size);
+	std::lock_guard<std::mutex> lock(cachem);
+
+	auto range = images.equal_range(key);
+	for (auto it = range.first; it != range.second; ++it) {
+		std::shared_ptr<BYTE> cached = it->second.data.lock();
+		if (cached && it->second.size == size && memcmp(cached.get(), data, size) == 0)
+			return cached;
+	}
+
+	prune();
+	std::shared_ptr<BYTE> image(new BYTE[size], std::default_delete<BYTE[]>());
+	memcpy(image.get(), data, size);
+	Entry entry = { image, size };
+	images.insert(std::make_pair(key, entry));
+	return image;
+}
+
+size_t RomCache::getImageCount() {
+	std::lock_guard<std::mutex> lock(cachem);
+	prune();
+	return images.size();
+}
+
+void RomCache::prune() {
+	for (auto it = images.begin(); it != images.end();) {
+		if (it->second.data.expired())
+			it = images.erase(it);
+		else
+			++it;
+	}
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#ifdef __ROMCACHE_H__
+#error __ROMCACHE_H__ Already defined!
+#else
+#define __ROMCACHE_H__
+#endif
+
+#include "NTDef.h"
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace emu {
+
+	/* Process wide cache of immutable ROM images keyed by a hash of their content. Every mapper
+	 * created from the same image shares one copy, which is freed with the last mapper using it.
+	 * Thread-safe.
+	 */
+	class RomCache {
+	public:
+		static RomCache& instance();
+
+		/* Return shared storage holding the same bytes as data, copying data only if no
+		 * identical image is cached. The storage must not be written to.
+		 */
+		std::shared_ptr<BYTE> intern(const BYTE* data, size_t size);
+		/* Number of images currently cached. */
+		size_t getImageCount();
+		/* 64 bit FNV-1a hash. */
+		static uint64_t hash(const BYTE* data, size_t size);
+	private:
+		RomCache() {};
+		struct Entry {
+			std::weak_ptr<BYTE> data;
+			size_t size;
+		};
+		//Drop entries whose storage has been freed
+		void prune();
+
+		std::mutex cachem;
+		std::unordered_multimap<uint64_t, Entry> images;
+	};
+
+}
@@ -0,0 +1,49 @@
+#include "Scheduler.h"
+#include <algorithm>
+
+using namespace emu;
+
+//======================================================
+//Scheduler
+//======================================================
+
+bool Scheduler::later(const Event& a, const Event& b) {
+	//Ids only wrap after 4 billion events, long after any two pending ones were scheduled
+	return a.when > b.when || (a.when == b.when && (int32_t)(a.id - b.id) > 0);
+}
+
+Scheduler::EventId Scheduler::schedule(uint64_t when, EventHandler handler) {
+	Event event = { when, ++lastid, handler };
+	events.push_back(event);
+	std::push_heap(events.begin(), events.end(), later);
+	return event.id;
+}
+
+bool Scheduler::cancel(EventId id) {
+	for (size_t i = 0; i < events.size(); i++) {
+		if (events[i].id == id) {
+			events[i] = events.back();
+			events.pop_back();
+			std::make_heap(events.begin(), events.end(), later);
+			return true;
+		}
+	}
+	return false;
+}
+
+int Scheduler::ticksUntilNext(int limit) const {
+	if (events.empty() || events.front().when >= clock + limit)
+		return limit;
+	//advance leaves nothing due, so the earliest event is at least a tick away
+	return (int)(events.front().when - clock);
+}
+
+void Scheduler::advance(int ticks) {
+	clock += ticks;
+	while (!events.empty() && events.front().when <= clock) {
+		std::pop_heap(events.begin(), events.end(), later);
+		Event event = events.back();
+		events.pop_back();
+		event.handler(event.when);
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#ifdef __SCHEDULER_H__
+#error __SCHEDULER_H__ Already defined!
+#else
+#define __SCHEDULER_H__
+#endif
+
+#include "NTDef.h"
+#include <functional>
+#include <vector>
+
+namespace emu {
+
+	/* Master clock of a machine in CPU ticks, and the events due on it (vblank, NMI, frame
+	 * counter, mapper IRQ counters, ...). Emulator2A03::emulate_cpu runs the CPU uninterrupted
+	 * up to the next event and then runs every event due. Components schedule an event for the
+	 * next time they need the CPU to stop, and otherwise catch up from now() when read or
+	 * written. now() only moves between the runs of the CPU, so within one it is the clock the
+	 * run started at. Events due on the same tick run in the order they were scheduled.
+	 * Not thread-safe; events run on the thread calling emulate_cpu.
+	 */
+	class Scheduler {
+	public:
+		typedef std::function<void(uint64_t when)> EventHandler;
+		typedef uint32_t EventId;
+
+		Scheduler() : clock(0), lastid(0) {};
+		uint64_t now() const { return clock; }
+		/* Move the clock without running anything. Pending events keep their deadlines. */
+		void setClock(uint64_t when) { clock = when; }
+
+		/* Run handler once the clock reaches when. Events scheduled in the past run at the
+		 * start of the next emulate_cpu.
+		 * @return An id to cancel the event with.
+		 */
+		EventId schedule(uint64_t when, EventHandler handler);
+		/* Drop an event before it runs. Returns false if it has run or was dropped already. */
+		bool cancel(EventId id);
+		/* Ticks from now to the earliest event, or limit if none is due sooner. At least 1. */
+		int ticksUntilNext(int limit) const;
+		/* Move the clock forward by ticks, then run every event due, earliest first. Events
+		 * scheduled by a handler run in the same call if they are due. */
+		void advance(int ticks);
+		/* Drop every pending event without running it. The clock is kept. */
+		void clear() { events.clear(); }
+		size_t getPendingCount() const { return events.size(); }
+	private:
+		struct Event {
+			uint64_t when;
+			EventId id;
+			EventHandler handler;
+		};
+		//Heap order: the earliest event, then the first scheduled, at the front
+		static bool later(const Event& a, const Event& b);
+
+		std::vector<Event> events;
+		uint64_t clock;
+		EventId lastid;
+	};
+
+}
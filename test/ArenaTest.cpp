@@ -0,0 +1,100 @@
+#include "Emulator.h"
+#include "Arena.h"
+#include "Test.h"
+#include "Helpers.h"
+#include "Instructions.h"
+#include <vector>
+
+#define ARENATEST ArenaTest
+
+#define INIT_CPUEMU \
+	CREATE_DEFMAP; \
+	emu::CPU cpu; \
+	emu::initializeCPU(cpu); \
+	emu::Emulator2A03 cpuemu(*defmap, cpu); \
+	cpu.progcount = 0x8000; \
+	writePatternToMem(*defmap, arenaProgram, sizeof(arenaProgram), 0x8000);
+
+#define TEARDOWN_CPUEMU \
+	TEARDOWN_DEFMAP;
+
+//Forks made and torn down per round of ROLLOUTTEST
+#define ROLLOUTS 500
+
+/* Count X into $10. */
+static OPCODE arenaProgram[] = {
+	OP_INX,
+	OP_STX | AMODE_ZPAGE, 0x10,
+	OP_JMPABS, 0x00, 0x80
+};
+
+/* Freed blocks are reused by their size class, and every block is cache line aligned. */
+TEST(ARENATEST, SLOTTEST) {
+	emu::Arena arena;
+	void* first = arena.allocate(100);
+	void* second = arena.allocate(100);
+	ASSERT_NE(first, second);
+	ASSERT_EQ((uintptr_t)first % ARENA_MIN_SLOT, 0u);
+	ASSERT_EQ((uintptr_t)second % ARENA_MIN_SLOT, 0u);
+	arena.release(first, 100);
+	ASSERT_EQ(arena.allocate(120), first);
+	ASSERT_NE(arena.allocate(20), first);
+
+	//Too large for a slab
+	void* large = arena.allocate(ARENA_SLAB_SIZE);
+	arena.release(large, ARENA_SLAB_SIZE);
+	ASSERT_EQ(arena.getSlabCount(), 1u);
+}
+
+/* Blocks that would waste over a quarter of a power of two slot get slots of their own size. */
+TEST(ARENATEST, FITTEDTEST) {
+	emu::Arena arena;
+	const size_t size = sizeof(emu::MapperMemory);
+	BYTE* first = static_cast<BYTE*>(arena.allocate(size));
+	BYTE* second = static_cast<BYTE*>(arena.allocate(size));
+	ASSERT_EQ((size_t)(second - first), (size + ARENA_MIN_SLOT - 1) / ARENA_MIN_SLOT * ARENA_MIN_SLOT);
+	ASSERT_EQ((uintptr_t)second % ARENA_MIN_SLOT, 0u);
+	arena.release(first, size);
+	ASSERT_EQ(arena.allocate(size), first);
+
+	//A power of two class serves sizes that nearly fill it
+	void* page = arena.allocate(SZ_PRGROM_BLOCK);
+	arena.release(page, SZ_PRGROM_BLOCK);
+	ASSERT_EQ(arena.allocate(SZ_PRGROM_BLOCK - 100), page);
+
+	//A pool's worth of memory blocks takes slabs by their size, not by the next power of two
+	emu::Arena pool;
+	const int blocks = 100;
+	for (int i = 0; i < blocks; i++)
+		pool.allocate(size);
+	ASSERT_LE(pool.getSlabCount(), (blocks * size + ARENA_SLAB_SIZE - 1) / ARENA_SLAB_SIZE);
+}
+
+/* Forks carved from an arena run as heap forks do, and tearing them down and forking again
+ * takes no more slabs. */
+TEST(ARENATEST, ROLLOUTTEST) {
+	INIT_CPUEMU;
+	emu::Arena arena;
+	size_t slabs = 0;
+	for (int round = 0; round < 3; round++) {
+		std::vector<std::unique_ptr<emu::Machine>> rollouts;
+		for (int i = 0; i < ROLLOUTS; i++) {
+			rollouts.push_back(cpuemu.fork(&arena));
+			rollouts.back()->emulator.emulate_cpu(1 + i % 50);
+		}
+		std::unique_ptr<emu::Machine> heap = cpuemu.fork();
+		heap->emulator.emulate_cpu(1 + (ROLLOUTS - 1) % 50);
+		ASSERT_EQ(rollouts.back()->mapper->readMemory(0x10), heap->mapper->readMemory(0x10));
+		ASSERT_EQ(rollouts.back()->cpu.progcount, heap->cpu.progcount);
+		ASSERT_EQ(defmap->readMemory(0x10), 0);
+
+		//Forks of forks come from the same arena
+		std::unique_ptr<emu::Machine> grandchild = rollouts.back()->emulator.fork(&arena);
+		ASSERT_EQ(grandchild->mapper->readMemory(0x10), heap->mapper->readMemory(0x10));
+
+		if (round == 0)
+			slabs = arena.getSlabCount();
+		ASSERT_EQ(arena.getSlabCount(), slabs);
+	}
+	TEARDOWN_CPUEMU;
+}
@@ -0,0 +1,126 @@
+#include "Batch.h"
+#include "Test.h"
+#include "Helpers.h"
+#include "Instructions.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#define BATCHTEST BatchRunnerTest
+
+#define INSTANCES 16
+//Runs in RERUNTEST, each short enough for workers to still be leaving the last
+#define RERUNS 2000
+
+/* Add an instance running the INX / JMP $8000 loop. */
+static int addLoopInstance(emu::BatchRunner& batch)
+{
+	emu::Mapper* defmap = NULL;
+	std::ifstream rom(TESTROM, std::ifstream::binary);
+	emu::Mapper::createMapper(rom, defmap);
+	writeOpToMem(*defmap, OP_INX, 0x8000);
+	writeOpToMem(*defmap, OP_JMPABS, 0x8001);
+	writeOpToMem(*defmap, 0x00, 0x8002);
+	writeOpToMem(*defmap, 0x80, 0x8003);
+
+	emu::CPU cpu;
+	emu::initializeCPU(cpu);
+	cpu.progcount = 0x8000;
+	return batch.addInstance(defmap, cpu);
+}
+
+/* Every instance runs its full budget and reports completion once. */
+TEST(BATCHTEST, RUNTEST) {
+	std::ifstream rom(TESTROM, std::ifstream::binary);
+	if (!rom.is_open()) FAIL();
+
+	emu::BatchRunner batch(4);
+	for (int i = 0; i < INSTANCES; i++)
+		addLoopInstance(batch);
+
+	std::atomic<int> completions(0);
+	batch.setCompletionHandler([&](int, const emu::InstanceStatus&) { completions++; });
+
+	const int looptick = emu::OPTICK[OP_INX] + emu::OPTICK[OP_JMPABS];
+	const long budget = 10 * TICKS_PER_FRAME;
+	batch.run(budget, 1000);
+
+	ASSERT_EQ(completions, INSTANCES);
+	unsigned long long total = 0;
+	for (int i = 0; i < INSTANCES; i++) {
+		const emu::InstanceStatus& status = batch.getStatus(i);
+		ASSERT_TRUE(status.complete);
+		ASSERT_EQ(status.error, emu::NONE);
+		ASSERT_GE(status.ticks_run, budget);
+		ASSERT_LT(status.ticks_run, budget + looptick);
+		ASSERT_EQ(batch.getCPU(i).xindex.unsigned8, batch.getCPU(0).xindex.unsigned8);
+		total += status.ticks_run;
+	}
+
+	emu::BatchCounters counters = batch.getCounters();
+	ASSERT_EQ(counters.ticks, total);
+	ASSERT_EQ(counters.completed, (unsigned long long)INSTANCES);
+	ASSERT_GT(counters.seconds, 0);
+
+	//A second run continues from where the first stopped
+	batch.runFrames(1);
+	ASSERT_EQ(batch.getCounters().completed, 2ull * INSTANCES);
+	ASSERT_GE(batch.getStatus(0).ticks_run, TICKS_PER_FRAME);
+}
+
+/* An instance that locks the CPU completes early with its error. */
+TEST(BATCHTEST, ERRORTEST) {
+	std::ifstream rom(TESTROM, std::ifstream::binary);
+	if (!rom.is_open()) FAIL();
+
+	emu::BatchRunner batch(2);
+	addLoopInstance(batch);
+	int locked = addLoopInstance(batch);
+	writeOpToMem(batch.getMapper(locked), OP_KIL0, 0x8000);
+
+	batch.run(100 * TICKS_PER_FRAME);
+
+	ASSERT_TRUE(batch.getStatus(locked).complete);
+	ASSERT_EQ(batch.getStatus(locked).error, emu::CPU_LOCK);
+	ASSERT_LT(batch.getStatus(locked).ticks_run, TICKS_PER_FRAME);
+	ASSERT_EQ(batch.getStatus(0).error, emu::NONE);
+	ASSERT_GE(batch.getStatus(0).ticks_run, 100 * TICKS_PER_FRAME);
+}
+
+/* Back to back short runs, with more workers than instances, each finish and count every instance once. */
+TEST(BATCHTEST, RERUNTEST) {
+	std::ifstream rom(TESTROM, std::ifstream::binary);
+	if (!rom.is_open()) FAIL();
+
+	emu::BatchRunner batch(8);
+	addLoopInstance(batch);
+	addLoopInstance(batch);
+
+	for (int run = 1; run <= RERUNS; run++) {
+		batch.run(100, 10);
+		ASSERT_EQ(batch.getCounters().completed, 2ull * run);
+		ASSERT_TRUE(batch.getStatus(0).complete);
+		ASSERT_TRUE(batch.getStatus(1).complete);
+	}
+}
+
+/* Pausing the pool holds every instance before it runs, with run blocking until resumed. */
+TEST(BATCHTEST, PAUSETEST) {
+	std::ifstream rom(TESTROM, std::ifstream::binary);
+	if (!rom.is_open()) FAIL();
+
+	emu::BatchRunner batch(4);
+	for (int i = 0; i < INSTANCES; i++)
+		addLoopInstance(batch);
+
+	batch.pause();
+	std::thread runner([&] { batch.run(10 * TICKS_PER_FRAME, 1000); });
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	EXPECT_EQ(batch.getCounters().ticks, 0ull);
+	batch.resume();
+	runner.join();
+
+	ASSERT_EQ(batch.getCounters().completed, (unsigned long long)INSTANCES);
+	for (int i = 0; i < INSTANCES; i++)
+		ASSERT_GE(batch.getStatus(i).ticks_run, 10 * TICKS_PER_FRAME);
+}
@@ -0,0 +1,110 @@
+#include "Emulator.h"
+#include "Test.h"
+#include "Helpers.h"
+#include "Instructions.h"
+
+#define BLOCKCACHETEST BlockCacheTest
+
+#define INIT_CPUEMU \
+	CREATE_DEFMAP; \
+	emu::CPU cpu; \
+	emu::initializeCPU(cpu); \
+	emu::Emulator2A03 cpuemu(*defmap, cpu); \
+	ASSERT_EQ(cpuemu.setDispatch(emu::Dispatch::BLOCK), emu::Dispatch::BLOCK); \
+	cpu.progcount = 0x8000; \
+	writePatternToMem(*defmap, blockProgram, sizeof(blockProgram), 0x8000);
+
+#define TEARDOWN_CPUEMU \
+	TEARDOWN_DEFMAP;
+
+//Address of the NOP the tests patch
+#define PATCHADDR 0x8009
+
+/* One straight-line block looping on itself. */
+static OPCODE blockProgram[] = {
+	OP_LDA | AMODE_ZPAGE, 0x10,
+	OP_CLC,
+	OP_ADC | AMODE_IMMED, 0x03,
+	OP_STA | AMODE_ZPAGE, 0x10,
+	OP_INX,
+	OP_TXA,
+	OP_NOP,
+	OP_JMPABS, 0x00, 0x80
+};
+
+/* Any budget leaves the same ticks and state whether blocks are cached or not. */
+TEST(BLOCKCACHETEST, TICKTEST) {
+	INIT_CPUEMU;
+	cpuemu.emulate_cpu(1000);
+	emu::CPU start = cpuemu.getCopyCPU();
+	BYTE sum = defmap->readMemory(0x10);
+
+	for (int budget = 1; budget < 40; budget++) {
+		cpuemu.setCPU(start);
+		defmap->writeMemory(0x10, sum);
+		int left = cpuemu.emulate_cpu(budget);
+		emu::CPU run = cpuemu.getCopyCPU();
+
+		//One opcode at a time, by the reference dispatch
+		cpuemu.setDispatch(emu::Dispatch::SWITCH);
+		cpuemu.setCPU(start);
+		defmap->writeMemory(0x10, sum);
+		int stepped = budget;
+		while (stepped > 0)
+			stepped += cpuemu.emulate_cpu(1) - 1;
+		cpuemu.setDispatch(emu::Dispatch::BLOCK);
+
+		ASSERT_EQ(left, stepped);
+		ASSERT_EQ(run.progcount, cpu.progcount);
+		ASSERT_EQ(run.xindex.unsigned8, cpu.xindex.unsigned8);
+		ASSERT_EQ(run.accumulator.unsigned8, cpu.accumulator.unsigned8);
+	}
+	TEARDOWN_CPUEMU;
+}
+
+/* Writing over code that has already run takes effect on the next pass. */
+TEST(BLOCKCACHETEST, PATCHTEST) {
+	INIT_CPUEMU;
+	cpuemu.emulate_cpu(1000);
+	ASSERT_EQ(cpuemu.getCopyCPU().yindex.unsigned8, 0);
+
+	defmap->writeMemory(PATCHADDR, OP_INY);
+	cpuemu.emulate_cpu(1000);
+	ASSERT_GT(cpuemu.getCopyCPU().yindex.unsigned8, 10);
+	TEARDOWN_CPUEMU;
+}
+
+/* Writing through a mirror of a page invalidates code cached from the page. */
+TEST(BLOCKCACHETEST, MIRRORTEST) {
+	INIT_CPUEMU;
+	ASSERT_EQ(defmap->getMemoryPageCount(), 1);
+	cpuemu.emulate_cpu(1000);
+
+	defmap->writeMemory(PATCHADDR + 0x4000, OP_INY);
+	ASSERT_EQ(defmap->readMemory(PATCHADDR), OP_INY);
+	cpuemu.emulate_cpu(1000);
+	ASSERT_GT(cpuemu.getCopyCPU().yindex.unsigned8, 10);
+
+	//Again, now that the page is private
+	defmap->writeMemory(PATCHADDR + 0x4000, OP_DEY);
+	int y = cpuemu.getCopyCPU().yindex.unsigned8;
+	cpuemu.emulate_cpu(1000);
+	ASSERT_LT(cpuemu.getCopyCPU().yindex.unsigned8, y - 10);
+	TEARDOWN_CPUEMU;
+}
+
+/* Code writing over the rest of its own block runs the new opcode. */
+TEST(BLOCKCACHETEST, SELFMODIFYTEST) {
+	INIT_CPUEMU;
+	//LDA #OP_INY / STA $8009 in place of CLC / ADC / STA, so the NOP becomes INY
+	static OPCODE selfmodify[] = {
+		OP_LDA | AMODE_IMMED, OP_INY,
+		OP_STA | AMODE_ABS, PATCHADDR & 0xFF, PATCHADDR >> 8
+	};
+	cpuemu.emulate_cpu(1000);
+	writePatternToMem(*defmap, selfmodify, sizeof(selfmodify), 0x8002);
+	writeOpToMem(*defmap, OP_NOP, 0x8007);
+	cpuemu.emulate_cpu(1000);
+	ASSERT_GT(cpuemu.getCopyCPU().yindex.unsigned8, 10);
+	TEARDOWN_CPUEMU;
+}
@@ -136,6 +136,30 @@ TEST(CPUEMUTEST, TRANSFER_INS) {
 	TEARDOWN_CPUEMU;
 }
 
+/* TYA sets Negative and Zero from the value it transfers. */
+TEST(CPUEMUTEST, TYA_FLAGS) {
+	INIT_CPUEMU;
+	OPCODE inject[] = { OP_TYA, OP_TYA };
+	writePatternToMem(*defmap, inject, 2, L_PRGROM);
+	cpu.xindex.signed8 = 7;
+	cpu.yindex.signed8 = 0;
+	cpu.accumulator.signed8 = 1;
+	int ticksr = cpuemu.emulate_cpu(emu::OPTICK[OP_TYA]);
+	ASSERT_EQ(ticksr, 0);
+	ASSERT_EQ(cpu.accumulator.signed8, 0);
+	ASSERT_EQ(F_ZERO(cpu.procstat), 1);
+	ASSERT_EQ(F_NEG(cpu.procstat), 0);
+
+	cpu.xindex.signed8 = 0;
+	cpu.yindex.signed8 = -2;
+	ticksr = cpuemu.emulate_cpu(emu::OPTICK[OP_TYA]);
+	ASSERT_EQ(ticksr, 0);
+	ASSERT_EQ(cpu.accumulator.signed8, -2);
+	ASSERT_EQ(F_ZERO(cpu.procstat), 0);
+	ASSERT_EQ(F_NEG(cpu.procstat), 1);
+	TEARDOWN_CPUEMU;
+}
+
 /* Test for all stack manipulation instructions. */
 TEST(CPUEMUTEST, STACK_INS) {
 	INIT_CPUEMU;
@@ -197,6 +221,23 @@ TEST(CPUEMUTEST, FLAG_INS) {
 	TEARDOWN_CPUEMU;
 }
 
+/* N and Z recorded within one run are exact when pushed and once the run returns. */
+TEST(CPUEMUTEST, LAZYFLAG_INS) {
+	INIT_CPUEMU;
+	OPCODE inject[] = { OP_LDA | AMODE_IMMED, 0x00, OP_PHP, OP_LDA | AMODE_IMMED, 0x80, OP_PHP, OP_SEC, OP_INX };
+	writePatternToMem(*defmap, inject, sizeof(inject), L_PRGROM);
+	cpu.procstat = NEG_BIT | OVRFLOW_BIT;
+
+	int ticksr = cpuemu.emulate_cpu(2 * emu::OPTICK[OP_LDA | AMODE_IMMED] + 2 * emu::OPTICK[OP_PHP] +
+		emu::OPTICK[OP_SEC] + emu::OPTICK[OP_INX]);
+	ASSERT_EQ(ticksr, 0);
+	ASSERT_EQ(defmap->getMemory()[L_STACKT + 0xFF], ZERO_BIT | OVRFLOW_BIT);
+	ASSERT_EQ(defmap->getMemory()[L_STACKT + 0xFE], NEG_BIT | OVRFLOW_BIT);
+	ASSERT_EQ(cpu.procstat, CARRY_BIT | OVRFLOW_BIT);
+
+	TEARDOWN_CPUEMU;
+}
+
 /* Test for BRK instruction. May be re-written to more faithfully emulate 2A05. */
 TEST(CPUEMUTEST, BRK_INS) {
 	INIT_CPUEMU;
@@ -746,4 +787,40 @@ TEST(CPUEMUTEST, CMP_INS)
 	}
 
 	TEARDOWN_CPUEMU;
-}
\ No newline at end of file
+}
+
+/* A strict instance stops on a write to PRG-ROM that a fast one lets through, reporting it
+ * and the opcode making it. */
+TEST(CPUEMUTEST, ENFORCETEST) {
+	INIT_CPUEMU;
+	OPCODE program[] = { OP_STA | AMODE_ABS, 0x00, 0x80, OP_INX };
+	writePatternToMem(*defmap, program, sizeof(program), 0x0200);
+	cpu.progcount = 0x0200;
+	cpuemu.emulate_cpu(emu::OPTICK[OP_STA | AMODE_ABS]);
+	ASSERT_EQ(cpuemu.getErrorState(), emu::ERROR_STATE::NONE);
+
+	emu::Mapper* strict = NULL;
+	rom.clear();
+	emu::Mapper::createMapper(rom, strict, emu::Enforcement::STRICT);
+	writePatternToMem(*strict, program, sizeof(program), 0x0200);
+	emu::CPU strictcpu;
+	emu::initializeCPU(strictcpu);
+	strictcpu.progcount = 0x0200;
+	emu::Emulator2A03 strictemu(*strict, strictcpu);
+	int left = strictemu.emulate_cpu(1000);
+	ASSERT_EQ(strictemu.getErrorState(), emu::ERROR_STATE::BAD_WRITE);
+	ASSERT_EQ(strictemu.getFaultAddress(), 0x8000);
+	ASSERT_EQ(strictemu.getFaultPC(), 0x0200);
+	ASSERT_EQ(strictcpu.progcount, 0x0200);
+	ASSERT_EQ(strictcpu.xindex.unsigned8, 0);
+	ASSERT_EQ(left, 1000 - emu::OPTICK[OP_STA | AMODE_ABS]);
+	ASSERT_FALSE(strict->hasFault());
+
+	//Running on retries the opcode, and stops on it again
+	left = strictemu.emulate_cpu(1000);
+	ASSERT_EQ(strictemu.getErrorState(), emu::ERROR_STATE::BAD_WRITE);
+	ASSERT_EQ(strictemu.getFaultPC(), 0x0200);
+	ASSERT_EQ(left, 1000 - emu::OPTICK[OP_STA | AMODE_ABS]);
+	delete strict;
+	TEARDOWN_CPUEMU;
+}
@@ -0,0 +1,106 @@
+#include "Emulator.h"
+#include "Test.h"
+#include "Helpers.h"
+#include "Instructions.h"
+
+#define FORKTEST ForkTest
+
+#define INIT_CPUEMU \
+	CREATE_DEFMAP; \
+	emu::CPU cpu; \
+	emu::initializeCPU(cpu); \
+	emu::Emulator2A03 cpuemu(*defmap, cpu); \
+	cpu.progcount = 0x8000; \
+	writePatternToMem(*defmap, forkProgram, sizeof(forkProgram), 0x8000);
+
+#define TEARDOWN_CPUEMU \
+	TEARDOWN_DEFMAP;
+
+/* Loop adding the byte at $20 to $10. */
+static OPCODE forkProgram[] = {
+	OP_LDA | AMODE_ZPAGE, 0x10,
+	OP_CLC,
+	OP_ADC | AMODE_ZPAGE, 0x20,
+	OP_STA | AMODE_ZPAGE, 0x10,
+	OP_PHA,
+	OP_JMPABS, 0x00, 0x80
+};
+
+/* A fork shares pages until one side writes to them. */
+TEST(FORKTEST, SHARETEST) {
+	INIT_CPUEMU;
+	defmap->writeMemory(0x20, 1);
+	cpuemu.emulate_cpu(1000);
+
+	std::unique_ptr<emu::Machine> child = cpuemu.fork();
+	for (int page = 0; page < 16; page++)
+		ASSERT_EQ(child->mapper->getReadPages()[page], defmap->getReadPages()[page]);
+	ASSERT_EQ(child->cpu.progcount, cpu.progcount);
+
+	child->mapper->writeMemory(0x20, 2);
+	ASSERT_NE(child->mapper->getReadPages()[0], defmap->getReadPages()[0]);
+	ASSERT_EQ(child->mapper->getReadPages()[1], child->mapper->getReadPages()[0]);
+	ASSERT_EQ(child->mapper->getReadPages()[8], defmap->getReadPages()[8]);
+	ASSERT_EQ(defmap->readMemory(0x20), 1);
+	ASSERT_EQ(child->mapper->readMemory(0x820), 2);
+	TEARDOWN_CPUEMU;
+}
+
+/* Parent and child run on independently after a fork. */
+TEST(FORKTEST, DIVERGETEST) {
+	INIT_CPUEMU;
+	defmap->writeMemory(0x20, 1);
+	cpuemu.emulate_cpu(1000);
+
+	std::unique_ptr<emu::Machine> child = cpuemu.fork();
+	std::unique_ptr<emu::Machine> twin = cpuemu.fork();
+	child->mapper->writeMemory(0x20, 3);
+
+	cpuemu.emulate_cpu(1000);
+	child->emulator.emulate_cpu(1000);
+	twin->emulator.emulate_cpu(1000);
+
+	ASSERT_EQ(twin->cpu.progcount, cpu.progcount);
+	ASSERT_EQ(twin->cpu.accumulator.unsigned8, cpu.accumulator.unsigned8);
+	ASSERT_EQ(twin->mapper->readMemory(0x10), defmap->readMemory(0x10));
+	ASSERT_NE(child->mapper->readMemory(0x10), defmap->readMemory(0x10));
+	for (int addr = 0x100; addr < 0x200; addr++)
+		ASSERT_EQ(twin->mapper->readMemory(addr), defmap->readMemory(addr));
+	TEARDOWN_CPUEMU;
+}
+
+/* A fork outlives its parent and can fork again. */
+TEST(FORKTEST, LIFETIMETEST) {
+	std::unique_ptr<emu::Machine> child;
+	{
+		INIT_CPUEMU;
+		defmap->writeMemory(0x20, 1);
+		cpuemu.emulate_cpu(1000);
+		child = cpuemu.fork();
+		TEARDOWN_CPUEMU;
+	}
+	BYTE before = child->mapper->readMemory(0x10);
+	std::unique_ptr<emu::Machine> grandchild = child->emulator.fork();
+	child.reset();
+
+	grandchild->emulator.emulate_cpu(1000);
+	ASSERT_NE(grandchild->mapper->readMemory(0x10), before);
+}
+
+/* Restoring a state into a fork leaves the pages it shares alone. */
+TEST(FORKTEST, RESTORETEST) {
+	INIT_CPUEMU;
+	defmap->writeMemory(0x20, 1);
+	cpuemu.emulate_cpu(1000);
+	static emu::MachineState state;
+	cpuemu.saveState(state);
+	cpuemu.emulate_cpu(1000);
+	BYTE parentval = defmap->readMemory(0x10);
+
+	std::unique_ptr<emu::Machine> child = cpuemu.fork();
+	ASSERT_TRUE(child->emulator.restoreState(state));
+	ASSERT_EQ(defmap->readMemory(0x10), parentval);
+	ASSERT_EQ(child->mapper->readMemory(0x10), state.mapper.ram[0x10]);
+	ASSERT_EQ(child->cpu.progcount, state.cpu.progcount);
+	TEARDOWN_CPUEMU;
+}
@@ -0,0 +1,112 @@
+#include "Emulator.h"
+#include "Test.h"
+#include "Helpers.h"
+#include "Instructions.h"
+
+#define FUSIONTEST FusionTest
+
+#define INIT_CPUEMU \
+	CREATE_DEFMAP; \
+	emu::CPU cpu; \
+	emu::initializeCPU(cpu); \
+	emu::Emulator2A03 cpuemu(*defmap, cpu); \
+	ASSERT_EQ(cpuemu.setDispatch(emu::Dispatch::BLOCK), emu::Dispatch::BLOCK); \
+	cpu.progcount = 0x8000; \
+	writePatternToMem(*defmap, fusionProgram, sizeof(fusionProgram), 0x8000);
+
+#define TEARDOWN_CPUEMU \
+	TEARDOWN_DEFMAP;
+
+//Ticks covering several passes of fusionProgram
+#define BUDGETS 4000
+
+/* Every fused pair at least once, then loops counting X and Y down and up. */
+static OPCODE fusionProgram[] = {
+	OP_LDA | AMODE_IMMED, 0x05,
+	OP_STA | AMODE_ZPAGE, 0x10,
+	OP_LDA | AMODE_IMMED, 0x07,
+	OP_STA | AMODE_ABS, 0x00, 0x03,
+	OP_LDA | AMODE_ZPAGE, 0x10,
+	OP_STA | AMODE_ZPAGE, 0x11,
+	OP_LDA | AMODE_ABS, 0x00, 0x03,
+	OP_STA | AMODE_ABS, 0x01, 0x03,
+	OP_CLC,
+	OP_ADC | AMODE_IMMED, 0x03,
+	OP_CLC,
+	OP_ADC | AMODE_ZPAGE, 0x10,
+	OP_SEC,
+	OP_SBC | AMODE_IMMED, 0x01,
+	OP_SEC,
+	OP_SBC | AMODE_ZPAGE, 0x11,
+	OP_STA | AMODE_ZPAGE, 0x12,
+	OP_TAX,
+	OP_TAY,
+	OP_DEX,							//$8023
+	OP_BNE, 0x03,
+	OP_JMPABS, 0x2C, 0x80,
+	OP_JMPABS, 0x23, 0x80,
+	OP_DEY,							//$802C
+	OP_BNE, 0x03,
+	OP_JMPABS, 0x35, 0x80,
+	OP_JMPABS, 0x2C, 0x80,
+	OP_INX,							//$8035
+	OP_BNE, 0x03,
+	OP_JMPABS, 0x3E, 0x80,
+	OP_JMPABS, 0x35, 0x80,
+	OP_INY,							//$803E
+	OP_BNE, 0x03,
+	OP_JMPABS, 0x47, 0x80,
+	OP_JMPABS, 0x3E, 0x80,
+	OP_DEX,							//$8047
+	OP_BPL, 0x03,
+	OP_JMPABS, 0x50, 0x80,
+	OP_KIL0, OP_NOP, OP_NOP,
+	OP_DEY,							//$8050
+	OP_BPL, 0x03,
+	OP_JMPABS, 0x00, 0x80,
+	OP_KIL0
+};
+
+/* Fused pairs leave the results of their opcodes run one after the other. */
+TEST(FUSIONTEST, RESULTTEST) {
+	INIT_CPUEMU;
+	cpuemu.emulate_cpu(100000);
+
+	ASSERT_EQ(cpuemu.getErrorState(), emu::ERROR_STATE::NONE);
+	ASSERT_EQ(defmap->readMemory(0x10), 0x05);
+	ASSERT_EQ(defmap->readMemory(0x11), 0x05);
+	ASSERT_EQ(defmap->readMemory(0x0300), 0x07);
+	ASSERT_EQ(defmap->readMemory(0x0301), 0x07);
+	//7 + 3 + 5 - 1 - 5, less the carry SBC subtracts in this core
+	ASSERT_EQ(defmap->readMemory(0x12), 0x07);
+	TEARDOWN_CPUEMU;
+}
+
+/* Budgets ending between the opcodes of a pair leave the same ticks and state as stepping. */
+TEST(FUSIONTEST, TICKTEST) {
+	INIT_CPUEMU;
+	emu::CPU start = cpuemu.getCopyCPU();
+
+	for (int budget = 1; budget < BUDGETS; budget += 3) {
+		cpuemu.setCPU(start);
+		int left = cpuemu.emulate_cpu(budget);
+		emu::CPU run = cpuemu.getCopyCPU();
+
+		//One opcode at a time, by the reference dispatch
+		cpuemu.setDispatch(emu::Dispatch::SWITCH);
+		cpuemu.setCPU(start);
+		int stepped = budget;
+		while (stepped > 0)
+			stepped += cpuemu.emulate_cpu(1) - 1;
+		cpuemu.setDispatch(emu::Dispatch::BLOCK);
+
+		ASSERT_EQ(left, stepped);
+		ASSERT_EQ(run.progcount, cpu.progcount);
+		ASSERT_EQ(run.accumulator.unsigned8, cpu.accumulator.unsigned8);
+		ASSERT_EQ(run.xindex.unsigned8, cpu.xindex.unsigned8);
+		ASSERT_EQ(run.yindex.unsigned8, cpu.yindex.unsigned8);
+		ASSERT_EQ(run.procstat, cpu.procstat);
+	}
+	ASSERT_EQ(cpuemu.getErrorState(), emu::ERROR_STATE::NONE);
+	TEARDOWN_CPUEMU;
+}
@@ -0,0 +1,88 @@
+#include "Emulator.h"
+#include "Test.h"
+#include "Helpers.h"
+#include "Instructions.h"
+
+#define IDLELOOPTEST IdleLoopTest
+
+#define INIT_CPUEMU \
+	CREATE_DEFMAP; \
+	emu::CPU cpu; \
+	emu::initializeCPU(cpu); \
+	emu::Emulator2A03 cpuemu(*defmap, cpu); \
+	cpu.progcount = 0x8000; \
+	defmap->writeMemory(POLLADDR, 0); \
+	writePatternToMem(*defmap, idleProgram, sizeof(idleProgram), 0x8000);
+
+#define TEARDOWN_CPUEMU \
+	TEARDOWN_DEFMAP;
+
+//Zero page byte the loop polls, and where the loop leaves to
+#define POLLADDR 0x10
+#define EXITADDR 0x8007
+
+/* Polls POLLADDR until its top bit is set. */
+static OPCODE idleProgram[] = {
+	OP_LDA | AMODE_ZPAGE, POLLADDR,
+	OP_BMI, 0x03,
+	OP_JMPABS, 0x00, 0x80,
+	OP_INX,
+	OP_JMPABS, 0x07, 0x80
+};
+
+/* Skipping passes leaves the same ticks and state as running them one opcode at a time. */
+TEST(IDLELOOPTEST, EXACTTEST) {
+	INIT_CPUEMU;
+	for (int budget = 1; budget < 400; budget += 7) {
+		cpu.progcount = 0x8000;
+		int left = cpuemu.emulate_cpu(budget);
+		emu::CPU run = cpuemu.getCopyCPU();
+
+		cpu.progcount = 0x8000;
+		int stepped = budget;
+		while (stepped > 0)
+			stepped += cpuemu.emulate_cpu(1) - 1;
+
+		ASSERT_EQ(left, stepped);
+		ASSERT_EQ(run.progcount, cpu.progcount);
+		ASSERT_EQ(run.accumulator.unsigned8, cpu.accumulator.unsigned8);
+		ASSERT_EQ(run.procstat, cpu.procstat);
+	}
+	TEARDOWN_CPUEMU;
+}
+
+/* A budget of a billion ticks spent in an idle loop runs almost none of its passes. */
+TEST(IDLELOOPTEST, SKIPTEST) {
+	INIT_CPUEMU;
+	const int pass = emu::OPTICK[OP_LDA | AMODE_ZPAGE] + emu::OPTICK[OP_BMI] + emu::OPTICK[OP_JMPABS];
+	const int budget = 1000000000;
+	int left = cpuemu.emulate_cpu(budget);
+
+	ASSERT_LE(left, 0);
+	ASSERT_GT(left, -pass);
+	ASSERT_LT(cpu.progcount, EXITADDR);
+	//Not one pass in a hundred is run
+	uint64_t passes = (uint64_t)(budget - left) / pass;
+	ASSERT_GE(cpuemu.getIdleSkips(), passes - passes / 100);
+	ASSERT_LE(cpuemu.getIdleSkips(), passes);
+	TEARDOWN_CPUEMU;
+}
+
+/* The loop is left as soon as what it polls changes, and loops that do work are never skipped. */
+TEST(IDLELOOPTEST, EXITTEST) {
+	INIT_CPUEMU;
+	cpuemu.emulate_cpu(100000);
+	defmap->writeMemory(POLLADDR, 0x80);
+
+	//One pass to see the change, then 100 passes of INX/JMPABS
+	cpu.progcount = 0x8000;
+	cpu.xindex.unsigned8 = 0;
+	uint64_t skips = cpuemu.getIdleSkips();
+	int left = cpuemu.emulate_cpu(emu::OPTICK[OP_LDA | AMODE_ZPAGE] + emu::OPTICK[OP_BMI] +
+		100 * (emu::OPTICK[OP_INX] + emu::OPTICK[OP_JMPABS]));
+	ASSERT_EQ(left, 0);
+	ASSERT_EQ(cpu.xindex.unsigned8, 100);
+	ASSERT_EQ(cpu.progcount, EXITADDR);
+	ASSERT_EQ(cpuemu.getIdleSkips(), skips);
+	TEARDOWN_CPUEMU;
+}
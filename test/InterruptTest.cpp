@@ -0,0 +1,149 @@
+#include "Emulator.h"
+#include "Test.h"
+#include "Helpers.h"
+#include "Instructions.h"
+
+#define INTERRUPTTEST InterruptTest
+
+#define INIT_CPUEMU \
+	CREATE_DEFMAP; \
+	emu::CPU cpu; \
+	emu::initializeCPU(cpu); \
+	emu::Emulator2A03 cpuemu(*defmap, cpu); \
+	cpu.progcount = 0x8000; \
+	writePatternToMem(*defmap, mainProgram, sizeof(mainProgram), 0x8000); \
+	writePatternToMem(*defmap, handlerProgram, sizeof(handlerProgram), 0x9000); \
+	writePatternToMem(*defmap, vectors, sizeof(vectors), L_NMIHNDL);
+
+#define TEARDOWN_CPUEMU \
+	TEARDOWN_DEFMAP;
+
+//Longest opcode, the most an interrupt can wait after its event
+#define MAX_OPTICK 7
+
+/* Counts X in a loop at $8000, and at $8100 unmasks IRQs then spins. */
+static OPCODE mainProgram[] = {
+	OP_INX,
+	OP_JMPABS, 0x00, 0x80
+};
+
+static OPCODE unmaskProgram[] = {
+	OP_CLI,
+	OP_JMPABS, 0x01, 0x81
+};
+
+/* NMI counts Y, clears carry and returns, IRQ counts Y forever at $9010. */
+static OPCODE handlerProgram[] = {
+	OP_INY,
+	OP_CLC,
+	OP_RTI,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	OP_INY,
+	OP_JMPABS, 0x10, 0x90
+};
+
+static OPCODE vectors[] = {
+	0x00, 0x90,
+	0x00, 0x80,
+	0x10, 0x90
+};
+
+/* An NMI is taken once per raise, and RTI returns to the loop it interrupted with the flags
+ * it had. */
+TEST(INTERRUPTTEST, NMITEST) {
+	INIT_CPUEMU;
+	SETF_CARRY(cpu.procstat, 1);
+	cpuemu.emulate_cpu(100);
+	cpuemu.raiseInterrupt(INT_NMI);
+	cpuemu.emulate_cpu(1000);
+
+	ASSERT_EQ(cpuemu.getErrorState(), emu::ERROR_STATE::NONE);
+	ASSERT_EQ(cpu.yindex.unsigned8, 1);
+	ASSERT_EQ(cpuemu.getPendingInterrupts(), 0u);
+	ASSERT_EQ(cpu.stackp.unsigned8, 0xFF);
+	ASSERT_LT(cpu.progcount, 0x8004);
+	ASSERT_TRUE(F_CARRY(cpu.procstat));
+	ASSERT_FALSE(F_INTDIS(cpu.procstat));
+	TEARDOWN_CPUEMU;
+}
+
+/* RTI pops P, then PC, from the slots BRK and interrupts push them to. */
+TEST(INTERRUPTTEST, RTITEST) {
+	INIT_CPUEMU;
+	writeOpToMem(*defmap, OP_RTI, 0x8100);
+	cpu.progcount = 0x8100;
+	BYTE psw = 0;
+	SETF_CARRY(psw, 1);
+	SETF_OVRFLOW(psw, 1);
+	defmap->writeMemory(L_STACKT + 0xFF, 0x00);
+	defmap->writeMemory(L_STACKT + 0xFE, 0x80);
+	defmap->writeMemory(L_STACKT + 0xFD, psw);
+	cpu.stackp.unsigned8 = 0xFC;
+	SETF_INTDIS(cpu.procstat, 1);
+	cpuemu.emulate_cpu(emu::OPTICK[OP_RTI]);
+
+	ASSERT_EQ(cpu.progcount, 0x8000);
+	ASSERT_EQ(cpu.stackp.unsigned8, 0xFF);
+	ASSERT_TRUE(F_CARRY(cpu.procstat));
+	ASSERT_TRUE(F_OVRFLOW(cpu.procstat));
+	ASSERT_FALSE(F_INTDIS(cpu.procstat));
+	ASSERT_FALSE(F_ZERO(cpu.procstat));
+	TEARDOWN_CPUEMU;
+}
+
+/* An IRQ waits while the I flag is set and stays pending until its line is cleared. */
+TEST(INTERRUPTTEST, IRQTEST) {
+	INIT_CPUEMU;
+	SETF_INTDIS(cpu.procstat, 1);
+	cpuemu.raiseInterrupt(INT_IRQ_MAPPER);
+	cpuemu.emulate_cpu(1000);
+	ASSERT_EQ(cpu.yindex.unsigned8, 0);
+	ASSERT_LT(cpu.progcount, 0x8004);
+
+	SETF_INTDIS(cpu.procstat, 0);
+	cpuemu.emulate_cpu(1000);
+	ASSERT_GT(cpu.yindex.unsigned8, 0);
+	ASSERT_GE(cpu.progcount, 0x9010);
+	ASSERT_TRUE(F_INTDIS(cpu.procstat));
+	ASSERT_EQ(cpuemu.getPendingInterrupts(), (uint32_t)INT_IRQ_MAPPER);
+
+	//P with B and I clear, then PC in the order BRK pushes it
+	BYTE psw = defmap->readMemory(L_STACKT + 0xFD);
+	ASSERT_FALSE(F_BRKCMD(psw));
+	ASSERT_FALSE(F_INTDIS(psw));
+	ASSERT_EQ(defmap->readMemory(L_STACKT + 0xFE), 0x80);
+	ASSERT_LT(defmap->readMemory(L_STACKT + 0xFF), 0x04);
+
+	cpuemu.clearInterrupt(INT_IRQ_MAPPER);
+	ASSERT_EQ(cpuemu.getPendingInterrupts(), 0u);
+	TEARDOWN_CPUEMU;
+}
+
+/* An IRQ unmasked by CLI is taken right after it, or after the JMP ending its block when
+ * blocks are cached. */
+TEST(INTERRUPTTEST, UNMASKTEST) {
+	INIT_CPUEMU;
+	writePatternToMem(*defmap, unmaskProgram, sizeof(unmaskProgram), 0x8100);
+	cpu.progcount = 0x8100;
+	SETF_INTDIS(cpu.procstat, 1);
+	cpuemu.raiseInterrupt(INT_IRQ_FRAME);
+	cpuemu.emulate_cpu(emu::OPTICK[OP_CLI] + emu::OPTICK[OP_JMPABS] + INT_TICKS + emu::OPTICK[OP_INY]);
+	ASSERT_GT(cpu.yindex.unsigned8, 0);
+	ASSERT_GE(cpu.progcount, 0x9010);
+	TEARDOWN_CPUEMU;
+}
+
+/* An NMI raised by a scheduled event is taken at the event, and costs INT_TICKS. */
+TEST(INTERRUPTTEST, EVENTTEST) {
+	INIT_CPUEMU;
+	uint64_t taken = 0;
+	cpuemu.getScheduler().schedule(1000, [&](uint64_t) {
+		cpuemu.raiseInterrupt(INT_NMI);
+		taken = cpuemu.getCycleCount();
+	});
+	int left = cpuemu.emulate_cpu(1000 + MAX_OPTICK + INT_TICKS + emu::OPTICK[OP_INY]);
+	ASSERT_EQ(cpu.yindex.unsigned8, 1);
+	ASSERT_LT(taken, (uint64_t)(1000 + MAX_OPTICK));
+	ASSERT_EQ(cpuemu.getCycleCount(), (uint64_t)(1000 + MAX_OPTICK + INT_TICKS + emu::OPTICK[OP_INY] - left));
+	TEARDOWN_CPUEMU;
+}
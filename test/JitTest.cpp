@@ -0,0 +1,93 @@
+#include "Emulator.h"
+#include "Test.h"
+#include "Helpers.h"
+#include "Instructions.h"
+#include <random>
+#include <vector>
+
+#define JITTEST JitTest
+
+#define PROGRAMS 32
+#define CHUNKS 200
+
+/* Opcodes a generated program is built from, with their operand count. */
+static const struct { OPCODE code; int operands; } jitOps[] = {
+	{ OP_LDA | AMODE_IMMED, 1 }, { OP_ORA | AMODE_IMMED, 1 }, { OP_AND | AMODE_IMMED, 1 },
+	{ OP_EOR | AMODE_IMMED, 1 }, { OP_ADC | AMODE_IMMED, 1 }, { OP_SBC | AMODE_IMMED, 1 },
+	{ OP_CMP | AMODE_IMMED, 1 }, { OP_LDA | AMODE_ZPAGE, 1 }, { OP_ORA | AMODE_ZPAGE, 1 },
+	{ OP_AND | AMODE_ZPAGE, 1 }, { OP_EOR | AMODE_ZPAGE, 1 }, { OP_ADC | AMODE_ZPAGE, 1 },
+	{ OP_STA | AMODE_ZPAGE, 1 }, { OP_STA | AMODE_ZPAGE, 1 },
+	{ OP_INX, 0 }, { OP_INY, 0 }, { OP_DEX, 0 }, { OP_DEY, 0 }, { OP_TAX, 0 }, { OP_TAY, 0 },
+	{ OP_TXA, 0 }, { OP_TYA, 0 }, { OP_CLC, 0 }, { OP_SEC, 0 }, { OP_CLV, 0 }, { OP_NOP, 0 },
+	{ OP_PHA, 0 }, { OP_PLA, 0 }, { OP_PHP, 0 }, { OP_PLP, 0 },
+	{ OP_BEQ, 1 }, { OP_BMI, 1 }
+};
+
+/* A random loop at $8000. Zero page operands stay in $00-$1F; branches skip one 2 byte opcode. */
+static std::vector<OPCODE> randomProgram(std::mt19937& rng)
+{
+	std::vector<OPCODE> program;
+	int length = 8 + rng() % 40;
+	for (int i = 0; i < length; i++) {
+		int pick = rng() % (sizeof(jitOps) / sizeof(jitOps[0]));
+		program.push_back(jitOps[pick].code);
+		if ((jitOps[pick].code & 0x1F) == 0x10) {
+			program.push_back(2);
+			program.push_back(OP_LDA | AMODE_IMMED);
+			program.push_back(rng() & 0xFF);
+		}
+		else if (jitOps[pick].operands == 1)
+			program.push_back(rng() & 0x1F);
+	}
+	program.push_back(OP_JMPABS);
+	program.push_back(0x00);
+	program.push_back(0x80);
+	return program;
+}
+
+/* Load the test ROM with program at $8000 and cleared RAM. */
+static emu::Mapper* programMapper(std::vector<OPCODE>& program)
+{
+	emu::Mapper* mapper = NULL;
+	std::ifstream rom(TESTROM, std::ifstream::binary);
+	emu::Mapper::createMapper(rom, mapper);
+	for (int addr = 0; addr < SZ_RAM; addr++)
+		mapper->writeMemory(addr, 0);
+	writePatternToMem(*mapper, program.data(), static_cast<int>(program.size()), 0x8000);
+	return mapper;
+}
+
+/* Whole budgets (translated once hot) and single opcodes leave the same machine after
+ * every chunk. */
+TEST(JITTEST, LOCKSTEPTEST) {
+	std::mt19937 rng(0x2A03);
+	for (int p = 0; p < PROGRAMS; p++) {
+		std::vector<OPCODE> program = randomProgram(rng);
+		std::unique_ptr<emu::Machine> jit(new emu::Machine(programMapper(program), emu::CPU()));
+		std::unique_ptr<emu::Machine> step(new emu::Machine(programMapper(program), emu::CPU()));
+		emu::initializeCPU(jit->cpu);
+		jit->cpu.progcount = 0x8000;
+		step->cpu = jit->cpu;
+		if (jit->emulator.setDispatch(emu::Dispatch::JIT) != emu::Dispatch::JIT)
+			GTEST_SKIP() << "No JIT on this host";
+		step->emulator.setDispatch(emu::Dispatch::SWITCH);
+
+		for (int chunk = 0; chunk < CHUNKS; chunk++) {
+			int budget = 1 + rng() % 300;
+			int left = jit->emulator.emulate_cpu(budget);
+			int stepped = budget;
+			while (stepped > 0)
+				stepped += step->emulator.emulate_cpu(1) - 1;
+
+			ASSERT_EQ(left, stepped);
+			ASSERT_EQ(jit->cpu.progcount, step->cpu.progcount);
+			ASSERT_EQ(jit->cpu.accumulator.unsigned8, step->cpu.accumulator.unsigned8);
+			ASSERT_EQ(jit->cpu.xindex.unsigned8, step->cpu.xindex.unsigned8);
+			ASSERT_EQ(jit->cpu.yindex.unsigned8, step->cpu.yindex.unsigned8);
+			ASSERT_EQ(jit->cpu.stackp.unsigned8, step->cpu.stackp.unsigned8);
+			ASSERT_EQ(jit->cpu.procstat, step->cpu.procstat);
+		}
+		for (int addr = 0; addr < 0x200; addr++)
+			ASSERT_EQ(jit->mapper->readMemory(addr), step->mapper->readMemory(addr));
+	}
+}
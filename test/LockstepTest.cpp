@@ -0,0 +1,287 @@
+#include "Lockstep.h"
+#include "Test.h"
+#include "Helpers.h"
+#include "Instructions.h"
+#include <chrono>
+#include <climits>
+#include <thread>
+
+#define LOCKSTEPTEST LockstepTest
+
+#define LANES 40
+//How long the tests leave another thread running before acting on it
+#define SETTLE_MS 20
+
+/* Loop mixing vector kernels, a divergent branch and peeled stack ops. */
+static OPCODE lockstepProgram[] = {
+	OP_LDA | AMODE_ZPAGE, 0x10,		//8000
+	OP_ADC | AMODE_IMMED, 0x37,		//8002
+	OP_CMP | AMODE_IMMED, 0x80,		//8004
+	OP_BCS, 0x02,					//8006 -> 800A
+	OP_EOR | AMODE_IMMED, 0xFF,		//8008
+	OP_SBC | AMODE_IMMED, 0x11,		//800A
+	OP_TAX,							//800C
+	OP_INX,							//800D
+	OP_DEY,							//800E
+	OP_TYA,							//800F
+	OP_ORA | AMODE_ZPAGEX, 0x20,	//8010
+	OP_AND | AMODE_ABS, 0x00, 0x03,	//8012
+	OP_AND | AMODE_ABSY, 0x00, 0x03,//8015
+	OP_STA | AMODE_ZPAGE, 0x10,		//8018
+	OP_PHA,							//801A
+	OP_PLA,							//801B
+	OP_BMI, 0x01,					//801C -> 801F
+	OP_SEC,							//801E
+	OP_JMPABS, 0x00, 0x80			//801F
+};
+
+/* Loop the lanes run together without ever leaving the vector kernels. */
+static OPCODE vectorLoop[] = {
+	OP_INX,							//8000
+	OP_JMPABS, 0x00, 0x80			//8001
+};
+
+/* Create a mapper holding lockstepProgram and RAM seeded by seed. */
+static emu::Mapper* createLaneMapper(int seed)
+{
+	emu::Mapper* defmap = NULL;
+	std::ifstream rom(TESTROM, std::ifstream::binary);
+	emu::Mapper::createMapper(rom, defmap);
+	writePatternToMem(*defmap, lockstepProgram, sizeof(lockstepProgram), 0x8000);
+	for (int addr = 0; addr < 0x400; addr++)
+		defmap->writeMemory(addr, static_cast<BYTE>(seed * 7 + addr * 13));
+	return defmap;
+}
+
+/* Every lane ends in the same state as the scalar core running alone. */
+TEST(LOCKSTEPTEST, EQUIVALENCETEST) {
+	std::ifstream rom(TESTROM, std::ifstream::binary);
+	if (!rom.is_open()) FAIL();
+
+	emu::LockstepGroup lockstep;
+	std::vector<emu::Mapper*> refmaps;
+	std::vector<emu::CPU> refcpus(LANES);
+	for (int lane = 0; lane < LANES; lane++) {
+		emu::CPU cpu;
+		emu::initializeCPU(cpu);
+		cpu.progcount = 0x8000;
+		cpu.yindex.unsigned8 = static_cast<BYTE>(lane);
+		lockstep.addLane(createLaneMapper(lane), cpu);
+		refmaps.push_back(createLaneMapper(lane));
+		refcpus[lane] = cpu;
+	}
+
+	for (int run = 0; run < 5; run++) {
+		lockstep.run(5000);
+		for (int lane = 0; lane < LANES; lane++) {
+			emu::Emulator2A03 ref(*refmaps[lane], refcpus[lane]);
+			int left = ref.emulate_cpu(5000);
+			emu::CPU cpu = lockstep.getCopyCPU(lane);
+
+			ASSERT_EQ(lockstep.getTicksRemaining(lane), left);
+			ASSERT_EQ(cpu.progcount, refcpus[lane].progcount);
+			ASSERT_EQ(cpu.accumulator.unsigned8, refcpus[lane].accumulator.unsigned8);
+			ASSERT_EQ(cpu.xindex.unsigned8, refcpus[lane].xindex.unsigned8);
+			ASSERT_EQ(cpu.yindex.unsigned8, refcpus[lane].yindex.unsigned8);
+			ASSERT_EQ(cpu.stackp.unsigned8, refcpus[lane].stackp.unsigned8);
+			ASSERT_EQ(cpu.procstat, refcpus[lane].procstat);
+			ASSERT_EQ(lockstep.getMapper(lane).getMemory()[0x10], refmaps[lane]->getMemory()[0x10]);
+			ASSERT_EQ(lockstep.getErrorState(lane), emu::NONE);
+		}
+	}
+
+	emu::LockstepCounters counters = lockstep.getCounters();
+	ASSERT_GT(counters.vectorsteps, 0u);
+	ASSERT_GT(counters.vectorlanes, counters.vectorsteps);
+	ASSERT_GT(counters.scalarsteps, 0u);
+
+	for (auto refmap : refmaps)
+		delete refmap;
+}
+
+/* A lane that locks the CPU stops without holding back the others. */
+TEST(LOCKSTEPTEST, ERRORTEST) {
+	std::ifstream rom(TESTROM, std::ifstream::binary);
+	if (!rom.is_open()) FAIL();
+
+	emu::LockstepGroup lockstep;
+	emu::CPU cpu;
+	emu::initializeCPU(cpu);
+	cpu.progcount = 0x8000;
+	for (int lane = 0; lane < 3; lane++)
+		lockstep.addLane(createLaneMapper(lane), cpu);
+	writeOpToMem(lockstep.getMapper(1), OP_KIL0, 0x800C);
+
+	lockstep.run(1000);
+	ASSERT_EQ(lockstep.getErrorState(1), emu::CPU_LOCK);
+	ASSERT_EQ(lockstep.getCopyCPU(1).progcount, 0x800D);
+	ASSERT_GT(lockstep.getTicksRemaining(1), 0);
+	ASSERT_EQ(lockstep.getErrorState(0), emu::NONE);
+	ASSERT_LE(lockstep.getTicksRemaining(0), 0);
+	ASSERT_LE(lockstep.getTicksRemaining(2), 0);
+}
+
+/* Create a group of lanes running vectorLoop. */
+static void createLoopLanes(emu::LockstepGroup& lockstep, int count)
+{
+	emu::CPU cpu;
+	emu::initializeCPU(cpu);
+	cpu.progcount = 0x8000;
+	for (int lane = 0; lane < count; lane++) {
+		int index = lockstep.addLane(createLaneMapper(lane), cpu);
+		writePatternToMem(lockstep.getMapper(index), vectorLoop, sizeof(vectorLoop), 0x8000);
+	}
+}
+
+/* A lane stopped before the run sits it out, and the others run together. */
+TEST(LOCKSTEPTEST, STOPTEST) {
+	emu::LockstepGroup lockstep;
+	createLoopLanes(lockstep, 3);
+	lockstep.getEmulator(1).stopEmulation();
+	lockstep.run(100000);
+
+	ASSERT_EQ(lockstep.getTicksRemaining(1), 100000);
+	ASSERT_EQ(lockstep.getCopyCPU(1).progcount, 0x8000);
+	ASSERT_LE(lockstep.getTicksRemaining(0), 0);
+	ASSERT_LE(lockstep.getTicksRemaining(2), 0);
+	ASSERT_EQ(lockstep.getCounters().scalarsteps, 0u);
+
+	//The stop was taken; the next run runs every lane
+	lockstep.run(1000);
+	ASSERT_LE(lockstep.getTicksRemaining(1), 0);
+}
+
+/* Stops from another thread reach lanes that never leave the vector kernels. */
+TEST(LOCKSTEPTEST, THREADSTOPTEST) {
+	emu::LockstepGroup lockstep;
+	createLoopLanes(lockstep, 3);
+	std::thread runner([&] { lockstep.run(INT_MAX); });
+	std::this_thread::sleep_for(std::chrono::milliseconds(SETTLE_MS));
+	for (int lane = 0; lane < 3; lane++)
+		lockstep.getEmulator(lane).stopEmulation();
+	runner.join();
+
+	for (int lane = 0; lane < 3; lane++)
+		ASSERT_GT(lockstep.getTicksRemaining(lane), 0);
+}
+
+/* A shared pause holds the group until a stop wakes it. */
+TEST(LOCKSTEPTEST, PAUSETEST) {
+	emu::LockstepGroup lockstep;
+	createLoopLanes(lockstep, 3);
+	emu::RunControl shared;
+	for (int lane = 0; lane < 3; lane++)
+		lockstep.getEmulator(lane).setRunControl(&shared);
+	shared.pause();
+	std::thread runner([&] { lockstep.run(10000); });
+	std::this_thread::sleep_for(std::chrono::milliseconds(SETTLE_MS));
+	for (int lane = 0; lane < 3; lane++)
+		lockstep.getEmulator(lane).stopEmulation();
+	runner.join();
+
+	for (int lane = 0; lane < 3; lane++) {
+		ASSERT_EQ(lockstep.getTicksRemaining(lane), 10000);
+		ASSERT_EQ(lockstep.getCopyCPU(lane).xindex.unsigned8, 0);
+	}
+	shared.resume();
+	lockstep.run(1000);
+	ASSERT_NE(lockstep.getCopyCPU(0).xindex.unsigned8, 0);
+}
+
+/* Lanes kept in lockstep count their cycles and run their events on the tick the scalar core does. */
+TEST(LOCKSTEPTEST, SCHEDULERTEST) {
+	std::ifstream rom(TESTROM, std::ifstream::binary);
+	if (!rom.is_open()) FAIL();
+
+	emu::LockstepGroup lockstep;
+	createLoopLanes(lockstep, 3);
+	uint64_t fired[3] = { 0, 0, 0 };
+	for (int lane = 0; lane < 3; lane++) {
+		emu::Emulator2A03& emulator = lockstep.getEmulator(lane);
+		emulator.getScheduler().schedule(1000 + lane, [&fired, &emulator, lane](uint64_t) { fired[lane] = emulator.getCycleCount(); });
+	}
+	lockstep.run(5000);
+	ASSERT_EQ(lockstep.getCounters().scalarsteps, 0u);
+
+	for (int lane = 0; lane < 3; lane++) {
+		emu::Mapper* refmap = createLaneMapper(lane);
+		writePatternToMem(*refmap, vectorLoop, sizeof(vectorLoop), 0x8000);
+		emu::CPU cpu;
+		emu::initializeCPU(cpu);
+		cpu.progcount = 0x8000;
+		emu::Emulator2A03 ref(*refmap, cpu);
+		uint64_t reffired = 0;
+		ref.getScheduler().schedule(1000 + lane, [&](uint64_t) { reffired = ref.getCycleCount(); });
+		int left = ref.emulate_cpu(5000);
+
+		ASSERT_EQ(lockstep.getTicksRemaining(lane), left);
+		ASSERT_EQ(lockstep.getEmulator(lane).getCycleCount(), ref.getCycleCount());
+		ASSERT_EQ(fired[lane], reffired);
+		ASSERT_GE(fired[lane], 1000u + lane);
+		delete refmap;
+	}
+}
+
+/* An NMI raised by an event reaches every lane of a group that never leaves the vector kernels. */
+TEST(LOCKSTEPTEST, INTERRUPTTEST) {
+	//NMI handler counting Y forever, and the vector to it
+	OPCODE handler[] = { OP_INY, OP_JMPABS, 0x00, 0x90 };
+	OPCODE vector[] = { 0x00, 0x90 };
+
+	emu::LockstepGroup lockstep;
+	createLoopLanes(lockstep, 3);
+	BYTE stackp = lockstep.getCopyCPU(0).stackp.unsigned8;
+	for (int lane = 0; lane < 3; lane++) {
+		writePatternToMem(lockstep.getMapper(lane), handler, sizeof(handler), 0x9000);
+		writePatternToMem(lockstep.getMapper(lane), vector, sizeof(vector), L_NMIHNDL);
+		emu::Emulator2A03& emulator = lockstep.getEmulator(lane);
+		emulator.getScheduler().schedule(200, [&emulator](uint64_t) { emulator.raiseInterrupt(INT_NMI); });
+	}
+	lockstep.run(1000);
+
+	for (int lane = 0; lane < 3; lane++) {
+		emu::CPU cpu = lockstep.getCopyCPU(lane);
+		ASSERT_GE(cpu.progcount, 0x9000);
+		ASSERT_LT(cpu.progcount, 0x9004);
+		ASSERT_GT(cpu.yindex.unsigned8, 0);
+		ASSERT_EQ(cpu.stackp.unsigned8, (BYTE)(stackp - 3));
+		ASSERT_EQ(lockstep.getEmulator(lane).getPendingInterrupts(), 0u);
+	}
+	//The handler runs in lockstep again
+	ASSERT_LT(lockstep.getCounters().scalarsteps, 10u);
+}
+
+/* Lanes on a strict mapper fault on the opcode refused its read, as the scalar core does. */
+TEST(LOCKSTEPTEST, FAULTTEST) {
+	std::ifstream rom(TESTROM, std::ifstream::binary);
+	if (!rom.is_open()) FAIL();
+	//Reads the write-only OAM DMA register, from RAM as a strict mapper refuses writes to PRG-ROM
+	OPCODE program[] = { OP_INX, OP_LDA | AMODE_ABS, 0x14, 0x40, OP_JMPABS, 0x00, 0x03 };
+
+	emu::LockstepGroup lockstep;
+	emu::CPU cpu;
+	emu::initializeCPU(cpu);
+	cpu.progcount = 0x0300;
+	for (int lane = 0; lane < 4; lane++) {
+		emu::Mapper* mapper = NULL;
+		rom.clear();
+		rom.seekg(0);
+		emu::Mapper::createMapper(rom, mapper, lane < 2 ? emu::Enforcement::STRICT : emu::Enforcement::FAST);
+		writePatternToMem(*mapper, program, sizeof(program), 0x0300);
+		lockstep.addLane(mapper, cpu);
+	}
+	lockstep.run(1000);
+
+	for (int lane = 0; lane < 2; lane++) {
+		ASSERT_EQ(lockstep.getErrorState(lane), emu::BAD_READ);
+		ASSERT_EQ(lockstep.getEmulator(lane).getFaultAddress(), 0x4014);
+		ASSERT_EQ(lockstep.getEmulator(lane).getFaultPC(), 0x0301);
+		ASSERT_EQ(lockstep.getCopyCPU(lane).progcount, 0x0301);
+		ASSERT_EQ(lockstep.getCopyCPU(lane).xindex.unsigned8, 1);
+	}
+	for (int lane = 2; lane < 4; lane++) {
+		ASSERT_EQ(lockstep.getErrorState(lane), emu::NONE);
+		ASSERT_LE(lockstep.getTicksRemaining(lane), 0);
+	}
+	ASSERT_GT(lockstep.getCounters().vectorsteps, 0u);
+}
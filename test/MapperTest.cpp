@@ -1,6 +1,5 @@
-#define IGNORE_STACK_MIRROR
-
 #include "Mapper.h"
+#include "RomCache.h"
 #include "Test.h"
 
 
@@ -14,14 +13,14 @@ TEST(MapperTest, initTest) {
 	CREATE_DEFMAP;
 
 	//Check beg and end
-	EXPECT_EQ(defmap->getMemory()[L_PRGROM], 0x20);
-	EXPECT_EQ(defmap->getMemory()[L_PRGROM + 0x20], 0x01);
-	EXPECT_EQ(defmap->getMemory()[L_PRGROM + SZ_PRGROM_BLOCK - 1], 0xFF);
+	EXPECT_EQ(defmap->readMemory(L_PRGROM), 0x20);
+	EXPECT_EQ(defmap->readMemory(L_PRGROM + 0x20), 0x01);
+	EXPECT_EQ(defmap->readMemory(L_PRGROM + SZ_PRGROM_BLOCK - 1), 0xFF);
 
 	//Check mirror
-	EXPECT_EQ(defmap->getMemory()[L_PRGROM + SZ_PRGROM_BLOCK], 0x20);
-	EXPECT_EQ(defmap->getMemory()[L_PRGROM + SZ_PRGROM_BLOCK + 0x20], 0x01);
-	EXPECT_EQ(defmap->getMemory()[L_PRGROM + SZ_PRGROM_BLOCK * 2 - 1], 0xFF);
+	EXPECT_EQ(defmap->readMemory(L_PRGROM + SZ_PRGROM_BLOCK), 0x20);
+	EXPECT_EQ(defmap->readMemory(L_PRGROM + SZ_PRGROM_BLOCK + 0x20), 0x01);
+	EXPECT_EQ(defmap->readMemory(L_PRGROM + SZ_PRGROM_BLOCK * 2 - 1), 0xFF);
 
 	TEARDOWN_DEFMAP;
 }
@@ -35,27 +34,24 @@ TEST(DEFAULTMAPPERTEST, writeTest) {
 	defmap->writeMemory(addr, data);
 	ASSERT_EQ(defmap->getMemory()[L_ZPAGE], data);
 
-#ifdef ENFORCE_READONLY_STRICT
-	addr = 0x2002;
-	data = 5;
-	ASSERT_THROW(defmap->writeMemory(addr,data), emu::BadWriteException);
-#endif
-
-#ifdef ENFORCE_READONLY_MINIMUM
-	addr = 0x8002;
-	data = 95;
-	ASSERT_THROW(defmap->writeMemory(addr, data), emu::BadWriteException);
-#endif
-
-#ifdef ENFORCE_STACK_MIRROR
-	addr = 0x10;
+	//Writes to RAM mirrors land in the same 2 Kb of RAM
+	addr = 0x1810;
 	data = 15;
 	defmap->writeMemory(addr, data);
 	ASSERT_EQ(defmap->getMemory()[0x0010], data);
-	ASSERT_EQ(defmap->getMemory()[0x0810], data);
-	ASSERT_EQ(defmap->getMemory()[0x1010], data);
-	ASSERT_EQ(defmap->getMemory()[0x1810], data);
-#endif
+
+	//The stack page included, so every stack mirror shows a push
+	addr = 0x19FF;
+	data = 11;
+	defmap->writeMemory(addr, data);
+	ASSERT_EQ(defmap->readMemory(L_STACKT + 0xFF), data);
+	ASSERT_EQ(defmap->readMemory(L_STACKT + 0x08FF), data);
+
+	//Writes to PPU register mirrors land in the same 8 registers
+	addr = 0x3FFD;
+	data = 7;
+	defmap->writeMemory(addr, data);
+	ASSERT_EQ(reinterpret_cast<const emu::MapperMemory*>(defmap->getMemory())->ppuregs[5], data);
 
 	TEARDOWN_DEFMAP;
 }
@@ -72,7 +68,7 @@ TEST(DEFAULTMAPPERTEST, readTest) {
 	//Check if read is valid
 	ASSERT_EQ(defmap->readMemory(addr), data);
 
-#ifdef ENFORCE_STACK_MIRROR
+	//RAM is mirrored every 2 Kb
 	addr = 0x0025;
 	data = 15;
 	defmap->writeMemory(addr, data);
@@ -80,23 +76,209 @@ TEST(DEFAULTMAPPERTEST, readTest) {
 	ASSERT_EQ(defmap->readMemory(addr + 0x0800), data);
 	ASSERT_EQ(defmap->readMemory(addr + 0x1000), data);
 	ASSERT_EQ(defmap->readMemory(addr + 0x1800), data);
-#endif
 
-	//$STUB$ include ENFORCE_WRITEONLY_MINIMUM case
+	//PPU registers are mirrored every 8 bytes
+	addr = 0x2003;
+	data = 9;
+	defmap->writeMemory(addr, data);
+	ASSERT_EQ(defmap->readMemory(addr + 0x0008), data);
+	ASSERT_EQ(defmap->readMemory(addr + 0x1FF8), data);
+
+	TEARDOWN_DEFMAP;
+}
+
+
+TEST(DEFAULTMAPPERTEST, compactTest) {
+	CREATE_DEFMAP;
+
+	//One aligned block of a few Kb holds everything writable, and a saved state no more
+	ASSERT_LE(sizeof(emu::MapperMemory), 12u * 1024);
+	ASSERT_LE(sizeof(emu::MapperState), 12u * 1024);
+	ASSERT_EQ((uintptr_t)defmap->getMemory() % 64, 0u);
+
+	//SRAM holds 8 Kb
+	defmap->writeMemory(L_SRAM, 1);
+	defmap->writeMemory(L_SRAM + SZ_PRGRAM_BLOCK - 1, 2);
+	ASSERT_EQ(defmap->readMemory(L_SRAM), 1);
+	ASSERT_EQ(defmap->readMemory(L_SRAM + SZ_PRGRAM_BLOCK - 1), 2);
+
+	//The expansion area is an open bus, and writes to it leave the i/o registers alone
+	ASSERT_EQ(defmap->readMemory(L_JOYSTICK1), 0x80);
+	ASSERT_EQ(defmap->readMemory(L_JOYSTICK1 + 0x1000), 0);
+	BYTE dma = defmap->readMemory(0x4014), sound = defmap->readMemory(L_ENBLSND);
+	defmap->writeMemory(0x4034, dma + 9);
+	defmap->writeMemory(0x5015, sound + 9);
+	ASSERT_EQ(defmap->readMemory(0x4014), dma);
+	ASSERT_EQ(defmap->readMemory(L_ENBLSND), sound);
+	ASSERT_EQ(defmap->readMemory(0x4034), 0);
+	ASSERT_EQ(defmap->readMemory(L_EXPROM + SZ_EXPROM - 1), 0);
+	ASSERT_FALSE(defmap->hasFault());
+
+	TEARDOWN_DEFMAP;
+}
+
+
+TEST(DEFAULTMAPPERTEST, enforceTest) {
+	CREATE_DEFMAP;
+	ASSERT_EQ(defmap->getEnforcement(), emu::Enforcement::FAST);
+	defmap->writeMemory(0x2002, 5);
+	defmap->readMemory(0x4014);
+	ASSERT_FALSE(defmap->hasFault());
+
+	//A strict mapper of the same ROM refuses them, keeping the first, and so do its forks
+	emu::Mapper* strict = NULL;
+	rom.clear();
+	emu::Mapper::createMapper(rom, strict, emu::Enforcement::STRICT);
+	ASSERT_EQ(strict->getEnforcement(), emu::Enforcement::STRICT);
+	ASSERT_NE(dynamic_cast<emu::StrictMapper*>(strict), (emu::StrictMapper*)NULL);
+	BYTE rom8002 = strict->readMemory(0x8002);
+	strict->writeMemory(0x8002, 95);
+	strict->writeMemory(0x2002, 5);
+	ASSERT_EQ(strict->readMemory(0x8002), rom8002);
+	emu::MemoryFault fault = strict->takeFault();
+	ASSERT_EQ(fault.kind, emu::MemoryFault::BADWRITE);
+	ASSERT_EQ(fault.addr, 0x8002);
+	ASSERT_FALSE(strict->hasFault());
+
+	ASSERT_EQ(strict->readMemory(0x4014), 0);
+	fault = strict->takeFault();
+	ASSERT_EQ(fault.kind, emu::MemoryFault::BADREAD);
+	ASSERT_EQ(fault.addr, 0x4014);
+	strict->writeMemory(L_ZPAGE, 1);
+	ASSERT_FALSE(strict->hasFault());
+
+	//and refuses writes to the expansion area, which never reach the i/o registers
+	strict->writeMemory(0x5015, 9);
+	fault = strict->takeFault();
+	ASSERT_EQ(fault.kind, emu::MemoryFault::BADWRITE);
+	ASSERT_EQ(fault.addr, 0x5015);
+	ASSERT_EQ(strict->readMemory(L_EXPROM), 0);
+	ASSERT_FALSE(strict->hasFault());
+
+	emu::Mapper* child = strict->fork();
+	ASSERT_EQ(child->getEnforcement(), emu::Enforcement::STRICT);
+	child->writeMemory(0x8002, 95);
+	ASSERT_TRUE(child->hasFault());
+	ASSERT_FALSE(strict->hasFault());
+	delete child;
 
+	//Exceptions carry their message
+	emu::BadWriteException thrown(0x8002);
+	ASSERT_STREQ(thrown.what(), "Bad write from memory location 8002");
+	delete strict;
 	TEARDOWN_DEFMAP;
 }
 
 
 TEST(DEFAULTMAPPERTEST, pagecountTest) {
 	CREATE_DEFMAP;
-	ASSERT_EQ(defmap->getMemoryPageCount(), 0);
+	ASSERT_EQ(defmap->getMemoryPageCount(), 1);
 	TEARDOWN_DEFMAP;
 }
 
 
 TEST(DEFAULTMAPPERTEST, memorypageTest) {
 	CREATE_DEFMAP;
-	ASSERT_EQ(const_cast<BYTE**>(defmap->getMemoryPages()), (unsigned char** const)NULL);
+	ASSERT_NE(const_cast<BYTE**>(defmap->getMemoryPages()), (unsigned char** const)NULL);
+	ASSERT_EQ(defmap->getMemoryPages()[0][0], 0x20);
+
+	//Mappers of the same ROM share one copy of PRG-ROM
+	emu::Mapper* other = NULL;
+	rom.clear();
+	emu::Mapper::createMapper(rom, other);
+	ASSERT_EQ(other->getMemoryPages()[0], defmap->getMemoryPages()[0]);
+	ASSERT_EQ(other->getReadPages()[L_PRGROM >> 12], defmap->getReadPages()[L_PRGROM >> 12]);
+
+	//Writing to PRG-ROM copies the page for that mapper only
+	other->writeMemory(L_PRGROM, 0x42);
+	ASSERT_EQ(other->readMemory(L_PRGROM), 0x42);
+	ASSERT_EQ(defmap->readMemory(L_PRGROM), 0x20);
+	ASSERT_EQ(defmap->getMemoryPages()[0][0], 0x20);
+	delete other;
+	TEARDOWN_DEFMAP;
+}
+
+TEST(DEFAULTMAPPERTEST, readpageTest) {
+	CREATE_DEFMAP;
+
+	//RAM, SRAM and PRG-ROM are read directly, i/o registers are not
+	ASSERT_TRUE(defmap->isPlainPage(L_ZPAGE));
+	ASSERT_TRUE(defmap->isPlainPage(L_SRAM));
+	ASSERT_TRUE(defmap->isPlainPage(L_PRGROM));
+	ASSERT_FALSE(defmap->isPlainPage(L_IOREGBLOCK1));
+	ASSERT_FALSE(defmap->isPlainPage(L_IOREGBLOCK2));
+	ASSERT_EQ(defmap->getReadPages()[L_IOREGBLOCK1 >> 12], (const BYTE*)NULL);
+
+	//Direct reads match readMemory
+	defmap->writeMemory(0x0010, 42);
+	ASSERT_EQ(defmap->getReadPages()[L_ZPAGE >> 12][0x0010], 42);
+	ASSERT_EQ(defmap->getReadPages()[L_PRGROM >> 12][0], defmap->readMemory(L_PRGROM));
+
+	TEARDOWN_DEFMAP;
+}
+
+TEST(DEFAULTMAPPERTEST, mmapTest) {
+	CREATE_DEFMAP;
+	emu::Mapper* mmapped = NULL;
+	emu::Mapper::createMapper(TESTROM, mmapped);
+	ASSERT_EQ(mmapped->getMemoryPageCount(), 1);
+
+	//PRG-ROM matches the stream loader, one bank mirrored
+	for (int addr = L_PRGROM; addr <= 0xFFFF; addr++)
+		ASSERT_EQ(mmapped->readMemory(addr), defmap->readMemory(addr));
+
+	//Writes to PRG-ROM copy the page and leave the file and other mappers alone
+	emu::Mapper* other = NULL;
+	emu::Mapper::createMapper(TESTROM, other);
+	mmapped->writeMemory(L_PRGROM, 0x42);
+	ASSERT_EQ(mmapped->readMemory(L_PRGROM), 0x42);
+	ASSERT_EQ(other->readMemory(L_PRGROM), 0x20);
+	ASSERT_EQ(other->getReadPages()[L_PRGROM >> 12], other->getMemoryPages()[0]);
+
+	ASSERT_THROW(emu::Mapper::createMapper("nosuchrom.nes", other), emu::BadRomException);
+
+	delete other;
+	delete mmapped;
 	TEARDOWN_DEFMAP;
-}
\ No newline at end of file
+}
+
+TEST(DEFAULTMAPPERTEST, storageTest) {
+	CREATE_DEFMAP;
+
+	//Forking, copying every page and power cycling over and over stays within MAPPER_STORAGE
+	for (int round = 0; round < 40; round++) {
+		emu::Mapper* child = defmap->fork();
+		for (int page = 0; page < 16; page++) {
+			if (page == 4 || page == 5)
+				continue;
+			defmap->writeMemory((ADDR_16B)(page << 12 | 0x0100), (BYTE)round);
+			child->writeMemory((ADDR_16B)(page << 12 | 0x0100), (BYTE)(round + 1));
+		}
+		ASSERT_EQ(defmap->readMemory(L_SRAM + 0x0100), (BYTE)round);
+		ASSERT_EQ(child->readMemory(L_SRAM + 0x0100), (BYTE)(round + 1));
+		child->powerCycle();
+		delete child;
+		defmap->powerCycle();
+	}
+	TEARDOWN_DEFMAP;
+}
+
+TEST(DEFAULTMAPPERTEST, romcacheTest) {
+	emu::RomCache& cache = emu::RomCache::instance();
+	size_t cached = cache.getImageCount();
+	BYTE image[64] = { 1, 2, 3 };
+	BYTE copy[64] = { 1, 2, 3 };
+	{
+		std::shared_ptr<BYTE> first = cache.intern(image, sizeof(image));
+		std::shared_ptr<BYTE> second = cache.intern(copy, sizeof(copy));
+		ASSERT_EQ(first, second);
+		ASSERT_EQ(cache.getImageCount(), cached + 1);
+
+		copy[63] = 1;
+		std::shared_ptr<BYTE> third = cache.intern(copy, sizeof(copy));
+		ASSERT_NE(first, third);
+		ASSERT_EQ(cache.getImageCount(), cached + 2);
+	}
+	//Images are freed with their last user
+	ASSERT_EQ(cache.getImageCount(), cached);
+}
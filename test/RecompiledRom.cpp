@@ -0,0 +1,189 @@
+/* Module of romImage() in RecompilerTest.cpp, linked into the tests in place of a shared
+ * object. Output of Recompiler::emit; regenerate it whenever the ROM or the emitter changes.
+ */
+//Generated by the recompiler (tools/Recompile.cpp). Do not edit.
+#include "Recompiled.h"
+
+using namespace emu;
+
+#define NZ(REG) LAZY_NZ(*cpu, cpu->REG.unsigned8)
+
+static const MicroOp ops_8000_0[] = {
+	{ 0xa9, 2, 0x8000 },
+	{ 0x85, 3, 0x8002 },
+	{ 0x18, 2, 0x8004 },
+	{ 0xa5, 3, 0x8005 },
+	{ 0x69, 2, 0x8007 },
+	{ 0x85, 3, 0x8009 },
+	{ 0xe8, 2, 0x800b },
+	{ 0x20, 6, 0x800c },
+};
+
+static int block_8000_0(void* mapper, CPU* cpu, const RecompiledHost* host)
+{
+	const uint32_t gen = host->pagegen[0x8];
+	int err;
+	cpu->accumulator.unsigned8 = 0x0;
+	NZ(accumulator);
+	cpu->progcount = 0x8003;
+	if ((err = host->handlers[0x85](mapper, cpu)) != 0)
+		return 2 << 8 | err;
+	if (host->pagegen[0x8] != gen)
+		return 2 << 8;
+	SETF_CARRY(cpu->procstat, 0);
+	cpu->progcount = 0x8006;
+	if ((err = host->handlers[0xa5](mapper, cpu)) != 0)
+		return 4 << 8 | err;
+	if (host->pagegen[0x8] != gen)
+		return 4 << 8;
+	cpu->progcount = 0x8008;
+	if ((err = host->handlers[0x69](mapper, cpu)) != 0)
+		return 5 << 8 | err;
+	if (host->pagegen[0x8] != gen)
+		return 5 << 8;
+	cpu->progcount = 0x800a;
+	if ((err = host->handlers[0x85](mapper, cpu)) != 0)
+		return 6 << 8 | err;
+	if (host->pagegen[0x8] != gen)
+		return 6 << 8;
+	++cpu->xindex.signed8;
+	NZ(xindex);
+	cpu->progcount = 0x800d;
+	if ((err = host->handlers[0x20](mapper, cpu)) != 0)
+		return 8 << 8 | err;
+	return 8 << 8;
+}
+
+static const MicroOp ops_8004_4[] = {
+	{ 0x18, 2, 0x8004 },
+	{ 0xa5, 3, 0x8005 },
+	{ 0x69, 2, 0x8007 },
+	{ 0x85, 3, 0x8009 },
+	{ 0xe8, 2, 0x800b },
+	{ 0x20, 6, 0x800c },
+};
+
+static int block_8004_4(void* mapper, CPU* cpu, const RecompiledHost* host)
+{
+	const uint32_t gen = host->pagegen[0x8];
+	int err;
+	SETF_CARRY(cpu->procstat, 0);
+	cpu->progcount = 0x8006;
+	if ((err = host->handlers[0xa5](mapper, cpu)) != 0)
+		return 2 << 8 | err;
+	if (host->pagegen[0x8] != gen)
+		return 2 << 8;
+	cpu->progcount = 0x8008;
+	if ((err = host->handlers[0x69](mapper, cpu)) != 0)
+		return 3 << 8 | err;
+	if (host->pagegen[0x8] != gen)
+		return 3 << 8;
+	cpu->progcount = 0x800a;
+	if ((err = host->handlers[0x85](mapper, cpu)) != 0)
+		return 4 << 8 | err;
+	if (host->pagegen[0x8] != gen)
+		return 4 << 8;
+	++cpu->xindex.signed8;
+	NZ(xindex);
+	cpu->progcount = 0x800d;
+	if ((err = host->handlers[0x20](mapper, cpu)) != 0)
+		return 6 << 8 | err;
+	return 6 << 8;
+}
+
+static const MicroOp ops_800f_f[] = {
+	{ 0xc9, 2, 0x800f },
+	{ 0xf0, 3, 0x8011 },
+};
+
+static int block_800f_f(void* mapper, CPU* cpu, const RecompiledHost* host)
+{
+	const uint32_t gen = host->pagegen[0x8];
+	int err;
+	cpu->progcount = 0x8010;
+	if ((err = host->handlers[0xc9](mapper, cpu)) != 0)
+		return 1 << 8 | err;
+	if (host->pagegen[0x8] != gen)
+		return 1 << 8;
+	cpu->progcount = 0x8012;
+	if ((err = host->handlers[0xf0](mapper, cpu)) != 0)
+		return 2 << 8 | err;
+	return 2 << 8;
+}
+
+static const MicroOp ops_8013_13[] = {
+	{ 0x6c, 5, 0x8013 },
+};
+
+static int block_8013_13(void* mapper, CPU* cpu, const RecompiledHost* host)
+{
+	int err;
+	cpu->progcount = 0x8014;
+	if ((err = host->handlers[0x6c](mapper, cpu)) != 0)
+		return 1 << 8 | err;
+	return 1 << 8;
+}
+
+static const MicroOp ops_8016_16[] = {
+	{ 0x6c, 5, 0x8016 },
+};
+
+static int block_8016_16(void* mapper, CPU* cpu, const RecompiledHost* host)
+{
+	int err;
+	cpu->progcount = 0x8017;
+	if ((err = host->handlers[0x6c](mapper, cpu)) != 0)
+		return 1 << 8 | err;
+	return 1 << 8;
+}
+
+static const MicroOp ops_8100_100[] = {
+	{ 0xc8, 2, 0x8100 },
+	{ 0xa5, 3, 0x8101 },
+	{ 0x69, 2, 0x8103 },
+	{ 0x85, 3, 0x8105 },
+	{ 0x60, 6, 0x8107 },
+};
+
+static int block_8100_100(void* mapper, CPU* cpu, const RecompiledHost* host)
+{
+	const uint32_t gen = host->pagegen[0x8];
+	int err;
+	++cpu->yindex.signed8;
+	NZ(yindex);
+	cpu->progcount = 0x8102;
+	if ((err = host->handlers[0xa5](mapper, cpu)) != 0)
+		return 2 << 8 | err;
+	if (host->pagegen[0x8] != gen)
+		return 2 << 8;
+	cpu->progcount = 0x8104;
+	if ((err = host->handlers[0x69](mapper, cpu)) != 0)
+		return 3 << 8 | err;
+	if (host->pagegen[0x8] != gen)
+		return 3 << 8;
+	cpu->progcount = 0x8106;
+	if ((err = host->handlers[0x85](mapper, cpu)) != 0)
+		return 4 << 8 | err;
+	if (host->pagegen[0x8] != gen)
+		return 4 << 8;
+	cpu->progcount = 0x8108;
+	if ((err = host->handlers[0x60](mapper, cpu)) != 0)
+		return 5 << 8 | err;
+	return 5 << 8;
+}
+
+static const RecompiledBlock blocks[] = {
+	{ 0x8000, 0x0, 8, ops_8000_0, block_8000_0 },
+	{ 0x8004, 0x4, 6, ops_8004_4, block_8004_4 },
+	{ 0x800f, 0xf, 2, ops_800f_f, block_800f_f },
+	{ 0x8013, 0x13, 1, ops_8013_13, block_8013_13 },
+	{ 0x8016, 0x16, 1, ops_8016_16, block_8016_16 },
+	{ 0x8100, 0x100, 5, ops_8100_100, block_8100_100 },
+};
+
+static const RecompiledImage image = { RECOMPILED_ABI, 0xc45870f62e9dbed1ull, 6, blocks };
+
+RECOMPILED_EXPORT const RecompiledImage* RECOMPILED_ENTRY_NAME()
+{
+	return &image;
+}
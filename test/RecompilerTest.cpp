@@ -0,0 +1,237 @@
+#include "Emulator.h"
+#include "Test.h"
+#include "Helpers.h"
+#include "Instructions.h"
+#include "Recompiler.h"
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define RECOMPILERTEST RecompilerTest
+
+#define CHUNKS 2000
+
+//Where romProgram and romSubroutine sit in PRG-ROM, as mapped at $8000
+#define PROGRAM_OFFSET 0x0000
+#define SUBROUTINE_OFFSET 0x0100
+
+/* Adds 3 to $10 and 1 to $11 until A reaches $40, then starts over. */
+static OPCODE romProgram[] = {
+	OP_LDA | AMODE_IMMED, 0x00,
+	OP_STA | AMODE_ZPAGE, 0x11,
+	OP_CLC,							//$8004
+	OP_LDA | AMODE_ZPAGE, 0x10,
+	OP_ADC | AMODE_IMMED, 0x03,
+	OP_STA | AMODE_ZPAGE, 0x10,
+	OP_INX,
+	OP_JSRABS, 0x00, 0x81,
+	OP_CMP | AMODE_IMMED, 0x40,		//$800F
+	OP_BEQ, 0x03,
+	OP_JMPABS, 0x04, 0x80,			//$8013
+	OP_JMPABS, 0x00, 0x80			//$8016
+};
+
+static OPCODE romSubroutine[] = {
+	OP_INY,							//$8100
+	OP_LDA | AMODE_ZPAGE, 0x11,
+	OP_ADC | AMODE_IMMED, 0x01,
+	OP_STA | AMODE_ZPAGE, 0x11,
+	OP_RTS
+};
+
+//Blocks the walk from the vectors finds in romProgram and romSubroutine
+static const ADDR_16B romBlocks[] = { 0x8000, 0x8004, 0x800F, 0x8013, 0x8016, 0x8100 };
+
+/* An iNES image of one PRG-ROM bank holding the test program, with every vector on $8000. */
+static std::string romImage()
+{
+	std::string image(INES_HEADER_SIZE + SZ_PRGROM_BLOCK + SZ_CHRROM_BLOCK, '\0');
+	const char header[] = { 'N', 'E', 'S', 0x1A, 1, 1 };
+	image.replace(0, sizeof(header), header, sizeof(header));
+	char* prg = &image[INES_HEADER_SIZE];
+	memcpy(prg + PROGRAM_OFFSET, romProgram, sizeof(romProgram));
+	memcpy(prg + SUBROUTINE_OFFSET, romSubroutine, sizeof(romSubroutine));
+	const ADDR_16B vectors[] = { L_NMIHNDL, L_PORHNDL, L_BRKHNDL };
+	for (ADDR_16B vector : vectors) {
+		prg[vector & (SZ_PRGROM_BLOCK - 1)] = 0x00;
+		prg[(vector & (SZ_PRGROM_BLOCK - 1)) + 1] = (char)0x80;
+	}
+	return image;
+}
+
+static emu::Mapper* romMapper()
+{
+	std::istringstream rom(romImage());
+	emu::Mapper* mapper = NULL;
+	emu::Mapper::createMapper(rom, mapper);
+	for (ADDR_16B addr = 0; addr < SZ_RAM; addr++)
+		mapper->writeMemory(addr, 0);
+	return mapper;
+}
+
+/* Blocks are found from every vector and cut the way Dispatch::BLOCK cuts them. */
+TEST(RECOMPILERTEST, DISCOVERTEST) {
+	std::unique_ptr<emu::Mapper> mapper(romMapper());
+	emu::Recompiler recompiler(*mapper);
+	ASSERT_EQ(recompiler.discover(), (int)(sizeof(romBlocks) / sizeof(romBlocks[0])));
+
+	const std::vector<emu::Recompiler::FoundBlock>& blocks = recompiler.getBlocks();
+	for (size_t i = 0; i < blocks.size(); i++) {
+		const emu::Recompiler::FoundBlock& block = blocks[i];
+		ASSERT_EQ(block.pc, romBlocks[i]);
+		ASSERT_EQ(block.prgoffset, mapper->getPrgOffset(block.pc));
+		ASSERT_EQ(block.ops[0].pc, block.pc);
+		for (size_t op = 0; op < block.ops.size(); op++) {
+			ASSERT_EQ(block.ops[op].code, mapper->readMemory(block.ops[op].pc));
+			ASSERT_EQ(block.ops[op].ticks, emu::OPTICK[block.ops[op].code]);
+		}
+		ASSERT_TRUE(emu::BlockCache::endsBlock(block.ops.back().code));
+	}
+	//Up to and including the JSR
+	ASSERT_EQ(blocks[0].ops.size(), 8u);
+	ASSERT_EQ(blocks[5].ops.back().code, OP_RTS);
+}
+
+/* Pages written to no longer show PRG-ROM and are left to the interpreter. */
+TEST(RECOMPILERTEST, PATCHEDTEST) {
+	std::unique_ptr<emu::Mapper> mapper(romMapper());
+	mapper->writeMemory(0x8100, OP_INY);
+	ASSERT_LT(mapper->getPrgOffset(0x8100), 0);
+	//Mirrors show the copy too
+	ASSERT_LT(mapper->getPrgOffset(0xC100), 0);
+
+	emu::Recompiler recompiler(*mapper);
+	ASSERT_EQ(recompiler.discover(), 0);
+}
+
+/* Generated source names every block and exports the entry point. */
+TEST(RECOMPILERTEST, EMITTEST) {
+	std::unique_ptr<emu::Mapper> mapper(romMapper());
+	emu::Recompiler recompiler(*mapper);
+	recompiler.discover();
+	std::ostringstream source;
+	recompiler.emit(source);
+
+	ASSERT_NE(source.str().find("block_8000_0("), std::string::npos);
+	ASSERT_NE(source.str().find("block_8100_100("), std::string::npos);
+	ASSERT_NE(source.str().find("RECOMPILED_ENTRY_NAME()"), std::string::npos);
+}
+
+static const emu::RecompiledImage* replayImage = NULL;
+static int replayRuns = 0;
+
+/* Stands in for generated code: runs the block's opcodes through the handlers of the host. */
+static int replayBlock(void* mapper, emu::CPU* cpu, const emu::RecompiledHost* host)
+{
+	const emu::RecompiledBlock* block = replayImage->blocks;
+	while (block->pc != cpu->progcount)
+		block++;
+	replayRuns++;
+
+	const uint32_t gen = host->pagegen[block->pc >> 12];
+	for (int i = 0; i < block->count; i++) {
+		cpu->progcount = block->ops[i].pc + 1;
+		int err = host->handlers[block->ops[i].code](mapper, cpu);
+		if (err != 0)
+			return (i + 1) << 8 | err;
+		if (host->pagegen[block->pc >> 12] != gen)
+			return (i + 1) << 8;
+	}
+	return block->count << 8;
+}
+
+/* An attached module runs in place of the interpreter and leaves the same state and ticks. */
+TEST(RECOMPILERTEST, MODULETEST) {
+	std::unique_ptr<emu::Mapper> mapper(romMapper());
+	std::unique_ptr<emu::Mapper> plainmap(romMapper());
+	emu::Recompiler recompiler(*mapper);
+	recompiler.discover();
+	std::vector<emu::RecompiledBlock> blocks;
+	for (const emu::Recompiler::FoundBlock& found : recompiler.getBlocks()) {
+		emu::RecompiledBlock block = { found.pc, found.prgoffset, (int)found.ops.size(), found.ops.data(), replayBlock };
+		blocks.push_back(block);
+	}
+	emu::RecompiledImage image = { RECOMPILED_ABI, emu::RecompiledModule::romHash(*mapper), (int)blocks.size(), blocks.data() };
+	replayImage = &image;
+	replayRuns = 0;
+
+	emu::CPU cpu;
+	emu::initializeCPU(cpu);
+	cpu.progcount = 0x8000;
+	emu::CPU plaincpu = cpu;
+	emu::Emulator2A03 cpuemu(*mapper, cpu);
+	emu::Emulator2A03 plainemu(*plainmap, plaincpu);
+	plainemu.setDispatch(emu::Dispatch::SWITCH);
+	//Attaching moves an emulator that does not cache blocks onto them
+	cpuemu.setDispatch(emu::Dispatch::TABLE);
+	ASSERT_TRUE(cpuemu.attachModule(std::make_shared<emu::RecompiledModule>(&image)));
+	ASSERT_EQ(cpuemu.getDispatch(), emu::Dispatch::BLOCK);
+
+	for (int chunk = 0; chunk < CHUNKS; chunk++) {
+		int budget = 1 + (chunk * 37) % 300;
+		ASSERT_EQ(cpuemu.emulate_cpu(budget), plainemu.emulate_cpu(budget));
+		ASSERT_EQ(cpu.progcount, plaincpu.progcount);
+		ASSERT_EQ(cpu.accumulator.unsigned8, plaincpu.accumulator.unsigned8);
+		ASSERT_EQ(cpu.xindex.unsigned8, plaincpu.xindex.unsigned8);
+		ASSERT_EQ(cpu.yindex.unsigned8, plaincpu.yindex.unsigned8);
+		ASSERT_EQ(cpu.stackp.unsigned8, plaincpu.stackp.unsigned8);
+		ASSERT_EQ(cpu.procstat, plaincpu.procstat);
+		ASSERT_EQ(mapper->readMemory(0x10), plainmap->readMemory(0x10));
+		ASSERT_EQ(mapper->readMemory(0x11), plainmap->readMemory(0x11));
+	}
+	ASSERT_GT(replayRuns, CHUNKS);
+
+	//Built from some other ROM
+	image.romhash ^= 1;
+	ASSERT_FALSE(cpuemu.attachModule(std::make_shared<emu::RecompiledModule>(&image)));
+}
+
+//Entry point of RecompiledRom.cpp
+extern "C" const emu::RecompiledImage* RECOMPILED_ENTRY_NAME();
+
+/* The emitted module of the test ROM, compiled and linked in, holds the blocks discover()
+ * finds and runs them to the same state and ticks as the reference interpreter. */
+TEST(RECOMPILERTEST, COMPILEDTEST) {
+	std::unique_ptr<emu::Mapper> mapper(romMapper());
+	std::unique_ptr<emu::Mapper> plainmap(romMapper());
+	emu::Recompiler recompiler(*mapper);
+	recompiler.discover();
+	const std::vector<emu::Recompiler::FoundBlock>& found = recompiler.getBlocks();
+
+	const emu::RecompiledImage* image = RECOMPILED_ENTRY_NAME();
+	ASSERT_EQ(image->abi, RECOMPILED_ABI);
+	ASSERT_EQ(image->blockcount, (int)found.size());
+	for (int i = 0; i < image->blockcount; i++) {
+		const emu::RecompiledBlock& block = image->blocks[i];
+		ASSERT_EQ(block.pc, found[i].pc);
+		ASSERT_EQ(block.prgoffset, found[i].prgoffset);
+		ASSERT_EQ(block.count, (int)found[i].ops.size());
+		for (int op = 0; op < block.count; op++) {
+			ASSERT_EQ(block.ops[op].code, found[i].ops[op].code);
+			ASSERT_EQ(block.ops[op].ticks, found[i].ops[op].ticks);
+			ASSERT_EQ(block.ops[op].pc, found[i].ops[op].pc);
+		}
+	}
+
+	emu::CPU cpu;
+	emu::initializeCPU(cpu);
+	cpu.progcount = 0x8000;
+	emu::CPU plaincpu = cpu;
+	emu::Emulator2A03 cpuemu(*mapper, cpu);
+	emu::Emulator2A03 plainemu(*plainmap, plaincpu);
+	plainemu.setDispatch(emu::Dispatch::SWITCH);
+	ASSERT_TRUE(cpuemu.attachModule(std::make_shared<emu::RecompiledModule>(image)));
+
+	for (int chunk = 0; chunk < CHUNKS; chunk++) {
+		int budget = 1 + (chunk * 37) % 300;
+		ASSERT_EQ(cpuemu.emulate_cpu(budget), plainemu.emulate_cpu(budget));
+		ASSERT_EQ(cpu.progcount, plaincpu.progcount);
+		ASSERT_EQ(cpu.accumulator.unsigned8, plaincpu.accumulator.unsigned8);
+		ASSERT_EQ(cpu.xindex.unsigned8, plaincpu.xindex.unsigned8);
+		ASSERT_EQ(cpu.yindex.unsigned8, plaincpu.yindex.unsigned8);
+		ASSERT_EQ(cpu.stackp.unsigned8, plaincpu.stackp.unsigned8);
+		ASSERT_EQ(cpu.procstat, plaincpu.procstat);
+		ASSERT_EQ(mapper->readMemory(0x10), plainmap->readMemory(0x10));
+		ASSERT_EQ(mapper->readMemory(0x11), plainmap->readMemory(0x11));
+	}
+}
@@ -0,0 +1,112 @@
+#include "Emulator.h"
+#include "MachinePool.h"
+#include "Test.h"
+#include "Helpers.h"
+#include "Instructions.h"
+
+#define RESETTEST ResetTest
+
+#define INIT_CPUEMU \
+	CREATE_DEFMAP; \
+	emu::CPU cpu; \
+	emu::initializeCPU(cpu); \
+	emu::Emulator2A03 cpuemu(*defmap, cpu); \
+	cpu.progcount = 0x8000;
+
+#define TEARDOWN_CPUEMU \
+	TEARDOWN_DEFMAP;
+
+//Ticks of the test ROM's own start up code run per episode
+#define EPISODE_TICKS 20000
+
+/* A soft reset jumps through the reset vector and keeps memory. */
+TEST(RESETTEST, RESETTEST) {
+	INIT_CPUEMU;
+	defmap->writeMemory(0x10, 42);
+	cpu.stackp.unsigned8 = 0xF0;
+	cpuemu.raiseInterrupt(INT_IRQ_MAPPER);
+	cpuemu.reset();
+
+	ADDR_16B vector = defmap->readMemory(L_PORHNDL) | defmap->readMemory(L_PORHNDL + 1) << 8;
+	ASSERT_EQ(cpu.progcount, vector);
+	ASSERT_EQ(cpu.stackp.unsigned8, 0xED);
+	ASSERT_TRUE(F_INTDIS(cpu.procstat));
+	ASSERT_EQ(cpuemu.getPendingInterrupts(), 0u);
+	ASSERT_EQ(defmap->readMemory(0x10), 42);
+	TEARDOWN_CPUEMU;
+}
+
+/* A power cycle undoes every write, PRG-ROM included, and restarts the clock. */
+TEST(RESETTEST, POWERTEST) {
+	INIT_CPUEMU;
+	BYTE prg = defmap->readMemory(L_PRGROM);
+	cpuemu.emulate_cpu(EPISODE_TICKS);
+	defmap->writeMemory(0x10, 42);
+	defmap->writeMemory(L_SRAM, 7);
+	defmap->writeMemory(L_PRGROM, prg + 1);
+	cpuemu.powerCycle();
+
+	ASSERT_EQ(defmap->readMemory(0x10), 0);
+	ASSERT_EQ(defmap->readMemory(L_SRAM), 0);
+	ASSERT_EQ(defmap->readMemory(L_PRGROM), prg);
+	ASSERT_EQ(defmap->readMemory(L_JOYSTICK1), 0x80);
+	ASSERT_EQ(cpu.stackp.unsigned8, 0xFD);
+	ASSERT_EQ(cpuemu.getCycleCount(), 0u);
+	ASSERT_EQ(cpuemu.getErrorState(), emu::ERROR_STATE::NONE);
+
+	//The same episode again from power-on runs the same way
+	cpuemu.emulate_cpu(EPISODE_TICKS);
+	emu::CPU first = cpuemu.getCopyCPU();
+	BYTE firstram = defmap->readMemory(0x10);
+	cpuemu.powerCycle();
+	cpuemu.emulate_cpu(EPISODE_TICKS);
+	ASSERT_EQ(cpu.progcount, first.progcount);
+	ASSERT_EQ(cpu.accumulator.unsigned8, first.accumulator.unsigned8);
+	ASSERT_EQ(defmap->readMemory(0x10), firstram);
+	TEARDOWN_CPUEMU;
+}
+
+/* Released machines come back powered on, without disturbing the ones still out or
+ * keeping the events, pause and run control of their last user. */
+TEST(RESETTEST, POOLTEST) {
+	CREATE_DEFMAP;
+	emu::MachinePool pool(defmap);
+	std::unique_ptr<emu::Machine> first = pool.acquire();
+	std::unique_ptr<emu::Machine> second = pool.acquire();
+	emu::CPU start = first->cpu;
+
+	first->emulator.emulate_cpu(EPISODE_TICKS);
+	first->mapper->writeMemory(0x10, 42);
+	int fired = 0;
+	first->emulator.getScheduler().schedule(10, [&](uint64_t) { fired++; });
+	emu::RunControl shared;
+	shared.pause();
+	first->emulator.setRunControl(&shared);
+	first->emulator.pauseEmulation();
+	ASSERT_EQ(second->mapper->readMemory(0x10), 0);
+	ASSERT_EQ(second->cpu.progcount, start.progcount);
+
+	emu::Machine* recycled = first.get();
+	pool.release(std::move(first));
+	ASSERT_EQ(pool.getIdleCount(), 1u);
+	std::unique_ptr<emu::Machine> again = pool.acquire();
+	ASSERT_EQ(again.get(), recycled);
+	ASSERT_EQ(pool.getIdleCount(), 0u);
+	ASSERT_EQ(again->mapper->readMemory(0x10), 0);
+	ASSERT_EQ(again->cpu.progcount, start.progcount);
+	ASSERT_EQ(again->cpu.stackp.unsigned8, start.stackp.unsigned8);
+	ASSERT_EQ(again->emulator.getCycleCount(), 0u);
+	ASSERT_EQ(again->emulator.getScheduler().getPendingCount(), 0u);
+
+	//A recycled machine runs an episode as a fresh one does
+	again->emulator.emulate_cpu(EPISODE_TICKS);
+	second->emulator.emulate_cpu(EPISODE_TICKS);
+	ASSERT_EQ(fired, 0);
+	ASSERT_EQ(again->cpu.progcount, second->cpu.progcount);
+	for (int addr = 0; addr < SZ_RAM; addr++)
+		ASSERT_EQ(again->mapper->readMemory(addr), second->mapper->readMemory(addr));
+
+	again.reset();
+	second.reset();
+	rom.close();
+}
@@ -0,0 +1,98 @@
+#include "Emulator.h"
+#include "Test.h"
+#include "Helpers.h"
+#include "Instructions.h"
+
+#define SAVESTATETEST SaveStateTest
+
+#define INIT_CPUEMU \
+	CREATE_DEFMAP; \
+	emu::CPU cpu; \
+	emu::initializeCPU(cpu); \
+	emu::Emulator2A03 cpuemu(*defmap, cpu); \
+	cpu.progcount = 0x8000; \
+	writePatternToMem(*defmap, savestateProgram, sizeof(savestateProgram), 0x8000);
+
+#define TEARDOWN_CPUEMU \
+	TEARDOWN_DEFMAP;
+
+/* Loop that keeps changing RAM and the stack. */
+static OPCODE savestateProgram[] = {
+	OP_LDA | AMODE_ZPAGE, 0x10,
+	OP_ADC | AMODE_IMMED, 0x03,
+	OP_STA | AMODE_ZPAGE, 0x10,
+	OP_PHA,
+	OP_INX,
+	OP_STA | AMODE_ABS, 0x00, 0x03,
+	OP_JMPABS, 0x00, 0x80
+};
+
+static emu::MachineState savedstate;
+
+/* Running on from a restored state repeats the same execution. */
+TEST(SAVESTATETEST, RESTORETEST) {
+	INIT_CPUEMU;
+	cpuemu.emulate_cpu(10000);
+	cpuemu.saveState(savedstate);
+
+	cpuemu.emulate_cpu(5000);
+	emu::CPU after = cpuemu.getCopyCPU();
+	std::vector<BYTE> ram(defmap->getMemory(), defmap->getMemory() + SZ_RAM);
+
+	//Scribble over RAM before restoring
+	for (int addr = 0; addr < SZ_RAM; addr++)
+		defmap->writeMemory(addr, 0xAA);
+	ASSERT_TRUE(cpuemu.restoreState(savedstate));
+	ASSERT_EQ(cpuemu.getCopyCPU().progcount, savedstate.cpu.progcount);
+
+	cpuemu.emulate_cpu(5000);
+	emu::CPU again = cpuemu.getCopyCPU();
+	ASSERT_EQ(again.progcount, after.progcount);
+	ASSERT_EQ(again.accumulator.unsigned8, after.accumulator.unsigned8);
+	ASSERT_EQ(again.xindex.unsigned8, after.xindex.unsigned8);
+	ASSERT_EQ(again.stackp.unsigned8, after.stackp.unsigned8);
+	ASSERT_EQ(again.procstat, after.procstat);
+	for (int addr = 0; addr < SZ_RAM; addr++)
+		ASSERT_EQ(defmap->getMemory()[addr], ram[addr]);
+	TEARDOWN_CPUEMU;
+}
+
+/* A state can be restored into another instance of the same ROM. */
+TEST(SAVESTATETEST, TRANSFERTEST) {
+	INIT_CPUEMU;
+	cpuemu.emulate_cpu(10000);
+	cpuemu.saveState(savedstate);
+
+	emu::Mapper* othermap = NULL;
+	std::ifstream otherrom(TESTROM, std::ifstream::binary);
+	emu::Mapper::createMapper(otherrom, othermap);
+	writePatternToMem(*othermap, savestateProgram, sizeof(savestateProgram), 0x8000);
+	emu::CPU othercpu;
+	emu::initializeCPU(othercpu);
+	emu::Emulator2A03 otheremu(*othermap, othercpu);
+	ASSERT_TRUE(otheremu.restoreState(savedstate));
+
+	ASSERT_EQ(cpuemu.emulate_cpu(5000), otheremu.emulate_cpu(5000));
+	ASSERT_EQ(cpu.progcount, othercpu.progcount);
+	ASSERT_EQ(cpu.accumulator.unsigned8, othercpu.accumulator.unsigned8);
+	ASSERT_EQ(cpu.stackp.unsigned8, othercpu.stackp.unsigned8);
+	for (int addr = 0; addr < L_PRGROM; addr++)
+		ASSERT_EQ(defmap->readMemory(addr), othermap->readMemory(addr));
+	for (int page = 0; page < 16; page++)
+		ASSERT_EQ(othermap->getReadPages()[page] == NULL, defmap->getReadPages()[page] == NULL);
+	delete othermap;
+	TEARDOWN_CPUEMU;
+}
+
+/* A state from a different cartridge layout is refused and changes nothing. */
+TEST(SAVESTATETEST, MISMATCHTEST) {
+	INIT_CPUEMU;
+	cpuemu.emulate_cpu(1000);
+	cpuemu.saveState(savedstate);
+	savedstate.mapper.rp_count = 4;
+	savedstate.cpu.progcount = 0x1234;
+
+	ASSERT_FALSE(cpuemu.restoreState(savedstate));
+	ASSERT_NE(cpuemu.getCopyCPU().progcount, 0x1234);
+	TEARDOWN_CPUEMU;
+}
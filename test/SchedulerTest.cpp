@@ -0,0 +1,110 @@
+#include "Emulator.h"
+#include "Scheduler.h"
+#include "Test.h"
+#include "Helpers.h"
+#include "Instructions.h"
+#include <vector>
+
+#define SCHEDULERTEST SchedulerTest
+
+#define INIT_CPUEMU \
+	CREATE_DEFMAP; \
+	emu::CPU cpu; \
+	emu::initializeCPU(cpu); \
+	emu::Emulator2A03 cpuemu(*defmap, cpu); \
+	cpu.progcount = 0x8000; \
+	writePatternToMem(*defmap, loopProgram, sizeof(loopProgram), 0x8000);
+
+#define TEARDOWN_CPUEMU \
+	TEARDOWN_DEFMAP;
+
+//Longest opcode, the most an event can run after its deadline
+#define MAX_OPTICK 7
+//Ticks between two vblanks in PERIODTEST
+#define FRAME_TICKS 29781
+
+static OPCODE loopProgram[] = {
+	OP_INX,
+	OP_JMPABS, 0x00, 0x80
+};
+
+/* Events run earliest first, ties in the order scheduled, and cancelled ones never. */
+TEST(SCHEDULERTEST, ORDERTEST) {
+	emu::Scheduler scheduler;
+	std::vector<int> ran;
+	scheduler.schedule(100, [&](uint64_t) { ran.push_back(3); });
+	scheduler.schedule(50, [&](uint64_t) { ran.push_back(1); });
+	emu::Scheduler::EventId dropped = scheduler.schedule(60, [&](uint64_t) { ran.push_back(-1); });
+	scheduler.schedule(50, [&](uint64_t) { ran.push_back(2); });
+	ASSERT_EQ(scheduler.ticksUntilNext(1000), 50);
+	ASSERT_EQ(scheduler.ticksUntilNext(20), 20);
+
+	ASSERT_TRUE(scheduler.cancel(dropped));
+	ASSERT_FALSE(scheduler.cancel(dropped));
+	scheduler.advance(70);
+	ASSERT_EQ(ran, std::vector<int>({ 1, 2 }));
+	ASSERT_EQ(scheduler.ticksUntilNext(1000), 30);
+
+	//Scheduled by a handler and already due
+	scheduler.schedule(120, [&](uint64_t when) {
+		ran.push_back(4);
+		scheduler.schedule(when, [&](uint64_t) { ran.push_back(5); });
+	});
+	scheduler.advance(100);
+	ASSERT_EQ(ran, std::vector<int>({ 1, 2, 3, 4, 5 }));
+	ASSERT_EQ(scheduler.now(), 170u);
+	ASSERT_EQ(scheduler.getPendingCount(), 0u);
+}
+
+/* The CPU stops at each deadline, and the clock counts every tick run. */
+TEST(SCHEDULERTEST, DEADLINETEST) {
+	INIT_CPUEMU;
+	emu::Scheduler& scheduler = cpuemu.getScheduler();
+	std::vector<uint64_t> late;
+	for (uint64_t at = 1000; at <= 5000; at += 1000)
+		scheduler.schedule(at, [&](uint64_t when) { late.push_back(scheduler.now() - when); });
+
+	int left = cpuemu.emulate_cpu(10000);
+	ASSERT_EQ(late.size(), 5u);
+	for (uint64_t ticks : late)
+		ASSERT_LT(ticks, (uint64_t)MAX_OPTICK);
+	ASSERT_EQ(cpuemu.getCycleCount(), (uint64_t)(10000 - left));
+	TEARDOWN_CPUEMU;
+}
+
+/* Stopping at deadlines leaves the same ticks and state as running without events. */
+TEST(SCHEDULERTEST, TICKTEST) {
+	INIT_CPUEMU;
+	emu::CPU start = cpuemu.getCopyCPU();
+	for (int budget = 1; budget < 2000; budget += 37) {
+		cpuemu.setCPU(start);
+		int plain = cpuemu.emulate_cpu(budget);
+		emu::CPU run = cpuemu.getCopyCPU();
+
+		cpuemu.setCPU(start);
+		emu::Scheduler& scheduler = cpuemu.getScheduler();
+		for (int at = 3; at < budget; at += 41)
+			scheduler.schedule(scheduler.now() + at, [](uint64_t) {});
+		ASSERT_EQ(cpuemu.emulate_cpu(budget), plain);
+		ASSERT_EQ(run.progcount, cpu.progcount);
+		ASSERT_EQ(run.xindex.unsigned8, cpu.xindex.unsigned8);
+	}
+	TEARDOWN_CPUEMU;
+}
+
+/* An event rescheduling itself each frame, as vblank would, runs once per frame. */
+TEST(SCHEDULERTEST, PERIODTEST) {
+	INIT_CPUEMU;
+	emu::Scheduler& scheduler = cpuemu.getScheduler();
+	int frames = 0;
+	std::function<void(uint64_t)> vblank = [&](uint64_t when) {
+		frames++;
+		scheduler.schedule(when + FRAME_TICKS, vblank);
+	};
+	scheduler.schedule(FRAME_TICKS, vblank);
+
+	cpuemu.emulate_cpu(10 * FRAME_TICKS + 1);
+	ASSERT_EQ(frames, 10);
+	ASSERT_EQ(scheduler.getPendingCount(), 1u);
+	TEARDOWN_CPUEMU;
+}
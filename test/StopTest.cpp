@@ -0,0 +1,97 @@
+#include "Emulator.h"
+#include "Test.h"
+#include "Helpers.h"
+#include "Instructions.h"
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <thread>
+
+#define STOPTEST StopTest
+
+#define INIT_CPUEMU \
+	CREATE_DEFMAP; \
+	emu::CPU cpu; \
+	emu::initializeCPU(cpu); \
+	emu::Emulator2A03 cpuemu(*defmap, cpu); \
+	cpu.progcount = 0x8000; \
+	writePatternToMem(*defmap, loopProgram, sizeof(loopProgram), 0x8000);
+
+#define TEARDOWN_CPUEMU \
+	TEARDOWN_DEFMAP;
+
+//How long the tests leave another thread running before acting on it
+#define SETTLE_MS 20
+
+static OPCODE loopProgram[] = {
+	OP_INX,
+	OP_JMPABS, 0x00, 0x80
+};
+
+/* A stop from another thread ends a run that would otherwise take seconds. */
+TEST(STOPTEST, STOPTEST) {
+	INIT_CPUEMU;
+	std::atomic<int> left(0);
+	std::thread runner([&] { left = cpuemu.emulate_cpu(INT_MAX); });
+	std::this_thread::sleep_for(std::chrono::milliseconds(SETTLE_MS));
+	EXPECT_EQ(cpuemu.stopEmulation(), 1);
+	runner.join();
+
+	ASSERT_GT(left, 0);
+	ASSERT_LT(left, INT_MAX);
+	ASSERT_EQ(cpuemu.getErrorState(), emu::ERROR_STATE::NONE);
+	TEARDOWN_CPUEMU;
+}
+
+/* A stop with no run in progress is taken by the next run, which runs nothing. */
+TEST(STOPTEST, PENDINGTEST) {
+	INIT_CPUEMU;
+	ASSERT_EQ(cpuemu.stopEmulation(), 0);
+	ASSERT_EQ(cpuemu.emulate_cpu(1000), 1000);
+	ASSERT_EQ(cpu.progcount, 0x8000);
+	ASSERT_LE(cpuemu.emulate_cpu(1000), 0);
+	TEARDOWN_CPUEMU;
+}
+
+/* Budgets spanning several polls leave the same ticks and state as many short runs. */
+TEST(STOPTEST, SLICETEST) {
+	INIT_CPUEMU;
+	const int budget = 3 * RUN_POLL_TICKS + 5;
+	int left = cpuemu.emulate_cpu(budget);
+	emu::CPU run = cpuemu.getCopyCPU();
+
+	cpu.progcount = 0x8000;
+	cpu.xindex.unsigned8 = 0;
+	int chunked = budget;
+	while (chunked > 0) {
+		int chunk = chunked < 1000 ? chunked : 1000;
+		chunked += cpuemu.emulate_cpu(chunk) - chunk;
+	}
+
+	ASSERT_EQ(left, chunked);
+	ASSERT_EQ(run.progcount, cpu.progcount);
+	ASSERT_EQ(run.xindex.unsigned8, cpu.xindex.unsigned8);
+	TEARDOWN_CPUEMU;
+}
+
+/* A paused emulator runs nothing until resumed, and a stop still wakes it. */
+TEST(STOPTEST, PAUSETEST) {
+	INIT_CPUEMU;
+	cpuemu.pauseEmulation();
+	std::atomic<int> left(0);
+	std::thread runner([&] { left = cpuemu.emulate_cpu(10000); });
+	std::this_thread::sleep_for(std::chrono::milliseconds(SETTLE_MS));
+	EXPECT_EQ(cpu.xindex.unsigned8, 0);
+	cpuemu.resumeEmulation();
+	runner.join();
+	ASSERT_LE(left, 0);
+
+	cpuemu.pauseEmulation();
+	runner = std::thread([&] { left = cpuemu.emulate_cpu(10000); });
+	std::this_thread::sleep_for(std::chrono::milliseconds(SETTLE_MS));
+	cpuemu.stopEmulation();
+	runner.join();
+	ASSERT_EQ(left, 10000);
+	cpuemu.resumeEmulation();
+	TEARDOWN_CPUEMU;
+}
@@ -0,0 +1,37 @@
+/* Recompile an iNES ROM into the source of a module for RecompiledModule::load.
+ *   Recompile game.nes game_module.cpp
+ *   g++ -O2 -shared -fPIC -Isrc game_module.cpp -o game_module.so
+ */
+#include "Recompiler.h"
+#include <fstream>
+#include <iostream>
+
+int main(int argc, char** argv)
+{
+	if (argc != 3) {
+		std::cerr << "usage: Recompile <rom.nes> <module.cpp>" << std::endl;
+		return 1;
+	}
+
+	emu::Mapper* mapper = NULL;
+	try {
+		emu::Mapper::createMapper(argv[1], mapper);
+	}
+	catch (emu::BadRomException& e) {
+		std::cerr << argv[1] << ": " << e.what() << std::endl;
+		return 1;
+	}
+	std::unique_ptr<emu::Mapper> owner(mapper);
+
+	emu::Recompiler recompiler(*mapper);
+	int blocks = recompiler.discover();
+	std::ofstream out(argv[2]);
+	recompiler.emit(out);
+	out.close();
+	if (!out) {
+		std::cerr << argv[2] << ": write failed" << std::endl;
+		return 1;
+	}
+	std::cout << blocks << " blocks written to " << argv[2] << std::endl;
+	return 0;
+}